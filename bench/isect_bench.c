@@ -0,0 +1,184 @@
+/*
+ * Microbenchmark for damage/capture intersection: damage events per
+ * second against the number of views on one target, for the old
+ * linked list walk and the packed kernels.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "isect.h"
+
+#define TARGET_W 1920
+#define TARGET_H 1080
+#define NDAMAGE 4096
+#define NEVENTS 2000000
+
+typedef struct node {
+	int cap_x, cap_y, cap_width, cap_height;
+	struct node *next;
+} node_t;
+
+typedef struct {
+	int x, y, w, h;
+} rect_t;
+
+static rect_t damage[NDAMAGE];
+static volatile int sink;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* the views tile the target in a grid, like a monitoring wall */
+static void
+tile(int n, int i, int *x, int *y, int *w, int *h)
+{
+	int cols = 1;
+	while (cols * cols < n)
+		cols++;
+	int rows = (n + cols - 1) / cols;
+	*w = TARGET_W / cols;
+	*h = TARGET_H / rows;
+	*x = (i % cols) * *w;
+	*y = (i / cols) * *h;
+}
+
+static double
+bench_list(node_t *first)
+{
+	double start = now();
+	int hits = 0;
+
+	for (int e = 0; e < NEVENTS; e++) {
+		rect_t *d = &damage[e % NDAMAGE];
+		for (node_t *v = first; v; v = v->next) {
+			if ((d->x + d->w < v->cap_x) ||
+			    (d->x > v->cap_x + v->cap_width) ||
+			    (d->y + d->h < v->cap_y) ||
+			    (d->y > v->cap_y + v->cap_height))
+				continue;
+			hits++;
+		}
+	}
+	sink = hits;
+	return NEVENTS / (now() - start);
+}
+
+/* all kernels have to agree with the scalar one */
+static void
+check_kernel(cap_set_t *s, cap_isect_fn fn, const char *name)
+{
+	int ref[s->alloc], got[s->alloc];
+
+	for (int e = 0; e < NDAMAGE; e++) {
+		rect_t *d = &damage[e];
+		int n1 = cap_isect_scalar(s, d->x, d->y, d->x + d->w,
+			d->y + d->h, ref);
+		int n2 = fn(s, d->x, d->y, d->x + d->w, d->y + d->h, got);
+		for (int i = 0; n1 == n2 && i < n1; i++)
+			if (ref[i] != got[i])
+				n2 = -1;
+		if (n1 != n2) {
+			fprintf(stderr, "%s kernel disagrees with scalar\n",
+				name);
+			exit(1);
+		}
+	}
+}
+
+/* what damage_views runs: the scalar loop for few views */
+static double
+bench_set(cap_set_t *s)
+{
+	double start = now();
+	int hits = 0;
+
+	for (int e = 0; e < NEVENTS; e++) {
+		rect_t *d = &damage[e % NDAMAGE];
+		hits += cap_set_intersect(s, d->x, d->y, d->w, d->h);
+	}
+	sink = hits;
+	return NEVENTS / (now() - start);
+}
+
+static double
+bench_kernel(cap_set_t *s, cap_isect_fn fn)
+{
+	double start = now();
+	int hits = 0;
+
+	for (int e = 0; e < NEVENTS; e++) {
+		rect_t *d = &damage[e % NDAMAGE];
+		hits += fn(s, d->x, d->y, d->x + d->w, d->y + d->h, s->hits);
+	}
+	sink = hits;
+	return NEVENTS / (now() - start);
+}
+
+int
+main(void)
+{
+	static const int counts[] = { 1, 2, 4, 8, 16, 40, 100, 400 };
+	const char *best_name;
+	cap_isect_fn best = cap_isect_best(&best_name);
+
+	srand(1);
+	for (int i = 0; i < NDAMAGE; i++) {
+		damage[i].w = 1 + rand() % 64;
+		damage[i].h = 1 + rand() % 64;
+		damage[i].x = rand() % (TARGET_W - damage[i].w);
+		damage[i].y = rand() % (TARGET_H - damage[i].h);
+	}
+
+	printf("events/sec, %d events, best kernel %s\n", NEVENTS, best_name);
+	printf("%6s %12s %12s %12s %12s %12s\n",
+		"views", "list", "scalar", "sse2", best_name, "picked");
+
+	for (int k = 0; k < (int)(sizeof(counts) / sizeof(counts[0])); k++) {
+		int n = counts[k];
+		node_t *first = NULL;
+		cap_set_t s;
+
+		cap_set_init(&s);
+		for (int i = 0; i < n; i++) {
+			int x, y, w, h;
+			tile(n, i, &x, &y, &w, &h);
+			node_t *v = malloc(sizeof(*v));
+			v->cap_x = x;
+			v->cap_y = y;
+			v->cap_width = w;
+			v->cap_height = h;
+			v->next = first;
+			first = v;
+			cap_set_add(&s, v, x, y, w, h);
+		}
+
+#ifdef __SSE2__
+		check_kernel(&s, cap_isect_sse2, "sse2");
+#endif
+		check_kernel(&s, best, best_name);
+
+		printf("%6d %12.0f %12.0f", n, bench_list(first),
+			bench_kernel(&s, cap_isect_scalar));
+#ifdef __SSE2__
+		printf(" %12.0f", bench_kernel(&s, cap_isect_sse2));
+#else
+		printf(" %12s", "-");
+#endif
+		printf(" %12.0f", bench_kernel(&s, best));
+		printf(" %12.0f\n", bench_set(&s));
+
+		while (first) {
+			node_t *next = first->next;
+			free(first);
+			first = next;
+		}
+		cap_set_free(&s);
+	}
+	return 0;
+}
@@ -0,0 +1,314 @@
+/*
+ * Microbenchmarks for the X independent core: state line parsing,
+ * snapping, damage intersection, name interning, context pools and
+ * rule kernels over synthetic inputs. Each benchmark runs until its timing is
+ * stable enough, then reports ns per operation. With -o, results are
+ * appended to a history file and compared with the previous run.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "isect.h"
+#include "pool.h"
+#include "rules.h"
+#include "snap.h"
+#include "state.h"
+
+#define NLINES 10000
+#define NVIEWS 1000
+#define NINPUTS 4096
+#define MIN_TIME 0.2
+
+typedef struct {
+	const char *name;
+	void (*setup)(void);
+	void (*run)(long iters);
+} bench_t;
+
+static volatile long sink;
+
+static double
+now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* state_parse: 10k lines as a long session would save them */
+static char *lines[NLINES];
+static int line_lens[NLINES];
+
+static void
+setup_state(void)
+{
+	char buf[256];
+
+	for (int i = 0; i < NLINES; i++) {
+		line_lens[i] = snprintf(buf, sizeof(buf),
+			"Terminal - user@host: ~/src/project %d "
+			"%d %d %d %d %d %d %d %d %d %d", i % 50,
+			rand() % 1000, rand() % 1000, 8 + rand() % 400,
+			8 + rand() % 300, rand() % 1920, rand() % 1080,
+			rand() % 2, rand() % 4, 1 + rand() % 9, rand() % 3);
+		lines[i] = strdup(buf);
+	}
+}
+
+static void
+run_state(long iters)
+{
+	int vals[STATE_NVALS];
+	long sum = 0;
+
+	for (long i = 0; i < iters; i++) {
+		int k = i % NLINES;
+		sum += parse_state_line(lines[k], line_lens[k],
+			STATE_NVALS, vals);
+		sum += vals[8];
+	}
+	sink = sum;
+}
+
+/* snap: 1k views tiled on a 4k screen, random drop positions */
+static snap_rect_t others[NVIEWS];
+static int pos_x[NINPUTS], pos_y[NINPUTS];
+
+static void
+setup_snap(void)
+{
+	for (int i = 0; i < NVIEWS; i++) {
+		others[i].x = (i % 40) * 96;
+		others[i].y = (i / 40) * 86;
+		others[i].w = 90;
+		others[i].h = 80;
+	}
+	for (int i = 0; i < NINPUTS; i++) {
+		pos_x[i] = rand() % 3840;
+		pos_y[i] = rand() % 2160;
+	}
+}
+
+static void
+run_snap(long iters)
+{
+	long sum = 0;
+
+	for (long i = 0; i < iters; i++) {
+		int x = pos_x[i % NINPUTS], y = pos_y[i % NINPUTS];
+		sum += snap_rect(&x, &y, 90, 80, 3840, 2160, others, NVIEWS);
+		sum += x + y;
+	}
+	sink = sum;
+}
+
+/* isect: 1k capture areas of one target, random damage */
+static cap_set_t caps;
+static int dmg[NINPUTS][4];
+
+static void
+setup_isect(void)
+{
+	cap_set_init(&caps);
+	for (int i = 0; i < NVIEWS; i++)
+		cap_set_add(&caps, &others[i], rand() % 3800, rand() % 2100,
+			8 + rand() % 200, 8 + rand() % 200);
+	for (int i = 0; i < NINPUTS; i++) {
+		dmg[i][0] = rand() % 3840;
+		dmg[i][1] = rand() % 2160;
+		dmg[i][2] = 1 + rand() % 64;
+		dmg[i][3] = 1 + rand() % 64;
+	}
+}
+
+static void
+run_isect(long iters)
+{
+	long sum = 0;
+
+	for (long i = 0; i < iters; i++) {
+		int *d = dmg[i % NINPUTS];
+		sum += cap_set_intersect(&caps, d[0], d[1], d[2], d[3]);
+	}
+	sink = sum;
+}
+
+/* intern: titles that are already interned, as on reconnect checks */
+static char names[NVIEWS][64];
+
+static void
+setup_intern(void)
+{
+	for (int i = 0; i < NVIEWS; i++) {
+		snprintf(names[i], sizeof(names[i]),
+			"Mozilla Firefox - dashboard %d", i);
+		str_intern(names[i]);
+	}
+}
+
+static void
+run_intern(long iters)
+{
+	for (long i = 0; i < iters; i++)
+		str_unref(str_intern(names[i % NVIEWS]));
+}
+
+/* pool: view sized contexts */
+static pool_t pool;
+
+static void
+setup_pool(void)
+{
+	pool_init(&pool, 256, 32);
+}
+
+static void
+run_pool(long iters)
+{
+	void *o[8];
+
+	for (long i = 0; i < iters; i += 8) {
+		for (int k = 0; k < 8; k++)
+			o[k] = pool_get(&pool);
+		for (int k = 0; k < 8; k++)
+			pool_put(&pool, o[k]);
+	}
+}
+
+/* rule kernels: rows of a 256x256 region, color and brightness */
+static uint32_t px_frame[256 * 256], px_color[256];
+static px_near_fn px_near;
+static px_sum_fn px_sum;
+
+static void
+setup_px(void)
+{
+	for (int i = 0; i < 256 * 256; i++)
+		px_frame[i] = rand() & 0x00ffffff;
+	for (int i = 0; i < 256; i++)
+		px_color[i] = 0x00ff0000;
+	px_kernels_best(&px_near, &px_sum, NULL);
+}
+
+static void
+run_px_near(long iters)
+{
+	long sum = 0;
+
+	for (long i = 0; i < iters; i++)
+		sum += px_near(px_frame + (i & 255) * 256, px_color, 256, 16,
+			0x00ffffff);
+	sink = sum;
+}
+
+static void
+run_px_sum(long iters)
+{
+	uint64_t s[4] = { 0 };
+
+	for (long i = 0; i < iters; i++)
+		px_sum(px_frame + (i & 255) * 256, 256, s);
+	sink = s[0] + s[1] + s[2];
+}
+
+static bench_t benches[] = {
+	{ "state_parse_line/10k", setup_state, run_state },
+	{ "snap_rect/1k_views", setup_snap, run_snap },
+	{ "cap_set_intersect/1k_views", setup_isect, run_isect },
+	{ "str_intern_hit/1k_names", setup_intern, run_intern },
+	{ "pool_get_put/256B", setup_pool, run_pool },
+	{ "px_near/256px_row", setup_px, run_px_near },
+	{ "px_sum/256px_row", setup_px, run_px_sum },
+};
+#define NBENCH (sizeof(benches) / sizeof(benches[0]))
+
+/* ns/op of the latest run of each benchmark in the history file */
+static double
+last_result(const char *path, const char *name)
+{
+	char line[512], rev[64], bname[128];
+	double ns, last = 0;
+	long when;
+	FILE *f = path ? fopen(path, "r") : NULL;
+
+	if (!f)
+		return 0;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "%ld\t%63s\t%127s\t%lf", &when, rev,
+		    bname, &ns) == 4 && strcmp(bname, name) == 0)
+			last = ns;
+	fclose(f);
+	return last;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *rev = "-";
+	const char *history = NULL;
+	const char *filter = NULL;
+	FILE *out = NULL;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "r:o:f:")) != -1) {
+		switch (opt) {
+		case 'r':
+			rev = optarg;
+			break;
+		case 'o':
+			history = optarg;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-r rev] [-o history.tsv] "
+				"[-f filter]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	srand(1);
+	printf("%-30s %12s %12s %14s %8s\n", "Benchmark", "Time(ns)",
+		"Iterations", "Items/s", "vs last");
+	for (unsigned b = 0; b < NBENCH; b++) {
+		bench_t *bm = &benches[b];
+		long iters = 1;
+		double t;
+
+		if (filter && !strstr(bm->name, filter))
+			continue;
+		bm->setup();
+		/* grow the batch until it runs long enough to time */
+		for (;;) {
+			double start = now();
+			bm->run(iters);
+			t = now() - start;
+			if (t >= MIN_TIME || iters > (1L << 40))
+				break;
+			iters *= t > MIN_TIME / 100 ?
+				(long)(MIN_TIME * 1.2 / t) + 1 : 10;
+		}
+
+		double ns = t * 1e9 / iters;
+		double last = last_result(history, bm->name);
+		char delta[16] = "-";
+		if (last > 0)
+			snprintf(delta, sizeof(delta), "%+.1f%%",
+				(ns - last) / last * 100);
+		printf("%-30s %12.1f %12ld %14.0f %8s\n", bm->name, ns,
+			iters, iters / t, delta);
+
+		if (history && !out && !(out = fopen(history, "a")))
+			perror(history);
+		if (out)
+			fprintf(out, "%ld\t%s\t%s\t%.2f\n", (long)time(NULL),
+				rev, bm->name, ns);
+	}
+	if (out)
+		fclose(out);
+	return 0;
+}
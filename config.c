@@ -0,0 +1,255 @@
+/*
+ * config file parsing
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <yaml.h>
+
+#include "config.h"
+
+enum { KEY_INT, KEY_LONG, KEY_ENUM, KEY_STR };
+
+static const char *refresh_names[] = {
+	"live", "throttled", "on-demand", "frozen", NULL
+};
+/* in xcb_damage_report_level_t order, then CONFIG_DAMAGE_AUTO */
+static const char *damage_names[] = {
+	"raw", "delta", "bounding-box", "non-empty", "auto", NULL
+};
+static const char *drag_names[] = { "client", "wm", NULL };
+
+static const struct config_key {
+	const char *name;
+	int type;
+	size_t off;
+	long min, max;
+	const char **names;
+} keys[] = {
+	{ "tick_hz", KEY_INT, offsetof(config_t, tick_hz), 0, 1000 },
+	{ "tick_budget_px", KEY_LONG, offsetof(config_t, tick_budget_px),
+		1, 1L << 30 },
+	{ "copy_budget_px", KEY_LONG, offsetof(config_t, copy_budget_px),
+		1, 1L << 30 },
+	{ "refresh", KEY_ENUM, offsetof(config_t, refresh), 0, 0,
+		refresh_names },
+	{ "refresh_fps", KEY_INT, offsetof(config_t, refresh_fps), 1, 9 },
+	{ "flash_period_ms", KEY_INT, offsetof(config_t, flash_period_ms),
+		10, 60000 },
+	{ "flash_on_ms", KEY_INT, offsetof(config_t, flash_on_ms),
+		0, 60000 },
+	{ "tooltip_delay_ms", KEY_INT, offsetof(config_t, tooltip_delay_ms),
+		0, 60000 },
+	{ "snap_distance", KEY_INT, offsetof(config_t, snap_distance),
+		0, 100 },
+	{ "undock_distance", KEY_INT, offsetof(config_t, undock_distance),
+		0, 1000 },
+	{ "border_width", KEY_INT, offsetof(config_t, border_width), 0, 100 },
+	{ "damage", KEY_ENUM, offsetof(config_t, damage_level), 0, 0,
+		damage_names },
+	{ "damage_busy_hz", KEY_INT, offsetof(config_t, damage_busy_hz),
+		1, 1000000 },
+	{ "stats_interval_s", KEY_INT, offsetof(config_t, stats_interval_s),
+		0, 86400 },
+	{ "xres_interval_s", KEY_INT, offsetof(config_t, xres_interval_s),
+		0, 86400 },
+	{ "record_fps", KEY_INT, offsetof(config_t, record_fps), 1, 100 },
+	{ "rule_threads", KEY_INT, offsetof(config_t, rule_threads), 0, 64 },
+	{ "history_frames", KEY_INT, offsetof(config_t, history_frames),
+		0, 10000 },
+	{ "history_s", KEY_INT, offsetof(config_t, history_s), 0, 86400 },
+	{ "history_mb", KEY_INT, offsetof(config_t, history_mb), 0, 65536 },
+	{ "drag", KEY_ENUM, offsetof(config_t, drag), 0, 0, drag_names },
+	/* max is the buffer size */
+	{ "stats_file", KEY_STR, offsetof(config_t, stats_file), 0,
+		sizeof(((config_t *)0)->stats_file) },
+	{ "capture_dir", KEY_STR, offsetof(config_t, capture_dir), 0,
+		sizeof(((config_t *)0)->capture_dir) },
+};
+#define NKEYS (sizeof(keys) / sizeof(keys[0]))
+
+void
+config_defaults(config_t *cfg)
+{
+	memset(cfg, 0, sizeof(*cfg));
+	cfg->tick_hz = 0;
+	cfg->tick_budget_px = 2 << 20;
+	cfg->copy_budget_px = 8 << 20;
+	cfg->refresh = 0;
+	cfg->refresh_fps = 1;
+	cfg->flash_period_ms = 1000;
+	cfg->flash_on_ms = 200;
+	cfg->tooltip_delay_ms = 3000;
+	cfg->snap_distance = 1;
+	cfg->undock_distance = 12;
+	cfg->border_width = 2;
+	cfg->damage_level = CONFIG_DAMAGE_AUTO;
+	cfg->damage_busy_hz = 200;
+	cfg->stats_interval_s = 0;
+	cfg->xres_interval_s = 60;
+	cfg->record_fps = 10;
+	cfg->rule_threads = 2;
+	cfg->history_frames = 30;
+	cfg->history_s = 0;
+	cfg->history_mb = 64;
+	cfg->drag = CONFIG_DRAG_CLIENT;
+}
+
+/*
+ * store value under key, 0 on success
+ */
+static int
+config_set(config_t *cfg, const char *key, const char *value,
+	char *err, int errlen)
+{
+	const struct config_key *k = NULL;
+	char *p = (char *)cfg;
+	char *end;
+	long n;
+
+	for (unsigned i = 0; i < NKEYS; i++)
+		if (strcmp(keys[i].name, key) == 0)
+			k = &keys[i];
+	if (!k) {
+		snprintf(err, errlen, "unknown key \"%s\"", key);
+		return -1;
+	}
+
+	switch (k->type) {
+	case KEY_INT:
+	case KEY_LONG:
+		errno = 0;
+		n = strtol(value, &end, 10);
+		if (end == value || *end || errno ||
+		    n < k->min || n > k->max) {
+			snprintf(err, errlen, "%s: \"%s\" is not a number "
+				"from %ld to %ld", key, value, k->min, k->max);
+			return -1;
+		}
+		if (k->type == KEY_INT)
+			*(int *)(p + k->off) = n;
+		else
+			*(long *)(p + k->off) = n;
+		return 0;
+	case KEY_ENUM:
+		for (int i = 0; k->names[i]; i++) {
+			if (strcmp(k->names[i], value) == 0) {
+				*(int *)(p + k->off) = i;
+				return 0;
+			}
+		}
+		snprintf(err, errlen, "%s: unknown value \"%s\"", key, value);
+		return -1;
+	default:
+		if (strlen(value) >= (size_t)k->max) {
+			snprintf(err, errlen, "%s: too long", key);
+			return -1;
+		}
+		strcpy(p + k->off, value);
+		return 0;
+	}
+}
+
+/*
+ * read the config at path into cfg, keys missing from the file get
+ * their defaults. Returns 0 on success, 1 if there is no file (cfg
+ * gets the defaults) and -1 with a message in err if the file is
+ * broken, leaving cfg alone.
+ */
+int
+config_load(const char *path, config_t *cfg, char *err, int errlen)
+{
+	yaml_parser_t parser;
+	yaml_event_t event;
+	config_t new;
+	char key[64] = "";
+	int depth = 0, ret = 0, done = 0;
+	FILE *f;
+
+	config_defaults(&new);
+	f = fopen(path, "r");
+	if (!f) {
+		if (errno != ENOENT) {
+			snprintf(err, errlen, "%s: %s", path, strerror(errno));
+			return -1;
+		}
+		*cfg = new;
+		return 1;
+	}
+
+	yaml_parser_initialize(&parser);
+	yaml_parser_set_input_file(&parser, f);
+	while (!done && ret == 0) {
+		if (!yaml_parser_parse(&parser, &event)) {
+			snprintf(err, errlen, "%s:%lu: %s", path,
+				(unsigned long)parser.problem_mark.line + 1,
+				parser.problem ? parser.problem : "parse error");
+			ret = -1;
+			break;
+		}
+		int line = event.start_mark.line + 1;
+
+		switch (event.type) {
+		case YAML_STREAM_END_EVENT:
+			done = 1;
+			break;
+		case YAML_MAPPING_START_EVENT:
+			if (++depth > 1) {
+				snprintf(err, errlen, "%s:%d: %s: nested "
+					"values are not supported", path, line,
+					key);
+				ret = -1;
+			}
+			break;
+		case YAML_MAPPING_END_EVENT:
+			depth--;
+			break;
+		case YAML_SEQUENCE_START_EVENT:
+		case YAML_ALIAS_EVENT:
+			snprintf(err, errlen, "%s:%d: lists and aliases are "
+				"not supported", path, line);
+			ret = -1;
+			break;
+		case YAML_SCALAR_EVENT: {
+			const char *s = (const char *)event.data.scalar.value;
+			char msg[256];
+
+			if (depth != 1) {
+				snprintf(err, errlen, "%s:%d: expected "
+					"\"key: value\" lines", path, line);
+				ret = -1;
+			} else if (!key[0]) {
+				snprintf(key, sizeof(key), "%s", s);
+				if (!key[0]) {
+					snprintf(err, errlen, "%s:%d: empty key",
+						path, line);
+					ret = -1;
+				}
+			} else {
+				if (config_set(&new, key, s, msg,
+						sizeof(msg)) < 0) {
+					snprintf(err, errlen, "%s:%d: %s",
+						path, line, msg);
+					ret = -1;
+				}
+				key[0] = '\0';
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		yaml_event_delete(&event);
+	}
+	yaml_parser_delete(&parser);
+	fclose(f);
+
+	if (ret == 0) {
+		if (new.flash_on_ms > new.flash_period_ms)
+			new.flash_on_ms = new.flash_period_ms;
+		*cfg = new;
+	}
+	return ret;
+}
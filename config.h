@@ -0,0 +1,44 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+ * tunables from ~/.config/sniptotop/config.yaml, a flat mapping of
+ * "key: value" lines. Missing keys keep their defaults.
+ */
+typedef struct {
+	int tick_hz;		/* max redraw ticks/s without vsync, 0: no cap */
+	long tick_budget_px;	/* pixels copied per tick */
+	long copy_budget_px;	/* pixels in flight before copies wait */
+	int refresh;		/* policy of new snips, refresh_policy_t order */
+	int refresh_fps;
+	int flash_period_ms;	/* notify flash cycle */
+	int flash_on_ms;	/* red part of the cycle */
+	int tooltip_delay_ms;
+	int snap_distance;
+	int undock_distance;
+	int border_width;	/* read at startup only */
+	int damage_level;	/* xcb damage report level or CONFIG_DAMAGE_AUTO */
+	int damage_busy_hz;	/* auto: damage events/s of a busy target */
+	int stats_interval_s;	/* periodic stats, 0: only on SIGUSR1 */
+	int xres_interval_s;	/* server resource check, 0: off */
+	int record_fps;		/* recordings of snips that aren't throttled */
+	int rule_threads;	/* rule checks, 0: in the main loop; startup */
+	int history_frames;	/* per notify snip, 0: no history */
+	int history_s;		/* max age of history frames, 0: no limit */
+	int history_mb;		/* history pixmaps of all snips */
+	int drag;		/* who moves snips, CONFIG_DRAG_* */
+	char stats_file[512];	/* appended to, empty: stdout */
+	char capture_dir[512];	/* snapshots and recordings, empty: cwd */
+} config_t;
+
+/* damage level picked per target from its damage rate */
+#define CONFIG_DAMAGE_AUTO 4
+
+/* right button drags: sniptotop moves the window, or the WM does */
+#define CONFIG_DRAG_CLIENT 0
+#define CONFIG_DRAG_WM 1
+
+void config_defaults(config_t *cfg);
+int config_load(const char *path, config_t *cfg, char *err, int errlen);
+
+#endif
@@ -0,0 +1,315 @@
+/*
+ * snapshot and recording writer
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "frames.h"
+
+/* recording frames waiting beyond this are dropped, snapshots never */
+#define MAX_QUEUED (64L << 20)
+
+struct frame_stream {
+	char *path;
+	FILE *f;		/* opened by the writer with the first frame */
+	int width;
+	int height;
+	int fps;
+	int failed;
+	uint8_t *yuv;		/* last frame, planar Y, Cb, Cr */
+};
+
+enum { JOB_SNAPSHOT, JOB_FRAME, JOB_CLOSE };
+
+typedef struct job {
+	int kind;
+	char *path;		/* snapshot */
+	frame_stream_t *s;
+	frame_t f;		/* data NULL: repeat */
+	struct job *next;
+} job_t;
+
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static int writer_running;
+static int writer_busy;
+static job_t *queue_head, *queue_tail;
+static long queued_bytes;
+
+static void
+pixel_rgb(const frame_t *f, int x, int y, int *r, int *g, int *b)
+{
+	const uint8_t *p = f->data + (long)y * f->stride + x * 4;
+
+	if (f->msb_first) {
+		*r = p[1];
+		*g = p[2];
+		*b = p[3];
+	} else {
+		*r = p[2];
+		*g = p[1];
+		*b = p[0];
+	}
+}
+
+static void
+write_snapshot(const char *path, const frame_t *f)
+{
+	uint8_t *row = malloc(f->width * 3);
+	FILE *out = fopen(path, "w");
+	int r, g, b;
+
+	if (!row || !out)
+		goto fail;
+	fprintf(out, "P6\n%d %d\n255\n", f->width, f->height);
+	for (int y = 0; y < f->height; y++) {
+		for (int x = 0; x < f->width; x++) {
+			pixel_rgb(f, x, y, &r, &g, &b);
+			row[x * 3] = r;
+			row[x * 3 + 1] = g;
+			row[x * 3 + 2] = b;
+		}
+		if (fwrite(row, 3, f->width, out) != (size_t)f->width)
+			goto fail;
+	}
+	free(row);
+	row = NULL;
+	if (fclose(out) != 0) {
+		out = NULL;
+		goto fail;
+	}
+	return;
+
+fail:
+	fprintf(stderr, "warning: %s: %s\n", path, strerror(errno));
+	free(row);
+	if (out)
+		fclose(out);
+}
+
+/*
+ * BT.601 studio range, what players assume for Y4M without a color
+ * range tag. Outside the frame stays black.
+ */
+static void
+convert_yuv(frame_stream_t *s, const frame_t *f)
+{
+	long n = (long)s->width * s->height;
+	uint8_t *py = s->yuv, *pu = s->yuv + n, *pv = s->yuv + 2 * n;
+	int r, g, b;
+
+	for (int y = 0; y < s->height; y++) {
+		for (int x = 0; x < s->width; x++, py++, pu++, pv++) {
+			if (x >= f->width || y >= f->height) {
+				*py = 16;
+				*pu = *pv = 128;
+				continue;
+			}
+			pixel_rgb(f, x, y, &r, &g, &b);
+			*py = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+			*pu = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+			*pv = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+		}
+	}
+}
+
+static void
+write_frame(frame_stream_t *s, const frame_t *f)
+{
+	if (s->failed)
+		return;
+	if (!s->f) {
+		s->f = fopen(s->path, "w");
+		if (!s->f)
+			goto fail;
+		fprintf(s->f, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+			s->width, s->height, s->fps);
+	}
+	if (f->data)
+		convert_yuv(s, f);
+	fputs("FRAME\n", s->f);
+	if (fwrite(s->yuv, 3, (long)s->width * s->height, s->f) !=
+	    (size_t)s->width * s->height)
+		goto fail;
+	return;
+
+fail:
+	fprintf(stderr, "warning: %s: %s, recording stopped\n", s->path,
+		strerror(errno));
+	s->failed = 1;
+}
+
+static void
+close_stream(frame_stream_t *s)
+{
+	if (s->f && fclose(s->f) != 0 && !s->failed)
+		fprintf(stderr, "warning: %s: %s\n", s->path, strerror(errno));
+	free(s->yuv);
+	free(s->path);
+	free(s);
+}
+
+static void *
+writer_thread(void *arg)
+{
+	pthread_mutex_lock(&writer_lock);
+	while (1) {
+		while (!queue_head)
+			pthread_cond_wait(&writer_cond, &writer_lock);
+		job_t *j = queue_head;
+		queue_head = j->next;
+		if (!queue_head)
+			queue_tail = NULL;
+		writer_busy = 1;
+		pthread_mutex_unlock(&writer_lock);
+
+		switch (j->kind) {
+		case JOB_SNAPSHOT:
+			write_snapshot(j->path, &j->f);
+			break;
+		case JOB_FRAME:
+			write_frame(j->s, &j->f);
+			break;
+		default:
+			close_stream(j->s);
+			break;
+		}
+
+		pthread_mutex_lock(&writer_lock);
+		if (j->f.data)
+			queued_bytes -= (long)j->f.stride * j->f.height;
+		free(j->f.data);
+		free(j->path);
+		free(j);
+		writer_busy = 0;
+		pthread_cond_broadcast(&writer_cond);
+	}
+	return NULL;
+}
+
+/*
+ * run the job right away if there is no thread
+ */
+static void
+queue_job(job_t *j)
+{
+	pthread_t th;
+
+	pthread_mutex_lock(&writer_lock);
+	if (!writer_running) {
+		if (pthread_create(&th, NULL, writer_thread, NULL) != 0) {
+			pthread_mutex_unlock(&writer_lock);
+			if (j->kind == JOB_SNAPSHOT)
+				write_snapshot(j->path, &j->f);
+			else if (j->kind == JOB_FRAME)
+				write_frame(j->s, &j->f);
+			else
+				close_stream(j->s);
+			free(j->f.data);
+			free(j->path);
+			free(j);
+			return;
+		}
+		pthread_detach(th);
+		writer_running = 1;
+	}
+	if (j->f.data)
+		queued_bytes += (long)j->f.stride * j->f.height;
+	if (queue_tail)
+		queue_tail->next = j;
+	else
+		queue_head = j;
+	queue_tail = j;
+	pthread_cond_broadcast(&writer_cond);
+	pthread_mutex_unlock(&writer_lock);
+}
+
+void
+frames_snapshot(const char *path, frame_t *f)
+{
+	job_t *j = calloc(1, sizeof(*j));
+
+	if (!j || !(j->path = strdup(path))) {
+		free(j);
+		free(f->data);
+		return;
+	}
+	j->kind = JOB_SNAPSHOT;
+	j->f = *f;
+	queue_job(j);
+}
+
+frame_stream_t *
+frames_open(const char *path, int width, int height, int fps)
+{
+	frame_stream_t *s = calloc(1, sizeof(*s));
+	long n = (long)width * height;
+
+	if (!s)
+		return NULL;
+	s->path = strdup(path);
+	s->yuv = malloc(3 * n);
+	if (!s->path || !s->yuv) {
+		free(s->path);
+		free(s->yuv);
+		free(s);
+		return NULL;
+	}
+	/* black until the first frame */
+	memset(s->yuv, 16, n);
+	memset(s->yuv + n, 128, 2 * n);
+	s->width = width;
+	s->height = height;
+	s->fps = fps;
+	return s;
+}
+
+int
+frames_put(frame_stream_t *s, frame_t *f)
+{
+	job_t *j = calloc(1, sizeof(*j));
+	int full;
+
+	pthread_mutex_lock(&writer_lock);
+	full = f && queued_bytes + (long)f->stride * f->height > MAX_QUEUED;
+	pthread_mutex_unlock(&writer_lock);
+	if (!j || full) {
+		free(j);
+		if (f)
+			free(f->data);
+		return -1;
+	}
+	j->kind = JOB_FRAME;
+	j->s = s;
+	if (f)
+		j->f = *f;
+	queue_job(j);
+	return 0;
+}
+
+void
+frames_close(frame_stream_t *s)
+{
+	job_t *j = calloc(1, sizeof(*j));
+
+	if (!j) {
+		frames_wait();
+		close_stream(s);
+		return;
+	}
+	j->kind = JOB_CLOSE;
+	j->s = s;
+	queue_job(j);
+}
+
+void
+frames_wait(void)
+{
+	pthread_mutex_lock(&writer_lock);
+	while (queue_head || writer_busy)
+		pthread_cond_wait(&writer_cond, &writer_lock);
+	pthread_mutex_unlock(&writer_lock);
+}
@@ -0,0 +1,37 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stdint.h>
+
+/*
+ * snapshots (binary PPM) and recordings (Y4M, 4:4:4) of snips. All
+ * file access happens on a background thread; the caller only hands
+ * over frames. Frames are 32 bit ZPixmap rows as the X server sends
+ * them, BGRX or XRGB from an MSB first server.
+ */
+typedef struct {
+	int width;
+	int height;
+	int stride;
+	int msb_first;
+	uint8_t *data;		/* malloced, owned by the writer once queued */
+} frame_t;
+
+typedef struct frame_stream frame_stream_t;
+
+void frames_snapshot(const char *path, frame_t *f);
+
+/*
+ * Frames of another size than the stream's are cropped or padded
+ * with black. f NULL repeats the last frame. Returns -1 if the frame
+ * was dropped because the writer is too far behind.
+ */
+frame_stream_t *frames_open(const char *path, int width, int height,
+	int fps);
+int frames_put(frame_stream_t *s, frame_t *f);
+void frames_close(frame_stream_t *s);
+
+/* block until everything queued is written */
+void frames_wait(void);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * frame history of views
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+static int max_frames;
+static int max_age_ms;
+static long budget;
+static void (*drop_fn)(uint32_t id);
+static hist_ring_t *rings;
+static int total_n;
+static long total_bytes;
+
+static long
+ms_between(const struct timeval *a, const struct timeval *b)
+{
+	return (b->tv_sec - a->tv_sec) * 1000L +
+		(b->tv_usec - a->tv_usec) / 1000;
+}
+
+static void
+unlink_ring(hist_ring_t *r)
+{
+	if (r->prev)
+		r->prev->next = r->next;
+	else
+		rings = r->next;
+	if (r->next)
+		r->next->prev = r->prev;
+	r->prev = r->next = NULL;
+}
+
+/*
+ * take the oldest frame out of r, the caller gets its pixmap
+ */
+static hist_frame_t
+take_oldest(hist_ring_t *r)
+{
+	hist_frame_t f = r->f[r->head];
+
+	r->head = (r->head + 1) % r->alloc;
+	r->n--;
+	total_n--;
+	total_bytes -= f.bytes;
+	if (r->n == 0)
+		unlink_ring(r);
+	return f;
+}
+
+static void
+evict_oldest(hist_ring_t *r)
+{
+	hist_frame_t f = take_oldest(r);
+
+	drop_fn(f.id);
+}
+
+/*
+ * the budget is shared, so the oldest frame of all rings goes first
+ */
+static void
+evict_over_budget(void)
+{
+	while (total_bytes > budget && rings) {
+		hist_ring_t *oldest = rings;
+		for (hist_ring_t *r = rings->next; r; r = r->next)
+			if (ms_between(&oldest->f[oldest->head].at,
+				    &r->f[r->head].at) < 0)
+				oldest = r;
+		evict_oldest(oldest);
+	}
+}
+
+void
+hist_configure(int frames, int age_ms, long bytes, void (*drop)(uint32_t id))
+{
+	max_frames = frames;
+	max_age_ms = age_ms;
+	budget = bytes;
+	drop_fn = drop;
+	for (hist_ring_t *r = rings, *next; r; r = next) {
+		next = r->next;
+		while (r->n > max_frames)
+			evict_oldest(r);
+	}
+	evict_over_budget();
+}
+
+int
+hist_enabled(long bytes)
+{
+	return max_frames > 0 && bytes <= budget;
+}
+
+uint32_t
+hist_recycle(hist_ring_t *r, int width, int height)
+{
+	hist_frame_t *f;
+
+	if (r->n == 0 || r->n < max_frames)
+		return 0;
+	f = &r->f[r->head];
+	if (f->width != width || f->height != height)
+		return 0;
+	return take_oldest(r).id;
+}
+
+void
+hist_push(hist_ring_t *r, uint32_t id, int width, int height, long bytes,
+	const struct timeval *at)
+{
+	if (r->n == r->alloc) {
+		int alloc = r->alloc ? r->alloc * 2 : 8;
+		hist_frame_t *f = malloc(alloc * sizeof(*f));
+		if (!f) {
+			drop_fn(id);
+			return;
+		}
+		/* unwrap, oldest first */
+		for (int i = 0; i < r->n; i++)
+			f[i] = r->f[(r->head + i) % r->alloc];
+		free(r->f);
+		r->f = f;
+		r->alloc = alloc;
+		r->head = 0;
+	}
+	if (r->n == 0) {
+		r->next = rings;
+		if (rings)
+			rings->prev = r;
+		rings = r;
+	}
+	r->f[(r->head + r->n) % r->alloc] = (hist_frame_t){
+		id, width, height, bytes, *at
+	};
+	r->n++;
+	r->seq++;
+	total_n++;
+	total_bytes += bytes;
+
+	while (r->n > max_frames)
+		evict_oldest(r);
+	hist_expire(at);
+	evict_over_budget();
+}
+
+void
+hist_expire(const struct timeval *now)
+{
+	if (max_age_ms <= 0)
+		return;
+	for (hist_ring_t *r = rings, *next; r; r = next) {
+		next = r->next;
+		/* keeps the newest, it is what the view shows */
+		while (r->n > 1 &&
+		    ms_between(&r->f[r->head].at, now) > max_age_ms)
+			evict_oldest(r);
+	}
+}
+
+void
+hist_clear(hist_ring_t *r)
+{
+	while (r->n)
+		evict_oldest(r);
+	free(r->f);
+	memset(r, 0, sizeof(*r));
+}
+
+const hist_frame_t *
+hist_get(hist_ring_t *r, unsigned seq)
+{
+	unsigned age = r->seq - seq;
+
+	if (age >= (unsigned)r->n)
+		return NULL;
+	return &r->f[(r->head + r->n - 1 - age) % r->alloc];
+}
+
+unsigned
+hist_oldest(hist_ring_t *r)
+{
+	return r->seq - r->n + 1;
+}
+
+int
+hist_count(void)
+{
+	return total_n;
+}
+
+long
+hist_bytes(void)
+{
+	return total_bytes;
+}
@@ -0,0 +1,58 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdint.h>
+#include <sys/time.h>
+
+/*
+ * recent frames of views, as ids of server-side pixmaps the caller
+ * owns. Each view has a ring of its newest frames, limited in count
+ * and age; all rings together stay within a byte budget, the oldest
+ * frame of all goes first. Frames are numbered per ring, the numbers
+ * of the frames in a ring are consecutive.
+ */
+typedef struct {
+	uint32_t id;
+	int width;
+	int height;
+	long bytes;
+	struct timeval at;
+} hist_frame_t;
+
+typedef struct hist_ring {
+	hist_frame_t *f;	/* n frames from head, oldest first */
+	int alloc;
+	int head;
+	int n;
+	unsigned seq;		/* number of the newest frame */
+	struct hist_ring *prev;	/* rings that hold frames */
+	struct hist_ring *next;
+} hist_ring_t;
+
+/*
+ * limits, applied right away; frames 0 turns history off. drop frees
+ * the pixmap of an evicted frame.
+ */
+void hist_configure(int frames, int max_age_ms, long budget,
+	void (*drop)(uint32_t id));
+int hist_enabled(long bytes);
+
+/*
+ * a pixmap of this size to reuse for the next frame of r, taken out of
+ * r as its oldest frame if it would be evicted anyway, 0 if none
+ */
+uint32_t hist_recycle(hist_ring_t *r, int width, int height);
+void hist_push(hist_ring_t *r, uint32_t id, int width, int height,
+	long bytes, const struct timeval *at);
+/* evict frames older than the age limit */
+void hist_expire(const struct timeval *now);
+void hist_clear(hist_ring_t *r);
+
+/* frame number seq of r, NULL if it is gone */
+const hist_frame_t *hist_get(hist_ring_t *r, unsigned seq);
+unsigned hist_oldest(hist_ring_t *r);
+
+int hist_count(void);
+long hist_bytes(void);
+
+#endif
@@ -0,0 +1,249 @@
+/*
+ * damage/capture rectangle intersection over packed arrays
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "isect.h"
+
+/* vector width in entries the arrays are padded to */
+#define CAP_LANES 8
+
+/*
+ * up to this many views the plain loop beats the vector setup and
+ * mask scan (make bench: 1 view ~190M events/s scalar, ~120M avx2;
+ * from 2 views on the kernels win)
+ */
+#define CAP_SCALAR_MAX 1
+
+void
+cap_set_init(cap_set_t *s)
+{
+	memset(s, 0, sizeof(*s));
+}
+
+void
+cap_set_free(cap_set_t *s)
+{
+	free(s->x1);
+	free(s->y1);
+	free(s->x2);
+	free(s->y2);
+	free(s->owner);
+	free(s->hits);
+	memset(s, 0, sizeof(*s));
+}
+
+static void
+cap_set_pad(cap_set_t *s, int ix)
+{
+	s->x1[ix] = INT32_MAX;
+	s->y1[ix] = INT32_MAX;
+	s->x2[ix] = INT32_MIN;
+	s->y2[ix] = INT32_MIN;
+	s->owner[ix] = NULL;
+}
+
+static int32_t *
+grow_array(int32_t *old, int n, int alloc)
+{
+	int32_t *a = aligned_alloc(32, alloc * sizeof(int32_t));
+
+	if (!a)
+		abort();
+	if (old)
+		memcpy(a, old, n * sizeof(int32_t));
+	free(old);
+	return a;
+}
+
+int
+cap_set_add(cap_set_t *s, void *owner, int x, int y, int w, int h)
+{
+	if (s->n == s->alloc) {
+		int alloc = s->alloc ? s->alloc * 2 : CAP_LANES;
+
+		s->x1 = grow_array(s->x1, s->n, alloc);
+		s->y1 = grow_array(s->y1, s->n, alloc);
+		s->x2 = grow_array(s->x2, s->n, alloc);
+		s->y2 = grow_array(s->y2, s->n, alloc);
+		s->owner = realloc(s->owner, alloc * sizeof(void *));
+		s->hits = realloc(s->hits, alloc * sizeof(int));
+		if (!s->owner || !s->hits)
+			abort();
+		s->alloc = alloc;
+		for (int i = s->n; i < alloc; i++)
+			cap_set_pad(s, i);
+	}
+	s->owner[s->n] = owner;
+	cap_set_update(s, s->n, x, y, w, h);
+
+	return s->n++;
+}
+
+void
+cap_set_update(cap_set_t *s, int ix, int x, int y, int w, int h)
+{
+	s->x1[ix] = x;
+	s->y1[ix] = y;
+	s->x2[ix] = x + w;
+	s->y2[ix] = y + h;
+}
+
+/*
+ * the last entry moves into the hole. Returns its owner, which has to
+ * learn its new index, or NULL if nothing moved.
+ */
+void *
+cap_set_remove(cap_set_t *s, int ix)
+{
+	int last = --s->n;
+	void *moved = NULL;
+
+	if (ix != last) {
+		s->x1[ix] = s->x1[last];
+		s->y1[ix] = s->y1[last];
+		s->x2[ix] = s->x2[last];
+		s->y2[ix] = s->y2[last];
+		s->owner[ix] = s->owner[last];
+		moved = s->owner[ix];
+	}
+	cap_set_pad(s, last);
+
+	return moved;
+}
+
+/*
+ * a damage rectangle touching a capture area counts as a hit, same as
+ * the edge-inclusive test views always used
+ */
+int
+cap_isect_scalar(const cap_set_t *s, int32_t x1, int32_t y1,
+	int32_t x2, int32_t y2, int *hits)
+{
+	int nhits = 0;
+
+	for (int i = 0; i < s->n; i++) {
+		if (x2 < s->x1[i] || x1 > s->x2[i] ||
+		    y2 < s->y1[i] || y1 > s->y2[i])
+			continue;
+		hits[nhits++] = i;
+	}
+	return nhits;
+}
+
+#ifdef __SSE2__
+int
+cap_isect_sse2(const cap_set_t *s, int32_t x1, int32_t y1,
+	int32_t x2, int32_t y2, int *hits)
+{
+	__m128i dx1 = _mm_set1_epi32(x1);
+	__m128i dy1 = _mm_set1_epi32(y1);
+	__m128i dx2 = _mm_set1_epi32(x2);
+	__m128i dy2 = _mm_set1_epi32(y2);
+	int nhits = 0;
+
+	for (int i = 0; i < s->n; i += 4) {
+		__m128i miss;
+
+		miss = _mm_cmplt_epi32(dx2,
+			_mm_load_si128((const __m128i *)(s->x1 + i)));
+		miss = _mm_or_si128(miss, _mm_cmpgt_epi32(dx1,
+			_mm_load_si128((const __m128i *)(s->x2 + i))));
+		miss = _mm_or_si128(miss, _mm_cmplt_epi32(dy2,
+			_mm_load_si128((const __m128i *)(s->y1 + i))));
+		miss = _mm_or_si128(miss, _mm_cmpgt_epi32(dy1,
+			_mm_load_si128((const __m128i *)(s->y2 + i))));
+
+		int mask = ~_mm_movemask_ps(_mm_castsi128_ps(miss)) & 0xf;
+		while (mask) {
+			int bit = __builtin_ctz(mask);
+			hits[nhits++] = i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return nhits;
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+int
+cap_isect_avx2(const cap_set_t *s, int32_t x1, int32_t y1,
+	int32_t x2, int32_t y2, int *hits)
+{
+	__m256i dx1 = _mm256_set1_epi32(x1);
+	__m256i dy1 = _mm256_set1_epi32(y1);
+	__m256i dx2 = _mm256_set1_epi32(x2);
+	__m256i dy2 = _mm256_set1_epi32(y2);
+	int nhits = 0;
+
+	for (int i = 0; i < s->n; i += 8) {
+		__m256i miss;
+
+		miss = _mm256_cmpgt_epi32(
+			_mm256_load_si256((const __m256i *)(s->x1 + i)), dx2);
+		miss = _mm256_or_si256(miss, _mm256_cmpgt_epi32(dx1,
+			_mm256_load_si256((const __m256i *)(s->x2 + i))));
+		miss = _mm256_or_si256(miss, _mm256_cmpgt_epi32(
+			_mm256_load_si256((const __m256i *)(s->y1 + i)), dy2));
+		miss = _mm256_or_si256(miss, _mm256_cmpgt_epi32(dy1,
+			_mm256_load_si256((const __m256i *)(s->y2 + i))));
+
+		int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(miss)) &
+			0xff;
+		while (mask) {
+			int bit = __builtin_ctz(mask);
+			hits[nhits++] = i + bit;
+			mask &= mask - 1;
+		}
+	}
+	return nhits;
+}
+#endif
+
+cap_isect_fn
+cap_isect_best(const char **name)
+{
+	const char *dummy;
+
+	if (!name)
+		name = &dummy;
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2")) {
+		*name = "avx2";
+		return cap_isect_avx2;
+	}
+#endif
+#ifdef __SSE2__
+	*name = "sse2";
+	return cap_isect_sse2;
+#else
+	*name = "scalar";
+	return cap_isect_scalar;
+#endif
+}
+
+/*
+ * indices of all capture areas hit by the damage rectangle end up in
+ * s->hits, returns their number
+ */
+int
+cap_set_intersect(cap_set_t *s, int x, int y, int w, int h)
+{
+	static cap_isect_fn isect;
+
+	if (s->n <= CAP_SCALAR_MAX)
+		return cap_isect_scalar(s, x, y, x + w, y + h, s->hits);
+	if (!isect)
+		isect = cap_isect_best(NULL);
+
+	return isect(s, x, y, x + w, y + h, s->hits);
+}
@@ -0,0 +1,45 @@
+#ifndef ISECT_H
+#define ISECT_H
+
+#include <stdint.h>
+
+/*
+ * capture rectangles of all views of one target, kept as packed
+ * parallel arrays so a damage rectangle can be tested against all of
+ * them with a few vector compares. Entries past n up to the allocated
+ * size are padded with rectangles that never intersect.
+ */
+typedef struct {
+	int n;
+	int alloc;
+	int32_t *x1;
+	int32_t *y1;
+	int32_t *x2;
+	int32_t *y2;
+	void **owner;
+	int *hits;	/* scratch, indices of the last intersection */
+} cap_set_t;
+
+typedef int (*cap_isect_fn)(const cap_set_t *s, int32_t x1, int32_t y1,
+	int32_t x2, int32_t y2, int *hits);
+
+void cap_set_init(cap_set_t *s);
+void cap_set_free(cap_set_t *s);
+int cap_set_add(cap_set_t *s, void *owner, int x, int y, int w, int h);
+void cap_set_update(cap_set_t *s, int ix, int x, int y, int w, int h);
+void *cap_set_remove(cap_set_t *s, int ix);
+int cap_set_intersect(cap_set_t *s, int x, int y, int w, int h);
+
+int cap_isect_scalar(const cap_set_t *s, int32_t x1, int32_t y1,
+	int32_t x2, int32_t y2, int *hits);
+#ifdef __SSE2__
+int cap_isect_sse2(const cap_set_t *s, int32_t x1, int32_t y1,
+	int32_t x2, int32_t y2, int *hits);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+int cap_isect_avx2(const cap_set_t *s, int32_t x1, int32_t y1,
+	int32_t x2, int32_t y2, int *hits);
+#endif
+cap_isect_fn cap_isect_best(const char **name);
+
+#endif
@@ -3,7 +3,13 @@
 #include <X11/Xutil.h>
 #include <X11/cursorfont.h>
 #include <xcb/xcb.h>
+#include <xcb/xcbext.h>
 #include <xcb/damage.h>
+#include <xcb/present.h>
+#include <xcb/screensaver.h>
+#include <xcb/dpms.h>
+#include <xcb/res.h>
+#include <xcb/shm.h>
 #include <xcb/xproto.h>
 #include <xcb/xcb_icccm.h>
 #include <stdio.h>
@@ -15,12 +21,81 @@
 #include <assert.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 #include <errno.h>
+#include <limits.h>
 #include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <time.h>
+#include <ctype.h>
+#include <fcntl.h>
+
+#include "isect.h"
+#include "thumbs.h"
+#include "pool.h"
+#include "state.h"
+#include "snap.h"
+#include "config.h"
+#include "rec.h"
+#include "frames.h"
+#include "rules.h"
+#include "history.h"
 
 int debug = 0;
 int no_restore = 0;
 char state_path[512] = "";
+char thumbs_path[520] = "";
+/*
+ * thumbnails cost a round trip per changed view, so they are saved
+ * every THUMB_SAVE_S and on exit rather than with every state save
+ */
+#define THUMB_SAVE_S 30
+struct timeval last_thumbs;
+int thumbs_stale = 0;		/* the set of views changed */
+char config_path[520] = "";
+char rules_path[520] = "";
+char rules_dir[512] = "";	/* match images, also in a replay */
+
+/* tunables, reloaded when the config file changes */
+config_t cfg;
+int inotify_fd = -1;
+struct timeval last_stats;
+
+/*
+ * -R records the session, -P runs a recording again without a
+ * display: xcb talks to one end of a socketpair, the recorded setup
+ * and replies are written into the other end right before xcb reads
+ * them, and a thread drops the requests. Round trips go through
+ * REPLY(), clock readings through now_tv(). Thumbnails are neither
+ * loaded nor saved while recording or replaying.
+ */
+rec_t rec;
+int recording = 0;
+/* a killed session keeps the passes up to the last flush */
+#define REC_FLUSH_MS 1000
+struct timeval rec_flushed;	/* real clock, not recorded */
+int replaying = 0;
+char replay_dir[64] = "";
+int stub_fd = -1;
+/*
+ * bytes for xcb to read, written by stub_server: a reply bigger than
+ * the socket buffer would block the thread that is going to read it
+ */
+struct stub_out {
+	uint8_t *data;
+	uint32_t len;
+	uint32_t off;
+	struct stub_out *next;
+} *stub_out, **stub_out_tail = &stub_out;
+pthread_mutex_t stub_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t stub_sent = PTHREAD_COND_INITIALIZER;
+int stub_wake[2] = { -1, -1 };
+long replay_events = 0, replay_passes = 0, replay_replies = 0;
+struct timeval replay_start;
 
 const char *program_name = "sniptotop";
 const char *class_name = "sniptotop;SnipToTop";
@@ -33,23 +108,28 @@ int damage_notify_event;
 xcb_window_t top_window;
 static xcb_font_t cursor_font;
 
-int nwindows = 0;
-#define MAX_WINDOWS 1000
 typedef enum {
 	WIN_TYPE_TOP,
 	WIN_TYPE_VIEW,
 	WIN_TYPE_TARGET,
 } win_type_t;
-struct {
+struct win_entry {
 	xcb_window_t window;
 	win_type_t type;
 	void *ctx;
-} windows[MAX_WINDOWS];
+} *windows;
+int nwindows = 0;
+int windows_alloc = 0;
 
+/* created on the first hover, then only mapped and unmapped */
 xcb_window_t tooltip_window = XCB_WINDOW_NONE;
 xcb_gcontext_t tooltip_gc;
+int tooltip_shown = 0;
+int tooltip_w, tooltip_h;
 struct timeval hover_start;
 xcb_window_t hover_window = XCB_WINDOW_NONE;
+xcb_window_t pointer_window = XCB_WINDOW_NONE;
+xcb_window_t focus_window = XCB_WINDOW_NONE;
 int hover_x, hover_y;
 
 static const char *tooltip_lines[] = {
@@ -59,23 +139,240 @@ static const char *tooltip_lines[] = {
 	"To move a snip, right-click and drag.",
 	"To close a snip, focus it and press escape.",
 	"Arrow keys/hjkl resize (lower-right), shift: upper-left.",
+	"r cycles refresh: live, throttled (1-9 fps), on demand, frozen.",
+	"i shows rates, latency and policy in a snip.",
+	"m on two snips puts both in one window, shift+m splits.",
 };
 #define TOOLTIP_NLINES (sizeof(tooltip_lines) / sizeof(tooltip_lines[0]))
 
 int notify_flashing_count = 0;
 
+/*
+ * server resources shared for the whole session: glyph cursors are
+ * created once per glyph, copy GCs once per depth (a GC works on any
+ * drawable of its depth) and refcounted by the views and targets
+ * using them
+ */
+struct {
+	uint16_t ch;
+	xcb_cursor_t cursor;
+} *cursors;
+int ncursors = 0;
+struct {
+	xcb_gcontext_t gc;
+	int refs;
+} copy_gcs[33];
+xcb_gcontext_t hud_gcs[33];	/* text GCs for the HUD, per depth */
+xcb_font_t hud_font;
+#define HUD_FONT "6x13"		/* the HUD lines are 13 pixels apart */
+int n_huds = 0;
+
+/* SIGUSR1 asks for a dump of live resource counts */
+volatile sig_atomic_t stats_requested = 0;
+/* SIGTERM and SIGINT leave the main loop, so the exit saves run */
+volatile sig_atomic_t quit_requested = 0;
+long max_stall_ms = 0;		/* longest main loop pass */
+long last_save_ms = 0;
+long max_save_ms = 0;
+
+/*
+ * what the server holds for this client (X-Resource), compared with
+ * what the tables above account for. The server also counts things
+ * we don't track, so only growth of the difference is a leak.
+ */
+enum { RES_WINDOW, RES_PIXMAP, RES_GC, RES_CURSOR, RES_COLORMAP,
+	RES_DAMAGE, NRES };
+const char *res_names[NRES] = {
+	"WINDOW", "PIXMAP", "GC", "CURSOR", "COLORMAP", "DAMAGE"
+};
+xcb_atom_t res_atoms[NRES];
+int xres_present = 0;
+int xres_sampled = 0;
+int xres_excess[NRES];		/* largest server - expected seen */
+long xres_excess_bytes;		/* same for the pixmap bytes */
+/* pixmap byte counts differ by padding, only more than this is drift */
+#define XRES_BYTES_SLACK (1 << 20)
+struct timeval last_xres;
+
+/*
+ * vsync pacing: with -v N, damaged views are only marked dirty and
+ * get copied once every N vblanks. Vblanks are taken from Present
+ * NotifyMSC on the top window; without Present, or when the server
+ * never completes the MSC request (Xvfb has no real CRTC), a software
+ * timer at 60Hz/N is used instead.
+ */
+int vsync_divisor = 0;
+int vsync_fallback = 0;
+int present_opcode = -1;
+int msc_pending = 0;
+uint32_t msc_serial = 0;
+struct timeval msc_requested;
+struct timeval last_vblank;
+/* the dirty views, so a tick doesn't look at the clean ones */
+struct view_ctx **dirty_views;
+int n_dirty_views = 0;
+int dirty_alloc = 0;
+unsigned long n_flushes = 0;
+#define SOFT_VBLANK_US 16667
+#define MSC_TIMEOUT_MS 100
+
+/*
+ * capture edits (edge drags, arrow keys) only move the capture
+ * rectangle; the cache, the window and the copy follow at most once a
+ * frame. Drags save when they end, keys once they stop repeating.
+ */
+int n_resize_pending = 0;
+struct timeval last_resize;
+int save_pending = 0;
+struct timeval save_requested;
+#define KEY_SAVE_DELAY_MS 500
+
+/* edges of a view window in reach for a resize drag */
+#define EDGE_LEFT 1
+#define EDGE_RIGHT 2
+#define EDGE_TOP 4
+#define EDGE_BOTTOM 8
+
+/*
+ * while the screensaver runs or DPMS has the monitor off, every view
+ * counts as hidden: damage only marks views missed, flashing and HUDs
+ * stand still, and the views catch up in one pass on wake. Without
+ * DPMS 1.2 info events only the screensaver is followed.
+ */
+int screensaver_event = -1;
+int dpms_opcode = -1;
+int saver_on = 0;
+int dpms_off = 0;
+int blanked = 0;
+
+/*
+ * snapshots and recordings: the pixels come through one MIT-SHM
+ * segment, reused and grown as needed, so frames don't go through
+ * the socket. Without the extension, or when the server can't attach
+ * the segment (another host), they come in the GetImage reply.
+ */
+int shm_present = 0;
+struct {
+	xcb_shm_seg_t seg;
+	int id;
+	uint8_t *addr;		/* NULL: no segment */
+	size_t size;
+	int removed;		/* IPC_RMID done, the server has it */
+} shm;
+int n_recordings = 0;
+
+/* 0 if the window manager doesn't move windows for clients */
+xcb_atom_t atom_moveresize = 0;
+
+/*
+ * pixel trigger rules: notify views with rules flash when one turns
+ * true rather than on every change. Damage in a rule region marks the
+ * view, once per pass the area of its rules is fetched and handed to
+ * the rule threads, which wake the main loop through rules_fd. Jobs
+ * are numbered so a recording can say which results a pass collected.
+ */
+rule_set_t rules;
+int rules_fd = -1;
+/* views with rules_dirty or a rule_job, the only ones a pass looks at */
+struct view_ctx **rule_views;
+int n_rule_views = 0;
+int rule_views_alloc = 0;
+unsigned rule_seq = 0;
+int rule_jobs = 0;		/* submitted, not collected yet */
+unsigned long n_rule_checks = 0, n_rule_hits = 0;
+
+/*
+ * output back-pressure: pixels copied since the server last answered
+ * a fence request. Past cfg.copy_budget_px, damaged views stay dirty
+ * (their damage merges) until the fence reply shows the server caught
+ * up.
+ */
+long inflight_px = 0;
+long fence_px = 0;		/* inflight_px when the fence was sent */
+int fence_pending = 0;
+unsigned int fence_seq;
+unsigned long n_throttled = 0;
+
+/*
+ * dirty views are copied once per tick (main loop pass or vblank, at
+ * most cfg.tick_hz a second) in priority order, until the tick's pixel
+ * budget cfg.tick_budget_px is used up
+ */
+unsigned long n_late = 0;
+
+/* damage: auto samples every target's damage for a second */
+#define DAMAGE_SAMPLE_MS 1000
+/* non-empty reports hide where the damage is, re-check that often */
+#define DAMAGE_PROBE_MS 10000
+unsigned long n_level_switches = 0;
+/* coarse targets that go quiet step down from the main loop timer */
+struct timeval last_level_check;
+int n_coarse_seen = 0;
+
+/* targets waiting for a window with their name to show up */
+void **disconnected_targets;
 int n_disconnected = 0;
-#define MAX_DISCONNECTED 100
-void *disconnected_targets[MAX_DISCONNECTED];
+int disconnected_alloc = 0;
+
+/* view and target contexts come from slabs, reused across snips */
+pool_t view_pool;
+pool_t target_pool;
+
+/*
+ * how a view follows its target: every damage, at most refresh_fps
+ * copies per second, only on request (enter, space, expose), or not
+ * at all
+ */
+typedef enum {
+	REFRESH_LIVE,
+	REFRESH_THROTTLED,
+	REFRESH_ON_DEMAND,
+	REFRESH_FROZEN,
+} refresh_policy_t;
 
 struct view_ctx;
+struct mirror_win;
 typedef struct {
 	xcb_window_t target;
 	xcb_window_t wm_target;
 	struct view_ctx *first_view;
+	cap_set_t caps;		/* capture areas of all views, for damage */
 	xcb_damage_damage_t damage;
-	char *name;
+	const char *name;	/* interned */
 	int disconnected;
+	int disc_ix;		/* index in disconnected_targets */
+	int unmapped;
+	/*
+	 * frame cache: the union of all capture areas (target coords),
+	 * refreshed from the target once per damage pass. Views, their
+	 * exposes and an unmapped or disconnected target are all served
+	 * from it.
+	 */
+	uint8_t depth;
+	xcb_gcontext_t gc;
+	xcb_pixmap_t cache;
+	int cache_x;
+	int cache_y;
+	int cache_w;
+	int cache_h;
+	unsigned long n_damage;	/* damage events, for the HUD */
+	/*
+	 * report level of the damage object, with damage: auto it is
+	 * adapted to the last second's damage events and how many of
+	 * the damaged pixels were in the cache (the views' area)
+	 */
+	int level;
+	struct timeval level_since;
+	struct timeval rate_since;
+	unsigned rate_events;
+	long rate_px;
+	long rate_px_in;
+	int dmg_x1;		/* damage not yet pulled into the cache */
+	int dmg_y1;
+	int dmg_x2;
+	int dmg_y2;
+	unsigned copy_seq;	/* last pull into the cache, for its error */
+	struct mirror_win *mirror;	/* -m, no target window here */
 } target_ctx_t;
 
 typedef struct view_ctx {
@@ -87,6 +384,21 @@ typedef struct view_ctx {
 	int cap_width;
 	int cap_height;
 	int button3_pressed;
+	int wm_moving;       /* drag handed to the window manager */
+	int resizing;        /* EDGE_* dragged with button 1, 0: none */
+	struct view_ctx *resize_m;  /* sub-capture whose edges move */
+	int drag_root_x;     /* where the resize drag started */
+	int drag_root_y;
+	int drag_cap[4];     /* capture x, y, w, h of resize_m then */
+	int drag_max[2];     /* its target's width, height, 0: unknown */
+	int drag_moved;      /* a click on the edge raises the target */
+	int drag_view_x;
+	int drag_view_y;
+	int move_pending;    /* window goes to move_x, move_y */
+	int move_x;
+	int move_y;
+	int resize_pending;  /* capture edited, cache and copy not yet */
+	int resize_size;     /* ... and its size, the window follows */
 	int move_offset_x;
 	int move_offset_y;
 	int view_x;
@@ -100,6 +412,54 @@ typedef struct view_ctx {
 	int notify;          /* notify mode enabled (green border) */
 	int notify_flash;    /* content changed, flashing active */
 	struct timeval notify_flash_start;  /* when flashing started */
+	int dirty;           /* damaged, waiting for the next paced update */
+	int dirty_ix;        /* index in dirty_views */
+	int stale;           /* damaged, but the policy holds the copy back */
+	int obscured;        /* fully covered by other windows */
+	int unmapped;        /* minimized or on another workspace */
+	int missed;          /* damaged while hidden, catch up when shown */
+	int late;            /* ticks it was due but over the budget */
+	refresh_policy_t refresh;
+	int refresh_fps;     /* copies per second when throttled */
+	struct timeval last_copy;
+	xcb_pixmap_t still;  /* last frame of a frozen view */
+	uint8_t depth;
+	int cap_ix;          /* index in the target's capture set */
+	unsigned frame_seq;  /* counts copies into the view */
+	unsigned thumb_seq;  /* frame_seq when thumb was taken */
+	thumb_buf_t *thumb;  /* last frame as persisted */
+	frame_stream_t *stream;  /* recording, NULL if none */
+	int stream_fps;
+	struct timeval stream_start;
+	long stream_frames;  /* frames due so far, written or dropped */
+	long stream_dropped;
+	unsigned stream_seq; /* frame_seq of the last recorded frame */
+	uint64_t rule_mask;  /* rules for the target's name */
+	uint64_t rule_state; /* their last results */
+	uint64_t rule_known; /* results since the rules were (re)loaded */
+	int rules_dirty;     /* damage in a rule region */
+	unsigned rule_job;   /* job in flight, 0: none */
+	int rule_pos;        /* in rule_views + 1, 0: not there */
+	hist_ring_t hist;    /* recent frames of a notify view */
+	unsigned hist_show;  /* frame shown instead of the content, 0: none */
+	int hist_new;        /* damaged since the last history frame */
+	int hud;             /* show rates and latency over the content */
+	int damage_pending;  /* damaged_at is waiting for a copy */
+	struct timeval damaged_at;
+	long latency_us;     /* last damage to copy */
+	unsigned long hud_damage;  /* counters at hud_since */
+	unsigned hud_copies;
+	struct timeval hud_since;
+	int damage_rate;
+	int copy_rate;
+	/*
+	 * composite: sub-captures share the window of the first one, the
+	 * group, and are laid out in a row inside it
+	 */
+	struct view_ctx *group;        /* NULL if v owns its window */
+	struct view_ctx *next_member;  /* next sub-capture of the group */
+	int sub_x;           /* capture position in the window content */
+	int sub_y;
 	struct view_ctx *next_view;
 } view_ctx_t;
 
@@ -115,7 +475,7 @@ typedef struct {
 	top_state_t state;
 	xcb_window_t sel_target;
 	xcb_window_t sel_wm_target;
-	char *sel_name;
+	const char *sel_name;	/* interned */
 	int sel_x1;
 	int sel_y1;
 	int sel_x2;
@@ -132,9 +492,127 @@ typedef struct {
     uint32_t   status;
 } motif_hints_t;
 
+/*
+ * mirrors, -m: snips of windows on other displays. Each source display
+ * gets a reader thread with its own connection, which follows the
+ * damage of the mirrored windows there and fetches the damaged part
+ * of their cache area into a buffer, an MIT-SHM segment both servers
+ * attach when they can. The main loop puts filled buffers into the
+ * cache of the mirror target and damages its views like any target's.
+ * A buffer is refilled once its put completed, until then damage
+ * merges in the reader: a slow display gets fewer, larger updates and
+ * never holds up the main loop.
+ */
+#define MIRROR_BUFS 2
+
+enum { MBUF_FREE, MBUF_READY, MBUF_BUSY };
+
+typedef struct {
+	int state;		/* MBUF_*, under the source's lock */
+	int x;			/* area in the source window */
+	int y;
+	int w;
+	int h;
+	uint8_t *addr;
+	size_t size;
+	int shmid;		/* -1: malloced */
+	int removed;		/* IPC_RMID done */
+	xcb_shm_seg_t src_seg;	/* on the source display, 0: none */
+	xcb_shm_seg_t seg;	/* on ours, 0: none */
+	xcb_shm_seg_t old_seg;	/* on ours, of a replaced segment */
+	int no_seg;		/* ours can't attach or put from it */
+	unsigned int attach_seq;	/* of the attach of seg */
+	unsigned int put_seq;	/* of the SHM put in flight */
+} mirror_buf_t;
+
+struct mirror_src;
+typedef struct mirror_win {
+	struct mirror_src *src;
+	char *name;
+	target_ctx_t *t;	/* main loop, NULL once its views are gone */
+	xcb_window_t window;	/* reader, 0 until found */
+	xcb_damage_damage_t damage;
+	int win_w;
+	int win_h;
+	int warned;
+	/* under the source's lock */
+	int closed;
+	int area_x1;		/* the cache, window coords */
+	int area_y1;
+	int area_x2;
+	int area_y2;
+	int dmg_x1;		/* not fetched yet */
+	int dmg_y1;
+	int dmg_x2;
+	int dmg_y2;
+	mirror_buf_t buf[MIRROR_BUFS];
+	struct mirror_win *next;
+} mirror_win_t;
+
+typedef struct mirror_src {
+	char *display;
+	int msb_first;		/* image byte order of our display */
+	int wake[2];		/* main loop to the reader */
+	pthread_mutex_t lock;
+	int wake_errno;		/* of a failed write to mirror_fd */
+	mirror_win_t *wins;
+	struct mirror_src *next;
+} mirror_src_t;
+
+const char *mirror_specs[16];
+int n_mirror_specs = 0;
+mirror_src_t *mirror_srcs;
+int mirror_fd[2] = { -1, -1 };	/* readers to the main loop */
+int shm_completion_event = -1;
+unsigned long n_mirror_puts = 0, n_mirror_px = 0;
+
 xcb_atom_t get_atom(xcb_connection_t *c, const char *name);
 xcb_window_t find_wm_window(xcb_window_t win);
 void set_border_color(view_ctx_t *v, uint32_t color);
+void clear_view_dirty(view_ctx_t *v);
+void update_target_damage(target_ctx_t *t);
+void update_target_cache(target_ctx_t *t);
+void free_target_cache(target_ctx_t *t);
+view_ctx_t *leave_group(view_ctx_t *v);
+void layout_group(view_ctx_t *g);
+void merge_views(view_ctx_t *dst, view_ctx_t *src);
+int initial_damage_level(void);
+void update_blanked(void);
+void *recorded_reply(const char *name, void *reply);
+void stub_reply(const char *name, unsigned int sequence);
+void stop_recording(view_ctx_t *v);
+void shm_release(void);
+void assign_rules(view_ctx_t *v);
+void update_rule_views(view_ctx_t *v);
+void start_notify_flash(view_ctx_t *v);
+void free_hud_gcs(void);
+void save_later(void);
+long pixmap_bytes(int depth, int w, int h);
+void damage_views(target_ctx_t *t, int x, int y, int w, int h);
+void mirror_area(target_ctx_t *t);
+void mirror_detach(target_ctx_t *t);
+void put_image_rows(xcb_drawable_t d, xcb_gcontext_t gc, int x, int y,
+	int w, int h, int depth, int stride, const uint8_t *data);
+
+/*
+ * all round trips, so they are recorded and replayed. cookie is used
+ * twice and has to be a plain variable.
+ */
+#define REPLY(fn, cookie, err) \
+	((fn##_t *)recorded_reply(#fn, \
+		(stub_reply(#fn, (cookie).sequence), fn(c, cookie, err))))
+
+/* first half of an 'm' merge, shown with a yellow border */
+view_ctx_t *merge_pending;
+
+/*
+ * the view a drag: wm move is out for. A WM that ignores the request
+ * or an EnterNotify that never comes would leave it stuck, so the
+ * pointer is checked that often until button 3 is up.
+ */
+#define WM_MOVE_CHECK_MS 500
+view_ctx_t *wm_move_view;
+struct timeval wm_move_check;
 
 void
 deb(const char *msg, ...)
@@ -165,11 +643,368 @@ fail(const char *msg, ...)
 	exit(EXIT_FAILURE);
 }
 
+/*
+ * the recording is used up, a session that was killed may end in
+ * the middle of a pass
+ */
+void
+replay_end(void)
+{
+	struct timeval end;
+
+	replaying = 0;
+	gettimeofday(&end, NULL);
+	printf("replay: %ld events, %ld passes, %ld round trips in %ld ms\n",
+		replay_events, replay_passes, replay_replies,
+		(end.tv_sec - replay_start.tv_sec) * 1000 +
+		(end.tv_usec - replay_start.tv_usec) / 1000);
+	exit(EXIT_SUCCESS);
+}
+
+/*
+ * next record of a replay, it has to be tag/name
+ */
+void *
+replay_get(int tag, const char *name, uint32_t *len)
+{
+	void *data;
+	uint32_t n;
+
+	if (rec_peek(&rec) < 0 && replay_passes > 0)
+		replay_end();
+	if (rec_get(&rec, tag, name, &data, len ? len : &n) < 0) {
+		/* the exit handlers read the clock too */
+		replaying = 0;
+		fail("replay: %s", rec.err);
+	}
+	return data;
+}
+
+void
+now_tv(struct timeval *tv)
+{
+	if (replaying) {
+		uint32_t len;
+		void *data = replay_get(REC_TIME, NULL, &len);
+		if (!data || len != sizeof(*tv))
+			fail("replay: bad clock record %ld", rec.count);
+		memcpy(tv, data, sizeof(*tv));
+		free(data);
+		return;
+	}
+	gettimeofday(tv, NULL);
+	if (recording)
+		rec_put(&rec, REC_TIME, NULL, tv, sizeof(*tv));
+}
+
+/*
+ * replay: queue malloced data for stub_server to write to xcb
+ */
+void
+stub_feed(uint8_t *data, uint32_t len)
+{
+	struct stub_out *o = malloc(sizeof(*o));
+
+	if (!o)
+		fail("replay: out of memory");
+	o->data = data;
+	o->len = len;
+	o->off = 0;
+	o->next = NULL;
+	pthread_mutex_lock(&stub_lock);
+	*stub_out_tail = o;
+	stub_out_tail = &o->next;
+	pthread_mutex_unlock(&stub_lock);
+	if (write(stub_wake[1], "", 1) < 0 && errno != EAGAIN)
+		fail("replay: stub wake: %s", strerror(errno));
+}
+
+/* wait until xcb can read all that was fed, for polls */
+void
+stub_drain(void)
+{
+	pthread_mutex_lock(&stub_lock);
+	while (stub_out)
+		pthread_cond_wait(&stub_sent, &stub_lock);
+	pthread_mutex_unlock(&stub_lock);
+}
+
+/*
+ * replay: put the recorded reply to the request with this sequence
+ * number where xcb is going to read it. A missing reply comes back
+ * as an error.
+ */
+void
+stub_reply(const char *name, unsigned int sequence)
+{
+	uint8_t error[32] = { 0, XCB_WINDOW };
+	uint32_t len;
+	uint8_t *r;
+
+	if (!replaying)
+		return;
+	r = replay_get(REC_REPLY, name, &len);
+	if (r && len < 32)
+		fail("replay: short reply record %ld", rec.count);
+	if (!r) {
+		r = malloc(sizeof(error));
+		if (!r)
+			fail("replay: out of memory");
+		memcpy(r, error, sizeof(error));
+		len = sizeof(error);
+	}
+	r[2] = sequence & 0xff;
+	r[3] = (sequence >> 8) & 0xff;
+	stub_feed(r, len);
+	replay_replies++;
+}
+
+void *
+recorded_reply(const char *name, void *reply)
+{
+	uint32_t len = 0;
+
+	if (!recording)
+		return reply;
+	if (reply)
+		len = 32 + 4 * ((xcb_generic_reply_t *)reply)->length;
+	rec_put(&rec, REC_REPLY, name, reply, len);
+	return reply;
+}
+
+/*
+ * xcb looks an extension up before its first request goes out, with
+ * a round trip of its own. Looking it up here first gets that one
+ * recorded; a replay hands the reply to the next request.
+ */
+const xcb_query_extension_reply_t *
+extension_data(xcb_extension_t *ext)
+{
+	const xcb_query_extension_reply_t *r;
+
+	if (replaying)
+		stub_reply(ext->name, xcb_no_operation(c).sequence + 1);
+	r = xcb_get_extension_data(c, ext);
+	if (recording)
+		rec_put(&rec, REC_REPLY, ext->name, r,
+			r ? 32 + 4 * r->length : 0);
+	return r;
+}
+
+/*
+ * the config and state files are part of a recording. A replay puts
+ * the recorded contents at path before it is read. NULL path records
+ * a missing file.
+ */
+void
+recorded_file(const char *name, const char *path)
+{
+	uint32_t len = 0;
+	char *data = NULL;
+	FILE *f;
+
+	if (replaying) {
+		data = replay_get(REC_FILE, name, &len);
+		if (!data) {
+			unlink(path);
+			return;
+		}
+		f = fopen(path, "w");
+		if (!f || fwrite(data, 1, len, f) != len)
+			fail("replay: %s: %s", path, strerror(errno));
+		fclose(f);
+		free(data);
+		return;
+	}
+	if (!recording)
+		return;
+
+	f = path ? fopen(path, "r") : NULL;
+	if (f) {
+		long n = 0;
+		size_t got;
+		data = malloc(4096);
+		while (data && (got = fread(data + n, 1, 4096, f)) > 0) {
+			n += got;
+			data = realloc(data, n + 4096);
+		}
+		fclose(f);
+		len = n;
+	}
+	rec_put(&rec, REC_FILE, name, data, len);
+	free(data);
+}
+
+/*
+ * bytes xcb handed out for an event: generic events carry their
+ * extra data after full_sequence
+ */
+size_t
+event_size(xcb_generic_event_t *e)
+{
+	if ((e->response_type & ~0x80) == XCB_GE_GENERIC)
+		return sizeof(xcb_ge_generic_event_t) +
+			4 * ((xcb_ge_generic_event_t *)e)->length;
+	return sizeof(*e);
+}
+
+/*
+ * write what fits of the oldest queued data, drop it once it is out
+ */
+void
+stub_send(void)
+{
+	struct stub_out *o;
+	ssize_t n;
+
+	pthread_mutex_lock(&stub_lock);
+	o = stub_out;
+	pthread_mutex_unlock(&stub_lock);
+	if (!o)
+		return;
+	n = write(stub_fd, o->data + o->off, o->len - o->off);
+	if (n < 0 && errno != EAGAIN && errno != EINTR)
+		fail("replay: stub write: %s", strerror(errno));
+	if (n > 0)
+		o->off += n;
+	if (o->off < o->len)
+		return;
+	pthread_mutex_lock(&stub_lock);
+	stub_out = o->next;
+	if (!stub_out)
+		stub_out_tail = &stub_out;
+	pthread_cond_broadcast(&stub_sent);
+	pthread_mutex_unlock(&stub_lock);
+	free(o->data);
+	free(o);
+}
+
+/*
+ * replay: the server side of the stub connection. The setup may only
+ * go out once the client's connection request is in, xcb parses
+ * anything that arrives earlier as events. Requests are dropped,
+ * queued replies written as xcb reads them.
+ */
+void *
+stub_server(void *arg)
+{
+	uint8_t *setup = arg;
+	uint32_t len;
+	char buf[65536];
+	int got = 0, n;
+	struct pollfd pfd[2] = {
+		{ .fd = stub_fd },
+		{ .fd = stub_wake[0], .events = POLLIN },
+	};
+
+	memcpy(&len, setup, sizeof(len));
+	/* byte order, version, no authorization: 12 bytes */
+	while (got < 12 && (n = read(stub_fd, buf, 12 - got)) > 0)
+		got += n;
+	if (got < 12 || write(stub_fd, setup + sizeof(len), len) != len)
+		fail("replay: stub connection setup failed");
+	free(setup);
+	fcntl(stub_fd, F_SETFL, O_NONBLOCK);
+	while (1) {
+		pthread_mutex_lock(&stub_lock);
+		pfd[0].events = stub_out ? POLLIN | POLLOUT : POLLIN;
+		pthread_mutex_unlock(&stub_lock);
+		if (poll(pfd, 2, -1) < 0 && errno != EINTR)
+			break;
+		while (read(stub_wake[0], buf, sizeof(buf)) > 0)
+			;
+		if (pfd[0].revents & (POLLIN | POLLHUP)) {
+			n = read(stub_fd, buf, sizeof(buf));
+			if (n == 0 || (n < 0 && errno != EAGAIN &&
+			    errno != EINTR))
+				break;
+		}
+		if (pfd[0].revents & POLLOUT)
+			stub_send();
+	}
+	return NULL;
+}
+
+void
+remove_replay_dir(void)
+{
+	char path[96];
+
+	snprintf(path, sizeof(path), "%s/config.yaml", replay_dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/rules.yaml", replay_dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/state", replay_dir);
+	unlink(path);
+	rmdir(replay_dir);
+}
+
+/*
+ * files of a replay go to a scratch directory, the real config and
+ * state stay untouched
+ */
+void
+initialize_replay(const char *path)
+{
+	uint32_t len;
+	void *data;
+
+	if (rec_open(&rec, path) < 0)
+		fail("replay: %s", rec.err);
+	replaying = 1;
+	data = replay_get(REC_OPTIONS, "vsync", &len);
+	if (!data || len != sizeof(vsync_divisor))
+		fail("replay: bad options record");
+	memcpy(&vsync_divisor, data, sizeof(vsync_divisor));
+	free(data);
+
+	snprintf(replay_dir, sizeof(replay_dir),
+		"/tmp/sniptotop-replay-XXXXXX");
+	if (!mkdtemp(replay_dir))
+		fail("replay: mkdtemp: %s", strerror(errno));
+	atexit(remove_replay_dir);
+	snprintf(config_path, sizeof(config_path), "%s/config.yaml",
+		replay_dir);
+	snprintf(rules_path, sizeof(rules_path), "%s/rules.yaml",
+		replay_dir);
+	snprintf(state_path, sizeof(state_path), "%s/state", replay_dir);
+	thumbs_path[0] = '\0';
+	no_restore = 0;
+}
+
+void
+flush_recording(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	if ((now.tv_sec - rec_flushed.tv_sec) * 1000 +
+	    (now.tv_usec - rec_flushed.tv_usec) / 1000 < REC_FLUSH_MS)
+		return;
+	fflush(rec.f);
+	rec_flushed = now;
+}
+
+void
+initialize_recording(const char *path)
+{
+	if (rec_create(&rec, path) < 0)
+		fail("record: %s", rec.err);
+	recording = 1;
+	rec_put(&rec, REC_OPTIONS, "vsync", &vsync_divisor,
+		sizeof(vsync_divisor));
+	thumbs_path[0] = '\0';
+}
+
 int
 add_window(xcb_window_t w, win_type_t type, void *ctx)
 {
-	if (nwindows >= MAX_WINDOWS)
-		fail("Too many windows");
+	if (nwindows == windows_alloc) {
+		windows_alloc = windows_alloc ? windows_alloc * 2 : 64;
+		windows = realloc(windows, windows_alloc * sizeof(windows[0]));
+		if (!windows)
+			fail("out of memory for %d windows", windows_alloc);
+	}
 	windows[nwindows].window = w;
 	windows[nwindows].type = type;
 	windows[nwindows].ctx = ctx;
@@ -177,13 +1012,24 @@ add_window(xcb_window_t w, win_type_t type, void *ctx)
 	return 0;
 }
 
+/*
+ * sub-captures of a composite are registered with the window of their
+ * group, lookups by window only find the group
+ */
+int
+is_member(int i)
+{
+	return windows[i].type == WIN_TYPE_VIEW &&
+		((view_ctx_t *)windows[i].ctx)->group;
+}
+
 int
 rem_window(xcb_window_t w)
 {
 	int i;
 
 	for (i = 0; i < nwindows; i++) {
-		if (windows[i].window == w) {
+		if (windows[i].window == w && !is_member(i)) {
 			break;
 		}
 	}
@@ -194,11 +1040,25 @@ rem_window(xcb_window_t w)
 	return 0;
 }
 
+void
+rem_view_entry(view_ctx_t *v)
+{
+	int i;
+
+	for (i = 0; i < nwindows; i++)
+		if (windows[i].ctx == v)
+			break;
+	if (i == nwindows)
+		fail("rem_view_entry: view 0x%x not found", v->window);
+	windows[i] = windows[nwindows - 1];
+	nwindows--;
+}
+
 int
 find_window(xcb_window_t win)
 {
 	for (int i = 0; i < nwindows; i++) {
-		if (windows[i].window == win) {
+		if (windows[i].window == win && !is_member(i)) {
 			deb("found window 0x%x type %d\n",
 				win, windows[i].type);
 			return i;
@@ -207,13 +1067,89 @@ find_window(xcb_window_t win)
 	return -1;
 }
 
+view_ctx_t *
+view_group(view_ctx_t *v)
+{
+	return v->group ? v->group : v;
+}
+
+/*
+ * size of the window of group g, the row of its sub-captures and the
+ * border around them
+ */
+void
+view_window_size(view_ctx_t *g, int *w, int *h)
+{
+	*w = *h = 0;
+	for (view_ctx_t *m = g; m; m = m->next_member) {
+		if (m->sub_x + m->cap_width > *w)
+			*w = m->sub_x + m->cap_width;
+		if (m->sub_y + m->cap_height > *h)
+			*h = m->sub_y + m->cap_height;
+	}
+	*w += 2 * border_width;
+	*h += 2 * border_width;
+}
+
+/*
+ * the sub-capture of group g at window position x,y, g itself where
+ * there is none
+ */
+view_ctx_t *
+view_at(view_ctx_t *g, int x, int y)
+{
+	x -= border_width;
+	y -= border_width;
+	for (view_ctx_t *m = g; m; m = m->next_member)
+		if (x >= m->sub_x && x < m->sub_x + m->cap_width &&
+		    y >= m->sub_y && y < m->sub_y + m->cap_height)
+			return m;
+	return g;
+}
+
+void
+add_disconnected(target_ctx_t *t)
+{
+	if (n_disconnected == disconnected_alloc) {
+		disconnected_alloc = disconnected_alloc ?
+			disconnected_alloc * 2 : 16;
+		disconnected_targets = realloc(disconnected_targets,
+			disconnected_alloc * sizeof(void *));
+		if (!disconnected_targets)
+			fail("out of memory for %d disconnected targets",
+				disconnected_alloc);
+	}
+	t->disc_ix = n_disconnected;
+	disconnected_targets[n_disconnected++] = t;
+}
+
+void
+rem_disconnected(target_ctx_t *t)
+{
+	target_ctx_t *last = disconnected_targets[--n_disconnected];
+
+	assert(disconnected_targets[t->disc_ix] == t);
+	disconnected_targets[t->disc_ix] = last;
+	last->disc_ix = t->disc_ix;
+}
+
 xcb_cursor_t
 get_cursor(uint16_t ch)
 {
+	for (int i = 0; i < ncursors; i++)
+		if (cursors[i].ch == ch)
+			return cursors[i].cursor;
+
 	xcb_cursor_t cursor = xcb_generate_id(c);
 	xcb_create_glyph_cursor(c, cursor, cursor_font, cursor_font,
 		ch, ch + 1, 0, 0, 0, 0xffff, 0xffff, 0xffff);
 
+	cursors = realloc(cursors, (ncursors + 1) * sizeof(cursors[0]));
+	if (!cursors)
+		fail("out of memory for cursors");
+	cursors[ncursors].ch = ch;
+	cursors[ncursors].cursor = cursor;
+	ncursors++;
 	return cursor;
 }
 
@@ -250,7 +1186,7 @@ find_wm_window(xcb_window_t win)
 
 	prop_cookie = xcb_get_property(c, 0, win, atom_wm_state,
 		XCB_ATOM_ANY, 0, 0);
-	prop_reply = xcb_get_property_reply(c, prop_cookie, &err);
+	prop_reply = REPLY(xcb_get_property_reply, prop_cookie, &err);
 	if (prop_reply) {
 		xcb_atom_t reply_type = prop_reply->type;
 		free (prop_reply);
@@ -264,7 +1200,7 @@ find_wm_window(xcb_window_t win)
 	xcb_query_tree_reply_t *tree_reply;
 
 	tree_cookie = xcb_query_tree(c, win);
-	tree_reply = xcb_query_tree_reply(c, tree_cookie, &err);
+	tree_reply = REPLY(xcb_query_tree_reply, tree_cookie, &err);
 	if (!tree_reply) {
 		deb("Failed to query tree\n");
 		return XCB_WINDOW_NONE;
@@ -299,7 +1235,7 @@ get_atom(xcb_connection_t *c, const char *name)
 
 	xcb_intern_atom_cookie_t cookie = xcb_intern_atom(c, 0,
 		strlen(name), name);
-	xcb_intern_atom_reply_t *r = xcb_intern_atom_reply(c, cookie, &e);
+	xcb_intern_atom_reply_t *r = REPLY(xcb_intern_atom_reply, cookie, &e);
 
 	a = r->atom;
 
@@ -313,11 +1249,37 @@ initialize_xcb(void)
 {
 	const xcb_setup_t *setup;
 
-	c = xcb_connect(NULL, NULL);
-	if (!c)
+	if (replaying) {
+		int fds[2];
+		pthread_t server;
+		uint32_t len;
+		uint8_t *data = replay_get(REC_SETUP, NULL, &len);
+		uint8_t *setup = malloc(sizeof(len) + len);
+
+		if (!data || !setup ||
+		    socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0 ||
+		    pipe(stub_wake) < 0)
+			fail("replay: can't set up the stub connection");
+		fcntl(stub_wake[0], F_SETFL, O_NONBLOCK);
+		fcntl(stub_wake[1], F_SETFL, O_NONBLOCK);
+		/* length first, for the server thread */
+		memcpy(setup, &len, sizeof(len));
+		memcpy(setup + sizeof(len), data, len);
+		free(data);
+		stub_fd = fds[1];
+		pthread_create(&server, NULL, stub_server, setup);
+		pthread_detach(server);
+		c = xcb_connect_to_fd(fds[0], NULL);
+	} else {
+		c = xcb_connect(NULL, NULL);
+	}
+	if (!c || xcb_connection_has_error(c))
 		fail("Could not open Display\n");
 
 	setup  = xcb_get_setup(c);
+	if (recording)
+		rec_put(&rec, REC_SETUP, NULL, setup,
+			8 + 4 * setup->length);
 	screen = xcb_setup_roots_iterator(setup).data;
 
 	cursor_font = xcb_generate_id(c);
@@ -328,15 +1290,12 @@ void
 initialize_xdamage(void)
 {
 	xcb_generic_error_t *err;
-	xcb_query_extension_cookie_t qe_c;
-	xcb_query_extension_reply_t *qe_r;
+	const xcb_query_extension_reply_t *qe_r;
 	xcb_damage_query_version_cookie_t dv_c;
 	xcb_damage_query_version_reply_t *dv_r;
 
 	// Check for XDamage extension
-	char *ext_name = "DAMAGE";
-	qe_c = xcb_query_extension(c, strlen(ext_name), ext_name);
-	qe_r = xcb_query_extension_reply(c, qe_c, &err);
+	qe_r = extension_data(&xcb_damage_id);
 	if (!qe_r || !qe_r->present) {
 		fail("XDamage extension not supported by X server, "
 			"fallback possible but not yet implemented\n");
@@ -348,7 +1307,7 @@ initialize_xdamage(void)
 
 	// Version handshake
 	dv_c = xcb_damage_query_version(c, 1, 1);
-	dv_r = xcb_damage_query_version_reply(c, dv_c, &err);
+	dv_r = REPLY(xcb_damage_query_version_reply, dv_c, &err);
 	if (!dv_r) {
 		fail("XDamage extension not supported by X server, "
 			"fallback possible but not yet implemented\n");
@@ -357,39 +1316,195 @@ initialize_xdamage(void)
 		dv_r->major_version, dv_r->minor_version);
 }
 
+/*
+ * must be called after the top window exists, as vblank notifications
+ * are requested on it
+ */
 void
-initialize_top_window(void)
+initialize_present(void)
 {
-	uint32_t mask;
-	uint32_t values[20];
+	xcb_generic_error_t *err;
+	const xcb_query_extension_reply_t *qe_r;
+	xcb_present_query_version_cookie_t pv_c;
+	xcb_present_query_version_reply_t *pv_r;
 
-	top_window = xcb_generate_id(c);
-	mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
-	values[0] = screen->white_pixel;
-	values[1] = XCB_EVENT_MASK_EXPOSURE |
-		XCB_EVENT_MASK_BUTTON_PRESS |
-		XCB_EVENT_MASK_BUTTON_RELEASE |
-		XCB_EVENT_MASK_ENTER_WINDOW |
-		XCB_EVENT_MASK_LEAVE_WINDOW;
-	xcb_create_window(c, XCB_COPY_FROM_PARENT, top_window,
-		screen->root, 0, 0,
-		150, 150,
-		0,
-		InputOutput, XCB_COPY_FROM_PARENT,
-		mask, values
-	);
+	if (vsync_divisor == 0)
+		return;
 
-	xcb_change_property(c, XCB_PROP_MODE_REPLACE, top_window,
-		XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
-		strlen(program_name), program_name);
+	now_tv(&last_vblank);
 
-	char cn[100];
-	strcpy(cn, class_name);
-	int class_len = strlen(class_name);
-	*strchr(cn, ';') = '\0';
+	qe_r = extension_data(&xcb_present_id);
+	if (!qe_r || !qe_r->present) {
+		deb("present extension not available, "
+			"using software vblank timer\n");
+		vsync_fallback = 1;
+		return;
+	}
+	present_opcode = qe_r->major_opcode;
+
+	pv_c = xcb_present_query_version(c, 1, 0);
+	pv_r = REPLY(xcb_present_query_version_reply, pv_c, &err);
+	if (!pv_r) {
+		deb("present version query failed, "
+			"using software vblank timer\n");
+		vsync_fallback = 1;
+		return;
+	}
+	deb("present extension supported, version %d.%d, opcode %d\n",
+		pv_r->major_version, pv_r->minor_version, present_opcode);
+	free(pv_r);
 
-	xcb_change_property(c, XCB_PROP_MODE_REPLACE, top_window,
-		XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8,
+	xcb_present_select_input(c, xcb_generate_id(c), top_window,
+		XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY);
+}
+
+/*
+ * follow the screensaver and, from DPMS 1.2 on, the monitor power
+ * level. Either extension may be missing, then it never blanks.
+ */
+void
+initialize_blanking(void)
+{
+	const xcb_query_extension_reply_t *qe_r;
+
+	qe_r = extension_data(&xcb_screensaver_id);
+	if (qe_r && qe_r->present) {
+		xcb_screensaver_query_info_cookie_t qi_c;
+		xcb_screensaver_query_info_reply_t *qi;
+
+		screensaver_event = qe_r->first_event;
+		xcb_screensaver_select_input(c, screen->root,
+			XCB_SCREENSAVER_EVENT_NOTIFY_MASK);
+		qi_c = xcb_screensaver_query_info(c, screen->root);
+		qi = REPLY(xcb_screensaver_query_info_reply, qi_c, NULL);
+		if (qi) {
+			saver_on = qi->state == XCB_SCREENSAVER_STATE_ON;
+			free(qi);
+		}
+	} else {
+		deb("no screensaver extension\n");
+	}
+
+	qe_r = extension_data(&xcb_dpms_id);
+	if (qe_r && qe_r->present) {
+		xcb_dpms_get_version_cookie_t dv_c;
+		xcb_dpms_get_version_reply_t *dv;
+		xcb_dpms_info_cookie_t di_c;
+		xcb_dpms_info_reply_t *di;
+
+		dv_c = xcb_dpms_get_version(c, 1, 2);
+		dv = REPLY(xcb_dpms_get_version_reply, dv_c, NULL);
+		if (dv && (dv->server_major_version > 1 ||
+			   (dv->server_major_version == 1 &&
+			    dv->server_minor_version >= 2))) {
+			dpms_opcode = qe_r->major_opcode;
+			xcb_dpms_select_input(c,
+				XCB_DPMS_EVENT_MASK_INFO_NOTIFY);
+			di_c = xcb_dpms_info(c);
+			di = REPLY(xcb_dpms_info_reply, di_c, NULL);
+			if (di) {
+				dpms_off = di->state &&
+					di->power_level != XCB_DPMS_DPMS_MODE_ON;
+				free(di);
+			}
+		} else {
+			deb("DPMS without info events, not followed\n");
+		}
+		free(dv);
+	}
+
+	update_blanked();
+}
+
+void
+initialize_xres(void)
+{
+	const xcb_query_extension_reply_t *qe_r;
+
+	qe_r = extension_data(&xcb_res_id);
+	if (!qe_r || !qe_r->present) {
+		deb("no X-Resource extension, server resources not checked\n");
+		return;
+	}
+	for (int i = 0; i < NRES; i++)
+		res_atoms[i] = get_atom(c, res_names[i]);
+	xres_present = 1;
+	now_tv(&last_xres);
+}
+
+void
+initialize_shm(void)
+{
+	const xcb_query_extension_reply_t *qe_r;
+
+	qe_r = extension_data(&xcb_shm_id);
+	if (!qe_r || !qe_r->present) {
+		deb("no MIT-SHM extension, snapshots use GetImage\n");
+		return;
+	}
+	shm_present = 1;
+	shm_completion_event = qe_r->first_event + XCB_SHM_COMPLETION;
+}
+
+/*
+ * whether the window manager supports _NET_WM_MOVERESIZE, for drag: wm
+ */
+void
+initialize_moveresize(void)
+{
+	xcb_get_property_cookie_t pr_c;
+	xcb_get_property_reply_t *pr_r;
+	xcb_atom_t supported = get_atom(c, "_NET_SUPPORTED");
+	xcb_atom_t moveresize = get_atom(c, "_NET_WM_MOVERESIZE");
+
+	pr_c = xcb_get_property(c, 0, screen->root, supported,
+		XCB_ATOM_ATOM, 0, 4096);
+	pr_r = REPLY(xcb_get_property_reply, pr_c, NULL);
+	if (pr_r) {
+		xcb_atom_t *atoms = xcb_get_property_value(pr_r);
+		int n = xcb_get_property_value_length(pr_r) / 4;
+		for (int i = 0; i < n; i++)
+			if (atoms[i] == moveresize)
+				atom_moveresize = moveresize;
+	}
+	free(pr_r);
+	if (!atom_moveresize)
+		deb("no _NET_WM_MOVERESIZE, sniptotop moves snips itself\n");
+}
+
+void
+initialize_top_window(void)
+{
+	uint32_t mask;
+	uint32_t values[20];
+
+	top_window = xcb_generate_id(c);
+	mask = XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK;
+	values[0] = screen->white_pixel;
+	values[1] = XCB_EVENT_MASK_EXPOSURE |
+		XCB_EVENT_MASK_BUTTON_PRESS |
+		XCB_EVENT_MASK_BUTTON_RELEASE |
+		XCB_EVENT_MASK_ENTER_WINDOW |
+		XCB_EVENT_MASK_LEAVE_WINDOW;
+	xcb_create_window(c, XCB_COPY_FROM_PARENT, top_window,
+		screen->root, 0, 0,
+		150, 150,
+		0,
+		InputOutput, XCB_COPY_FROM_PARENT,
+		mask, values
+	);
+
+	xcb_change_property(c, XCB_PROP_MODE_REPLACE, top_window,
+		XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
+		strlen(program_name), program_name);
+
+	char cn[100];
+	strcpy(cn, class_name);
+	int class_len = strlen(class_name);
+	*strchr(cn, ';') = '\0';
+
+	xcb_change_property(c, XCB_PROP_MODE_REPLACE, top_window,
+		XCB_ATOM_WM_CLASS, XCB_ATOM_STRING, 8,
 		class_len + 1, cn);
 
 
@@ -402,7 +1517,7 @@ initialize_top_window(void)
 
 	xcb_map_window(c, top_window);
 
-	top_ctx_t *t = malloc(sizeof(top_ctx_t));
+	top_ctx_t *t = calloc(1, sizeof(top_ctx_t));
 	t->window = top_window;
 	t->gc = gc;
 	t->state = TST_IDLE;
@@ -432,10 +1547,13 @@ create_view_window(uint8_t depth, xcb_visualid_t visual,
 		XCB_EVENT_MASK_BUTTON_PRESS |
 		XCB_EVENT_MASK_BUTTON_RELEASE |
 		XCB_EVENT_MASK_KEY_PRESS |
+		XCB_EVENT_MASK_BUTTON_1_MOTION |
 		XCB_EVENT_MASK_BUTTON_3_MOTION |
 		XCB_EVENT_MASK_STRUCTURE_NOTIFY |
 		XCB_EVENT_MASK_ENTER_WINDOW |
-		XCB_EVENT_MASK_LEAVE_WINDOW;
+		XCB_EVENT_MASK_LEAVE_WINDOW |
+		XCB_EVENT_MASK_VISIBILITY_CHANGE |
+		XCB_EVENT_MASK_FOCUS_CHANGE;
 	values[4] = colormap;
 	xcb_create_window(c, depth, win,
 		screen->root, x, y, w, h,
@@ -467,8 +1585,70 @@ create_view_window(uint8_t depth, xcb_visualid_t visual,
 	return win;
 }
 
+/*
+ * GC for copying target content, usable on any drawable of the same
+ * depth as d
+ */
+xcb_gcontext_t
+create_copy_gc(xcb_drawable_t d)
+{
+	uint32_t values[4];
+	xcb_gcontext_t gc = xcb_generate_id(c);
+
+	values[0] = 0xff808080; /* grey */
+	values[1] = 0xff000000; /* black */
+	values[2] = XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS;
+	values[3] = 0; /* graphics_exposures: disable to avoid feedback loop */
+	xcb_create_gc(c, gc, d,
+		XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_SUBWINDOW_MODE |
+		XCB_GC_GRAPHICS_EXPOSURES,
+		values);
+	return gc;
+}
+
+/*
+ * shared copy GC for drawables of the given depth, d is only used to
+ * create it
+ */
+xcb_gcontext_t
+copy_gc_get(uint8_t depth, xcb_drawable_t d)
+{
+	if (copy_gcs[depth].refs++ == 0)
+		copy_gcs[depth].gc = create_copy_gc(d);
+	return copy_gcs[depth].gc;
+}
+
+void
+copy_gc_put(xcb_gcontext_t gc)
+{
+	if (!gc)
+		return;
+	for (int i = 0; i < 33; i++) {
+		if (copy_gcs[i].refs && copy_gcs[i].gc == gc) {
+			if (--copy_gcs[i].refs == 0) {
+				xcb_free_gc(c, gc);
+				copy_gcs[i].gc = 0;
+			}
+			return;
+		}
+	}
+	fail("copy_gc_put: unknown GC 0x%x", gc);
+}
+
+void
+attach_view(target_ctx_t *t, view_ctx_t *v)
+{
+	v->t = t;
+	v->next_view = t->first_view;
+	t->first_view = v;
+	v->cap_ix = cap_set_add(&t->caps, v, v->cap_x, v->cap_y,
+		v->cap_width, v->cap_height);
+	update_target_cache(t);
+	assign_rules(v);
+}
+
 int
-create_view(xcb_window_t window, xcb_window_t wm_window, char *name,
+create_view(xcb_window_t window, xcb_window_t wm_window, const char *name,
 	int x1, int y1, int x2, int y2)
 {
 	xcb_generic_error_t *err;
@@ -485,14 +1665,14 @@ create_view(xcb_window_t window, xcb_window_t wm_window, char *name,
 	target_ctx_t *t;
 
 	attr_cookie = xcb_get_window_attributes(c, window);
-	win_attrs = xcb_get_window_attributes_reply(c, attr_cookie, &err);
+	win_attrs = REPLY(xcb_get_window_attributes_reply, attr_cookie, &err);
 	if (!win_attrs) {
 		deb("Failed to get window attributes\n");
 		return 1;
 	}
 
 	geom_cookie = xcb_get_geometry(c, window);
-	win_geom = xcb_get_geometry_reply(c, geom_cookie, &err);
+	win_geom = REPLY(xcb_get_geometry_reply, geom_cookie, &err);
 	if (!win_geom) {
 		deb("Failed to get window geometry\n");
 		return 1;
@@ -509,27 +1689,17 @@ create_view(xcb_window_t window, xcb_window_t wm_window, char *name,
 	cap_y = y1 - win_geom->y;
 
 	uint32_t black = 0xff000000;
-	uint32_t grey = 0xff808080;
-	int n_border_width = 2;
-	int width = cap_width + 2 * n_border_width;
-	int height = cap_height + 2 * n_border_width;
+	int width = cap_width + 2 * border_width;
+	int height = cap_height + 2 * border_width;
 	int view_x = (x1 + x2) / 2 - width / 2;
 	int view_y = (y1 + y2) / 2 - height / 2;
 	xcb_window_t new_window = create_view_window(win_geom->depth,
 		win_attrs->visual, win_attrs->colormap,
 		view_x, view_y, width, height, black);
 
-	xcb_gcontext_t copy_gc = xcb_generate_id(c);
-	values[0] = grey;
-	values[1] = black;
-	values[2] = XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS;
-	values[3] = 0; /* graphics_exposures: disable to avoid feedback loop */
-	xcb_create_gc(c, copy_gc, window,
-		XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_SUBWINDOW_MODE |
-		XCB_GC_GRAPHICS_EXPOSURES,
-		values);
+	xcb_gcontext_t copy_gc = copy_gc_get(win_geom->depth, window);
 
-	view_ctx_t *v = calloc(sizeof(view_ctx_t), 1);
+	view_ctx_t *v = pool_get(&view_pool);
 	v->window = new_window;
 	v->gc = copy_gc;
 	v->cap_x = cap_x;
@@ -541,6 +1711,8 @@ create_view(xcb_window_t window, xcb_window_t wm_window, char *name,
 	v->move_offset_y = 0;
 	v->view_x = view_x;
 	v->view_y = view_y;
+	v->depth = win_geom->depth;
+	v->refresh_fps = cfg.refresh_fps;
 	add_window(new_window, WIN_TYPE_VIEW, v);
 
 	t_ix = find_window(window);
@@ -552,23 +1724,24 @@ create_view(xcb_window_t window, xcb_window_t wm_window, char *name,
 
 		 // Create a damage object
 		xcb_damage_damage_t damage = xcb_generate_id(c);
-		xcb_damage_create(c, damage, window,
-			XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+		xcb_damage_create(c, damage, window, initial_damage_level());
 
-		t = calloc(sizeof(target_ctx_t), 1);
+		t = pool_get(&target_pool);
 		t->target = window;
 		t->wm_target = wm_window;
 		t->damage = damage;
-		t->name = name;
+		t->name = str_ref(name);
+		t->level = initial_damage_level();
+		now_tv(&t->level_since);
+		t->rate_since = t->level_since;
+		t->depth = win_geom->depth;
+		t->gc = copy_gc_get(t->depth, window);
 		add_window(window, WIN_TYPE_TARGET, t);
 	} else {
 		t = windows[t_ix].ctx;
 		assert(t->wm_target == wm_window);
-		free(name); // we already have a name
 	}
-	v->t = t;
-	v->next_view = t->first_view;
-	t->first_view = v;
+	attach_view(t, v);
 
 	return 0;
 }
@@ -595,192 +1768,2970 @@ destroy_view(view_ctx_t *v)
 	if (!cur)
 		fail("internal error, view not found in target's list");
 
+	view_ctx_t *moved = cap_set_remove(&t->caps, v->cap_ix);
+	if (moved)
+		moved->cap_ix = v->cap_ix;
+
 	if (v->notify_flash)
 		notify_flashing_count--;
-
-	if (v->gc)
-		xcb_free_gc(c, v->gc);
-	rem_window(v->window);
-	xcb_destroy_window(c, v->window);
+	if (v->hud && --n_huds == 0)
+		free_hud_gcs();
+	if (v->stream)
+		stop_recording(v);
+	if (v->resize_pending)
+		n_resize_pending--;
+	clear_view_dirty(v);
+	if (wm_move_view == v)
+		wm_move_view = NULL;
+	v->rules_dirty = 0;
+	v->rule_job = 0;
+	update_rule_views(v);
+	if (v->still)
+		xcb_free_pixmap(c, v->still);
+	hist_clear(&v->hist);
+	thumb_buf_unref(v->thumb);
+
+	copy_gc_put(v->gc);
+	if (merge_pending == v)
+		merge_pending = NULL;
+	/* the rest of a composite keeps the window */
+	view_ctx_t *g = leave_group(v);
+	rem_view_entry(v);
+	if (g)
+		layout_group(g);
+	else
+		xcb_destroy_window(c, v->window);
 
 	// if no more views for this target, free target as well
 	if (t->first_view == NULL) {
-		if (t->disconnected) {
-			/* remove from disconnected list */
-			for (int i = 0; i < n_disconnected; i++) {
-				if (disconnected_targets[i] == t) {
-					disconnected_targets[i] =
-						disconnected_targets[--n_disconnected];
-					break;
-				}
-			}
+		if (t->mirror) {
+			mirror_detach(t);
+		} else if (t->disconnected) {
+			rem_disconnected(t);
 		} else {
 			uint32_t eventmask = 0;
 			xcb_change_window_attributes(c, t->target,
 				XCB_CW_EVENT_MASK, &eventmask);
-			xcb_damage_destroy(c, t->damage);
+			if (t->damage)
+				xcb_damage_destroy(c, t->damage);
 			rem_window(t->target);
 		}
 		deb("No more views for target window 0x%x\n", t->target);
-		free(t->name);
-		free(t);
+		free_target_cache(t);
+		cap_set_free(&t->caps);
+		str_unref(t->name);
+		pool_put(&target_pool, t);
+	} else {
+		update_target_damage(t);
+		update_target_cache(t);
 	}
-	free(v);
+	pool_put(&view_pool, v);
 }
 
-void
-redraw_view(view_ctx_t *v)
+long
+ms_since(struct timeval *then)
 {
-	xcb_void_cookie_t v_cookie;
-	xcb_generic_error_t *error;
+	struct timeval now;
+	now_tv(&now);
+	return (now.tv_sec - then->tv_sec) * 1000 +
+		(now.tv_usec - then->tv_usec) / 1000;
+}
 
-	if (v->t->disconnected)
-		return;
+/*
+ * length of the overlap of [a, a + la) and [b, b + lb)
+ */
+int
+overlap(int a, int la, int b, int lb)
+{
+	int lo = a > b ? a : b;
+	int hi = a + la < b + lb ? a + la : b + lb;
 
-	deb("Redrawing view window 0x%x from target 0x%x "
-		"capture area %d,%d %dx%d\n",
-		v->window, v->t->target,
-		v->cap_x, v->cap_y,
-		v->cap_width, v->cap_height);
-	v_cookie = xcb_copy_area_checked(c,
-		v->t->target,
-		v->window,
-		v->gc,
-		v->cap_x, v->cap_y,
-		border_width, border_width,
-		v->cap_width, v->cap_height);
+	return hi > lo ? hi - lo : 0;
+}
 
-	if ((error = xcb_request_check(c, v_cookie))) {
-		deb("redraw_view: error code %d major %d minor %d "
-			"(target 0x%x probably gone)\n",
-			error->error_code,
-			error->major_code,
-			error->minor_code);
-		free(error);
+/*
+ * note damaged target area that has to be pulled into the cache
+ */
+void
+damage_target_cache(target_ctx_t *t, int x, int y, int w, int h)
+{
+	int x1 = x > t->cache_x ? x : t->cache_x;
+	int y1 = y > t->cache_y ? y : t->cache_y;
+	int x2 = x + w < t->cache_x + t->cache_w ?
+		x + w : t->cache_x + t->cache_w;
+	int y2 = y + h < t->cache_y + t->cache_h ?
+		y + h : t->cache_y + t->cache_h;
+
+	if (x1 >= x2 || y1 >= y2)
+		return;
+	if (t->dmg_x1 >= t->dmg_x2) {
+		t->dmg_x1 = x1;
+		t->dmg_y1 = y1;
+		t->dmg_x2 = x2;
+		t->dmg_y2 = y2;
+		return;
 	}
+	if (x1 < t->dmg_x1) t->dmg_x1 = x1;
+	if (y1 < t->dmg_y1) t->dmg_y1 = y1;
+	if (x2 > t->dmg_x2) t->dmg_x2 = x2;
+	if (y2 > t->dmg_y2) t->dmg_y2 = y2;
 }
 
 void
-initialize_state_path(void)
+damage_target_cache_all(target_ctx_t *t)
 {
-	const char *home = getenv("HOME");
-	if (!home)
-		return;
-	char dir1[512], dir2[512];
-	snprintf(dir1, sizeof(dir1), "%s/.config", home);
-	mkdir(dir1, 0755);
-	snprintf(dir2, sizeof(dir2), "%s/.config/sniptotop", home);
-	mkdir(dir2, 0755);
-	snprintf(state_path, sizeof(state_path),
-		"%s/.config/sniptotop/state", home);
+	damage_target_cache(t, t->cache_x, t->cache_y,
+		t->cache_w, t->cache_h);
 }
 
 void
-save_state(void)
+send_fence(void)
 {
-	char tmp_path[520];
-	FILE *f;
+	fence_seq = xcb_get_input_focus(c).sequence;
+	fence_px = inflight_px;
+	fence_pending = 1;
+	xcb_flush(c);
+}
 
-	if (state_path[0] == '\0')
+void
+account_copy(long px)
+{
+	inflight_px += px;
+	if (inflight_px >= cfg.copy_budget_px && !fence_pending)
+		send_fence();
+}
+
+int
+over_budget(void)
+{
+	return inflight_px >= cfg.copy_budget_px;
+}
+
+/*
+ * the server answered the fence, everything copied before it is done
+ */
+void
+check_fence(void)
+{
+	void *reply = NULL;
+	xcb_generic_error_t *err = NULL;
+	uint8_t done;
+	int polled;
+
+	if (!fence_pending)
 		return;
+	if (replaying) {
+		/* the fence is a GetInputFocus */
+		uint8_t focus[32] = { 1 };
+		void *data = replay_get(REC_POLL, "fence", NULL);
+		done = data && *(uint8_t *)data;
+		free(data);
+		if (done) {
+			uint8_t *r = malloc(sizeof(focus));
+			if (!r)
+				fail("replay: out of memory");
+			focus[2] = fence_seq & 0xff;
+			focus[3] = (fence_seq >> 8) & 0xff;
+			memcpy(r, focus, sizeof(focus));
+			stub_feed(r, sizeof(focus));
+			/* the poll below only sees what is there */
+			stub_drain();
+		}
+	}
+	polled = xcb_poll_for_reply(c, fence_seq, &reply, &err);
+	if (!replaying)
+		done = polled;
+	if (recording)
+		rec_put(&rec, REC_POLL, "fence", &done, 1);
+	if (!done)
+		return;
+	free(reply);
+	free(err);
+	fence_pending = 0;
+	inflight_px -= fence_px;
+	deb("fence done, %ld px still in flight\n", inflight_px);
+	if (over_budget())
+		send_fence();
+}
 
-	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state_path);
-	f = fopen(tmp_path, "w");
-	if (!f)
+/*
+ * pull pending damage from the target into the cache. Only the first
+ * view redrawn in a pass pays for the copy from the target.
+ */
+void
+sync_target_cache(target_ctx_t *t)
+{
+	if (!t->cache || t->disconnected || t->unmapped || t->mirror ||
+	    t->dmg_x1 >= t->dmg_x2)
 		return;
 
-	fprintf(f, "# target_name cap_x cap_y cap_width cap_height "
-		"view_x view_y notify\n");
+	deb("refreshing cache of target 0x%x area %d,%d %dx%d\n",
+		t->target, t->dmg_x1, t->dmg_y1,
+		t->dmg_x2 - t->dmg_x1, t->dmg_y2 - t->dmg_y1);
+	/*
+	 * no round trip: a target that just went away costs an error
+	 * event, which cache_copy_error matches by sequence
+	 */
+	t->copy_seq = xcb_copy_area(c,
+		t->target,
+		t->cache,
+		t->gc,
+		t->dmg_x1, t->dmg_y1,
+		t->dmg_x1 - t->cache_x, t->dmg_y1 - t->cache_y,
+		t->dmg_x2 - t->dmg_x1, t->dmg_y2 - t->dmg_y1).sequence;
+	account_copy((long)(t->dmg_x2 - t->dmg_x1) *
+		(t->dmg_y2 - t->dmg_y1));
+	t->dmg_x1 = t->dmg_x2 = 0;
+}
 
-	/* save connected views */
+/*
+ * an error to the last pull of a target into its cache, 1 if err was
+ * one. The cache keeps its old content for the area.
+ */
+int
+cache_copy_error(xcb_generic_error_t *err)
+{
+	if (err->major_code != XCB_COPY_AREA)
+		return 0;
 	for (int i = 0; i < nwindows; i++) {
-		if (windows[i].type != WIN_TYPE_VIEW)
+		if (windows[i].type != WIN_TYPE_TARGET)
 			continue;
-		view_ctx_t *v = windows[i].ctx;
-		if (v->t->disconnected)
+		target_ctx_t *t = windows[i].ctx;
+		if (t->copy_seq != err->full_sequence)
 			continue;
-		fprintf(f, "%s %d %d %d %d %d %d %d\n",
-			v->t->name,
-			v->cap_x, v->cap_y,
-			v->cap_width, v->cap_height,
-			v->view_x, v->view_y,
-			v->notify);
-	}
-
-	/* save disconnected views */
-	for (int i = 0; i < n_disconnected; i++) {
-		target_ctx_t *t = disconnected_targets[i];
-		for (view_ctx_t *v = t->first_view; v; v = v->next_view) {
-			fprintf(f, "%s %d %d %d %d %d %d %d\n",
-				t->name,
-				v->cap_x, v->cap_y,
-				v->cap_width, v->cap_height,
-				v->view_x, v->view_y,
-				v->notify);
-		}
+		deb("sync_target_cache: error code %d major %d minor %d "
+			"(target 0x%x probably gone)\n",
+			err->error_code, err->major_code, err->minor_code,
+			t->target);
+		return 1;
 	}
-
-	fclose(f);
-	rename(tmp_path, state_path);
+	return 0;
 }
 
 /*
- * get the window title: try _NET_WM_NAME first, fall back to WM_NAME.
- * returns a malloc'd string or NULL.
+ * size the cache to the union of the capture areas, keeping what it
+ * already holds
  */
-char *
-get_window_title(xcb_window_t win)
+void
+update_target_cache(target_ctx_t *t)
 {
-	xcb_generic_error_t *err;
-	xcb_get_property_cookie_t pr_c;
-	xcb_get_property_reply_t *pr_r;
-	xcb_atom_t atom_net_wm_name = get_atom(c, "_NET_WM_NAME");
-	xcb_atom_t atom_utf8 = get_atom(c, "UTF8_STRING");
+	cap_set_t *cs = &t->caps;
+	int x1 = INT_MAX, y1 = INT_MAX, x2 = INT_MIN, y2 = INT_MIN;
 
-	pr_c = xcb_get_property(c, 0, win, atom_net_wm_name,
-		atom_utf8, 0, 256);
-	pr_r = xcb_get_property_reply(c, pr_c, &err);
-	if (pr_r && xcb_get_property_value_length(pr_r) > 0) {
-		int len = xcb_get_property_value_length(pr_r);
-		char *name = malloc(len + 1);
-		memcpy(name, xcb_get_property_value(pr_r), len);
-		name[len] = '\0';
-		free(pr_r);
-		return name;
+	if (!t->gc || cs->n == 0)
+		return;
+
+	for (int i = 0; i < cs->n; i++) {
+		if (cs->x1[i] < x1) x1 = cs->x1[i];
+		if (cs->y1[i] < y1) y1 = cs->y1[i];
+		if (cs->x2[i] > x2) x2 = cs->x2[i];
+		if (cs->y2[i] > y2) y2 = cs->y2[i];
 	}
-	free(pr_r);
+	if (t->cache && x1 == t->cache_x && y1 == t->cache_y &&
+	    x2 - x1 == t->cache_w && y2 - y1 == t->cache_h)
+		return;
 
-	pr_c = xcb_get_property(c, 0, win, XCB_ATOM_WM_NAME,
-		XCB_ATOM_ANY, 0, 256);
-	pr_r = xcb_get_property_reply(c, pr_c, &err);
-	if (pr_r && xcb_get_property_value_length(pr_r) > 0) {
-		int len = xcb_get_property_value_length(pr_r);
-		char *name = malloc(len + 1);
-		memcpy(name, xcb_get_property_value(pr_r), len);
-		name[len] = '\0';
-		free(pr_r);
-		return name;
+	xcb_pixmap_t cache = xcb_generate_id(c);
+	xcb_create_pixmap(c, t->depth, cache, screen->root,
+		x2 - x1, y2 - y1);
+	if (t->cache) {
+		xcb_copy_area(c, t->cache, cache, t->gc, 0, 0,
+			t->cache_x - x1, t->cache_y - y1,
+			t->cache_w, t->cache_h);
+		xcb_free_pixmap(c, t->cache);
 	}
-	free(pr_r);
-	return NULL;
+	deb("target 0x%x cache %d,%d %dx%d\n", t->target,
+		x1, y1, x2 - x1, y2 - y1);
+	t->cache = cache;
+	t->cache_x = x1;
+	t->cache_y = y1;
+	t->cache_w = x2 - x1;
+	t->cache_h = y2 - y1;
+	damage_target_cache_all(t);
+	if (t->mirror)
+		mirror_area(t);
 }
 
-int
-find_window_by_name(const char *name, xcb_window_t *wm_win,
-	xcb_window_t *client_win)
+void
+free_target_cache(target_ctx_t *t)
 {
-	xcb_generic_error_t *err;
-	xcb_query_tree_cookie_t tree_cookie;
-	xcb_query_tree_reply_t *tree_reply;
+	if (t->cache)
+		xcb_free_pixmap(c, t->cache);
+	copy_gc_put(t->gc);
+	t->cache = 0;
+	t->gc = 0;
+}
 
-	tree_cookie = xcb_query_tree(c, screen->root);
-	tree_reply = xcb_query_tree_reply(c, tree_cookie, &err);
-	if (!tree_reply)
-		return 0;
+/*
+ * HUD: damage events/s of the target, copies/s into the view, the
+ * last damage to copy latency, the refresh policy and whether the view
+ * is recorded. It is text drawn over the view's top left corner, so
+ * it never costs a copy.
+ */
+xcb_font_t
+open_hud_font(void)
+{
+	const char *name = HUD_FONT;
+	xcb_list_fonts_cookie_t cookie;
+	xcb_list_fonts_reply_t *r;
+	xcb_font_t font;
+
+	cookie = xcb_list_fonts(c, 1, strlen(name), name);
+	r = REPLY(xcb_list_fonts_reply, cookie, NULL);
+	if (!r || r->names_len == 0) {
+		/* every server has this alias */
+		deb("no font %s, using fixed\n", name);
+		name = "fixed";
+	}
+	free(r);
+	font = xcb_generate_id(c);
+	xcb_open_font(c, font, strlen(name), name);
+	return font;
+}
+
+xcb_gcontext_t
+hud_gc(view_ctx_t *v)
+{
+	if (!hud_gcs[v->depth]) {
+		uint32_t values[4];
+		if (!hud_font)
+			hud_font = open_hud_font();
+		hud_gcs[v->depth] = xcb_generate_id(c);
+		values[0] = 0xffffffff;
+		values[1] = 0xff000000;
+		values[2] = hud_font;
+		values[3] = 0; /* graphics_exposures */
+		xcb_create_gc(c, hud_gcs[v->depth], v->window,
+			XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_FONT |
+			XCB_GC_GRAPHICS_EXPOSURES, values);
+	}
+	return hud_gcs[v->depth];
+}
+
+/*
+ * the last HUD went away. History labels make the GCs again when
+ * they need them.
+ */
+void
+free_hud_gcs(void)
+{
+	for (int i = 0; i < 33; i++) {
+		if (hud_gcs[i])
+			xcb_free_gc(c, hud_gcs[i]);
+		hud_gcs[i] = 0;
+	}
+	if (hud_font)
+		xcb_close_font(c, hud_font);
+	hud_font = 0;
+}
+
+void
+draw_hud(view_ctx_t *v)
+{
+	const char *rec_mark = v->stream ? " rec" : "";
+	char line[64];
+	int len;
+
+	len = snprintf(line, sizeof(line), "%d dmg/s %d cp/s",
+		v->damage_rate, v->copy_rate);
+	xcb_image_text_8(c, len, v->window, hud_gc(v),
+		border_width + v->sub_x + 2, border_width + v->sub_y + 11, line);
+
+	switch (v->refresh) {
+	case REFRESH_LIVE:
+		len = snprintf(line, sizeof(line), "%.1fms live%s",
+			v->latency_us / 1000.0, rec_mark);
+		break;
+	case REFRESH_THROTTLED:
+		len = snprintf(line, sizeof(line), "%.1fms %dfps%s",
+			v->latency_us / 1000.0, v->refresh_fps, rec_mark);
+		break;
+	case REFRESH_ON_DEMAND:
+		len = snprintf(line, sizeof(line), "%.1fms demand%s%s",
+			v->latency_us / 1000.0, v->stale ? " stale" : "",
+			rec_mark);
+		break;
+	default:
+		len = snprintf(line, sizeof(line), "frozen%s", rec_mark);
+		break;
+	}
+	xcb_image_text_8(c, len, v->window, hud_gc(v),
+		border_width + v->sub_x + 2, border_width + v->sub_y + 24, line);
+}
+
+void
+reset_hud(view_ctx_t *v)
+{
+	now_tv(&v->hud_since);
+	v->hud_damage = v->t->n_damage;
+	v->hud_copies = v->frame_seq;
+}
+
+/*
+ * recompute the rates of all HUDs once a second
+ */
+void
+update_huds(void)
+{
+	if (n_huds == 0)
+		return;
+
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		if (!v->hud)
+			continue;
+		long ms = ms_since(&v->hud_since);
+		if (ms < 1000)
+			continue;
+		v->damage_rate = (v->t->n_damage - v->hud_damage) * 1000 / ms;
+		v->copy_rate = (v->frame_seq - v->hud_copies) * 1000 / ms;
+		reset_hud(v);
+		draw_hud(v);
+	}
+}
+
+/*
+ * keep the capture area as it is in the cache as v's newest history
+ * frame, reusing the pixmap of the frame that falls out
+ */
+void
+push_history(view_ctx_t *v)
+{
+	target_ctx_t *t = v->t;
+	long bytes = pixmap_bytes(v->depth, v->cap_width, v->cap_height);
+	struct timeval now;
+	xcb_pixmap_t p;
+
+	v->hist_new = 0;
+	if (!v->notify || !t->cache || !v->gc || !hist_enabled(bytes))
+		return;
+
+	sync_target_cache(t);
+	p = hist_recycle(&v->hist, v->cap_width, v->cap_height);
+	if (!p) {
+		p = xcb_generate_id(c);
+		xcb_create_pixmap(c, v->depth, p, v->window,
+			v->cap_width, v->cap_height);
+	}
+	xcb_copy_area(c, t->cache, p, v->gc,
+		v->cap_x - t->cache_x, v->cap_y - t->cache_y,
+		0, 0, v->cap_width, v->cap_height);
+	account_copy((long)v->cap_width * v->cap_height);
+	now_tv(&now);
+	hist_push(&v->hist, p, v->cap_width, v->cap_height, bytes, &now);
+}
+
+void
+drop_history_frame(uint32_t id)
+{
+	xcb_free_pixmap(c, id);
+}
+
+/*
+ * the history frame v shows, the oldest one left if it was evicted.
+ * NULL and back to the content if there is none.
+ */
+const hist_frame_t *
+shown_frame(view_ctx_t *v)
+{
+	const hist_frame_t *f;
+
+	if (!v->hist_show)
+		return NULL;
+	f = hist_get(&v->hist, v->hist_show);
+	if (!f && v->hist.n) {
+		v->hist_show = hist_oldest(&v->hist);
+		f = hist_get(&v->hist, v->hist_show);
+	}
+	if (!f)
+		v->hist_show = 0;
+	return f;
+}
+
+/*
+ * a history frame with how far back it is in the bottom left corner
+ */
+void
+draw_history(view_ctx_t *v, const hist_frame_t *f)
+{
+	struct timeval at = f->at;
+	char line[64];
+	int len;
+
+	xcb_copy_area(c, f->id, v->window, v->gc, 0, 0,
+		border_width + v->sub_x, border_width + v->sub_y,
+		f->width < v->cap_width ? f->width : v->cap_width,
+		f->height < v->cap_height ? f->height : v->cap_height);
+	len = snprintf(line, sizeof(line), "-%u %.1fs",
+		v->hist.seq - v->hist_show, ms_since(&at) / 1000.0);
+	xcb_image_text_8(c, len, v->window, hud_gc(v),
+		border_width + v->sub_x + 2,
+		border_width + v->sub_y + v->cap_height - 3, line);
+	if (v->hud)
+		draw_hud(v);
+}
+
+void
+redraw_view(view_ctx_t *v)
+{
+	target_ctx_t *t = v->t;
+	const hist_frame_t *f;
+
+	if (v->refresh != REFRESH_FROZEN &&
+	    (v->hist_new || (v->notify && !v->hist.n)))
+		push_history(v);
+	if ((f = shown_frame(v))) {
+		draw_history(v, f);
+		return;
+	}
+
+	if (v->refresh == REFRESH_FROZEN) {
+		/* the target is not looked at anymore, only the still */
+		if (v->still)
+			xcb_copy_area(c, v->still, v->window, v->gc,
+				0, 0, border_width + v->sub_x,
+				border_width + v->sub_y,
+				v->cap_width, v->cap_height);
+		if (v->hud)
+			draw_hud(v);
+		return;
+	}
+
+	if (!t->cache || !v->gc)
+		return;
+
+	sync_target_cache(t);
+
+	deb("Redrawing view window 0x%x from cache of target 0x%x "
+		"capture area %d,%d %dx%d\n",
+		v->window, t->target,
+		v->cap_x, v->cap_y,
+		v->cap_width, v->cap_height);
+	xcb_copy_area(c,
+		t->cache,
+		v->window,
+		v->gc,
+		v->cap_x - t->cache_x, v->cap_y - t->cache_y,
+		border_width + v->sub_x, border_width + v->sub_y,
+		v->cap_width, v->cap_height);
+	account_copy((long)v->cap_width * v->cap_height);
+	now_tv(&v->last_copy);
+	v->stale = 0;
+	v->frame_seq++;
+	if (v->damage_pending) {
+		v->damage_pending = 0;
+		v->latency_us = (v->last_copy.tv_sec - v->damaged_at.tv_sec) *
+			1000000L + v->last_copy.tv_usec - v->damaged_at.tv_usec;
+	}
+	if (v->hud)
+		draw_hud(v);
+}
+
+int
+view_hidden(view_ctx_t *v)
+{
+	return blanked || v->obscured || v->unmapped;
+}
+
+/*
+ * ms until the view may be copied again, -1 if damage alone never
+ * makes it copy (on demand, frozen)
+ */
+long
+view_wait_ms(view_ctx_t *v)
+{
+	long left;
+
+	switch (v->refresh) {
+	case REFRESH_LIVE:
+		return 0;
+	case REFRESH_THROTTLED:
+		left = 1000 / v->refresh_fps - ms_since(&v->last_copy);
+		return left > 0 ? left : 0;
+	default:
+		return -1;
+	}
+}
+
+void
+mark_view_dirty(view_ctx_t *v)
+{
+	if (view_wait_ms(v) < 0) {
+		/* picked up when the user asks for it */
+		v->stale = 1;
+		return;
+	}
+	if (v->dirty)
+		return;
+	if (n_dirty_views == dirty_alloc) {
+		dirty_alloc = dirty_alloc ? dirty_alloc * 2 : 64;
+		dirty_views = realloc(dirty_views,
+			dirty_alloc * sizeof(*dirty_views));
+		if (!dirty_views)
+			fail("out of memory for %d dirty views", dirty_alloc);
+	}
+	v->dirty = 1;
+	v->dirty_ix = n_dirty_views;
+	dirty_views[n_dirty_views++] = v;
+}
+
+void
+clear_view_dirty(view_ctx_t *v)
+{
+	if (v->dirty) {
+		/* the last one moves into the hole */
+		view_ctx_t *last = dirty_views[--n_dirty_views];
+		last->dirty_ix = v->dirty_ix;
+		dirty_views[v->dirty_ix] = last;
+		v->dirty = 0;
+	}
+	v->late = 0;
+}
+
+/*
+ * the view's capture area changed on the target, leave the copy to
+ * the scheduler. Throttled counts the live views the fence holds back,
+ * the only ones that would otherwise go in this tick unpaced.
+ */
+void
+view_damaged(view_ctx_t *v)
+{
+	if (over_budget() && !v->dirty && v->refresh == REFRESH_LIVE &&
+	    !vsync_divisor)
+		n_throttled++;
+	mark_view_dirty(v);
+}
+
+/*
+ * ms until the first dirty view falls due, -1 if none is dirty
+ */
+long
+dirty_wait_ms(void)
+{
+	long wait = -1;
+
+	for (int i = 0; i < n_dirty_views; i++) {
+		long w = view_wait_ms(dirty_views[i]);
+		if (wait < 0 || w < wait)
+			wait = w;
+		if (wait == 0)
+			break;
+	}
+	return wait;
+}
+
+/*
+ * 0 for the view under the pointer or focused, 1 for notify mode,
+ * 2 for the rest
+ */
+int
+view_class(view_ctx_t *v)
+{
+	if (v->window == pointer_window || v->window == focus_window)
+		return 0;
+	return v->notify ? 1 : 2;
+}
+
+/*
+ * views that missed a tick first, then by class, then smaller ones
+ */
+int
+cmp_redraw(const void *a, const void *b)
+{
+	view_ctx_t *va = *(view_ctx_t **)a;
+	view_ctx_t *vb = *(view_ctx_t **)b;
+	int d;
+
+	if ((d = (vb->late > 0) - (va->late > 0)))
+		return d;
+	if ((d = view_class(va) - view_class(vb)))
+		return d;
+	if ((d = vb->late - va->late))
+		return d;
+	return va->cap_width * va->cap_height - vb->cap_width * vb->cap_height;
+}
+
+/*
+ * copy the dirty views that are due, in priority order, within the
+ * tick budget. With vsync pacing this runs once per vblank, otherwise
+ * on every pass of the main loop.
+ */
+void
+flush_dirty_views(void)
+{
+	static view_ctx_t **due;
+	static int due_alloc;
+	long budget = cfg.tick_budget_px;
+	int n = 0;
+
+	now_tv(&last_vblank);
+	if (n_dirty_views == 0)
+		return;
+	n_flushes++;
+
+	for (int i = 0; i < n_dirty_views; i++) {
+		view_ctx_t *v = dirty_views[i];
+		if (view_wait_ms(v) != 0)
+			continue;
+		if (n == due_alloc) {
+			due_alloc = due_alloc ? due_alloc * 2 : 64;
+			due = realloc(due, due_alloc * sizeof(*due));
+			if (!due)
+				fail("out of memory for %d views", due_alloc);
+		}
+		due[n++] = v;
+	}
+	qsort(due, n, sizeof(*due), cmp_redraw);
+
+	for (int i = 0; i < n; i++) {
+		view_ctx_t *v = due[i];
+		/* the first view always goes, however big */
+		if (over_budget() || (i > 0 && budget <= 0)) {
+			v->late++;
+			n_late++;
+			continue;
+		}
+		budget -= (long)v->cap_width * v->cap_height;
+		clear_view_dirty(v);
+		redraw_view(v);
+	}
+}
+
+void
+request_vblank(void)
+{
+	if (msc_pending || vsync_fallback)
+		return;
+
+	/* next msc with msc % divisor == 0 */
+	xcb_present_notify_msc(c, top_window, ++msc_serial, 0,
+		vsync_divisor, 0);
+	msc_pending = 1;
+	now_tv(&msc_requested);
+}
+
+void
+handle_present_event(xcb_generic_event_t *e)
+{
+	xcb_ge_generic_event_t *ge = (void *)e;
+
+	if (ge->extension != present_opcode ||
+	    ge->event_type != XCB_PRESENT_EVENT_COMPLETE_NOTIFY) {
+		deb("ignoring generic event ext %d type %d\n",
+			ge->extension, ge->event_type);
+		return;
+	}
+	xcb_present_complete_notify_event_t *cn = (void *)e;
+	if (cn->kind != XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC ||
+	    cn->serial != msc_serial)
+		return;
+
+	deb("vblank msc %lu\n", (unsigned long)cn->msc);
+	msc_pending = 0;
+	flush_dirty_views();
+}
+
+/*
+ * without vsync, ms until cfg.tick_hz allows the next tick
+ */
+long
+tick_wait_ms(void)
+{
+	if (!cfg.tick_hz)
+		return 0;
+	long left = 1000 / cfg.tick_hz - ms_since(&last_vblank);
+	return left > 0 ? left : 0;
+}
+
+/*
+ * poll timeout until the next redraw is due, -1 if none
+ */
+int
+redraw_timeout_ms(void)
+{
+	long wait = dirty_wait_ms();
+
+	/* the fence reply wakes the poll */
+	if (wait >= 0 && over_budget())
+		return -1;
+
+	if (wait == 0 && !vsync_divisor)
+		return tick_wait_ms();
+	if (wait != 0 || !vsync_divisor)
+		return wait;
+
+	if (!vsync_fallback) {
+		if (!msc_pending)
+			return 0;
+		/* wake when the completion is overdue */
+		long left = MSC_TIMEOUT_MS - ms_since(&msc_requested);
+		return left > 0 ? left : 0;
+	}
+
+	long left = SOFT_VBLANK_US / 1000 * vsync_divisor -
+		ms_since(&last_vblank);
+	return left > 0 ? left : 0;
+}
+
+void
+service_dirty_views(void)
+{
+	check_fence();
+	if (dirty_wait_ms() != 0 || over_budget())
+		return;
+
+	if (!vsync_divisor) {
+		if (tick_wait_ms() == 0)
+			flush_dirty_views();
+		return;
+	}
+
+	if (msc_pending && ms_since(&msc_requested) >= MSC_TIMEOUT_MS) {
+		/* the server has no vblank to give us */
+		deb("no msc completion within %dms, "
+			"using software vblank timer\n", MSC_TIMEOUT_MS);
+		msc_pending = 0;
+		vsync_fallback = 1;
+	}
+	if (!vsync_fallback)
+		request_vblank();
+	else if (ms_since(&last_vblank) >= SOFT_VBLANK_US / 1000 * vsync_divisor)
+		flush_dirty_views();
+}
+
+/*
+ * the damage object is only kept while some view of the target still
+ * follows its content, so a target with all views frozen doesn't
+ * generate any events
+ */
+void
+update_target_damage(target_ctx_t *t)
+{
+	int wanted = 0;
+
+	if (t->disconnected || t->mirror)
+		return;
+
+	/* hidden views in notify mode still want to flash */
+	for (view_ctx_t *v = t->first_view; v; v = v->next_view)
+		if (v->refresh != REFRESH_FROZEN &&
+		    (!view_hidden(v) || v->notify))
+			wanted = 1;
+
+	if (wanted && !t->damage) {
+		deb("target 0x%x: recreating damage object\n", t->target);
+		t->damage = xcb_generate_id(c);
+		xcb_damage_create(c, t->damage, t->target, t->level);
+		/* nothing was tracked while it was gone */
+		damage_target_cache_all(t);
+		for (view_ctx_t *v = t->first_view; v; v = v->next_view)
+			if (v->refresh != REFRESH_FROZEN)
+				v->missed = 1;
+	} else if (!wanted && t->damage) {
+		deb("target 0x%x: no view frozen or visible, "
+			"dropping damage\n", t->target);
+		xcb_damage_destroy(c, t->damage);
+		t->damage = 0;
+	}
+}
+
+int
+initial_damage_level(void)
+{
+	if (cfg.damage_level == CONFIG_DAMAGE_AUTO)
+		return XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES;
+	return cfg.damage_level;
+}
+
+/*
+ * a damage object can't change its level, it is replaced. Whatever
+ * happened in between is lost, so the views are copied once.
+ */
+void
+set_damage_level(target_ctx_t *t, int level)
+{
+	if (level == t->level)
+		return;
+	deb("target 0x%x: damage level %d -> %d\n", t->target,
+		t->level, level);
+	t->level = level;
+	now_tv(&t->level_since);
+	if (!t->damage)
+		return;
+
+	xcb_damage_destroy(c, t->damage);
+	t->damage = 0;
+	update_target_damage(t);
+	for (view_ctx_t *v = t->first_view; v; v = v->next_view)
+		if (v->refresh != REFRESH_FROZEN && !view_hidden(v)) {
+			v->missed = 0;
+			view_damaged(v);
+		}
+}
+
+/*
+ * damage: auto, once per sample. A busy target whose damage mostly
+ * lands in its views gets bounding boxes: the copies hardly grow, the
+ * events drop. If nearly all of it lands there, non-empty reports
+ * (copy the whole cache) follow. It steps back when the target calms
+ * down or most damage misses the views, and non-empty is re-checked
+ * now and then since its reports have no area to measure.
+ */
+void
+adapt_damage_level(target_ctx_t *t)
+{
+	long ms = ms_since(&t->rate_since);
+	int level = t->level;
+	long rate, in;
+
+	if (ms < DAMAGE_SAMPLE_MS)
+		return;
+	rate = t->rate_events * 1000L / ms;
+	in = t->rate_px ? t->rate_px_in * 100 / t->rate_px : 0;
+	now_tv(&t->rate_since);
+	t->rate_events = 0;
+	t->rate_px = t->rate_px_in = 0;
+
+	switch (level) {
+	case XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES:
+		if (rate >= cfg.damage_busy_hz && in >= 50)
+			level = XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX;
+		break;
+	case XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX:
+		/* one report per subtract, the rates are much lower */
+		if (in < 25 || rate < cfg.damage_busy_hz / 20)
+			level = XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES;
+		else if (in >= 90 && rate >= cfg.damage_busy_hz / 4)
+			level = XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY;
+		break;
+	case XCB_DAMAGE_REPORT_LEVEL_NON_EMPTY:
+		if (rate < cfg.damage_busy_hz / 20 ||
+		    ms_since(&t->level_since) >= DAMAGE_PROBE_MS)
+			level = XCB_DAMAGE_REPORT_LEVEL_BOUNDING_BOX;
+		break;
+	}
+	if (level != t->level) {
+		n_level_switches++;
+		set_damage_level(t, level);
+	}
+	if (level != XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES)
+		n_coarse_seen = 1;
+}
+
+/*
+ * a coarse target that went quiet sends no damage to adapt on, so its
+ * step down is also checked once a sample from the main loop
+ */
+void
+check_damage_levels(void)
+{
+	if (cfg.damage_level != CONFIG_DAMAGE_AUTO ||
+	    ms_since(&last_level_check) < DAMAGE_SAMPLE_MS)
+		return;
+	now_tv(&last_level_check);
+	n_coarse_seen = 0;
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_TARGET)
+			continue;
+		target_ctx_t *t = windows[i].ctx;
+		if (!t->damage ||
+		    t->level == XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES)
+			continue;
+		adapt_damage_level(t);
+		n_coarse_seen += t->level !=
+			XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES;
+	}
+}
+
+/*
+ * ms until check_damage_levels is due, -1 while no target is coarse
+ */
+long
+level_wait_ms(void)
+{
+	if (!n_coarse_seen)
+		return -1;
+	long left = DAMAGE_SAMPLE_MS - ms_since(&last_level_check);
+	return left > 0 ? left : 0;
+}
+
+/*
+ * a fully obscured or unmapped view isn't copied to. Damage only
+ * marks it missed, and one copy catches up once it shows again.
+ */
+void
+set_view_visibility(view_ctx_t *v, int obscured, int unmapped)
+{
+	int was_hidden = view_hidden(v);
+
+	v->obscured = obscured;
+	v->unmapped = unmapped;
+	if (view_hidden(v) == was_hidden)
+		return;
+
+	deb("view 0x%x %s\n", v->window, was_hidden ? "shown" : "hidden");
+	if (!was_hidden && v->dirty) {
+		clear_view_dirty(v);
+		v->missed = 1;
+	}
+	update_target_damage(v->t);
+	if (was_hidden && v->missed) {
+		v->missed = 0;
+		view_damaged(v);
+	}
+}
+
+/*
+ * screensaver or DPMS changed, blank or wake all views at once
+ */
+void
+update_blanked(void)
+{
+	int now = saver_on || dpms_off;
+
+	if (now == blanked)
+		return;
+	deb("screen %s\n", now ? "blanked" : "awake");
+	for (int i = 0; i < nwindows && now; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		if (v->dirty) {
+			clear_view_dirty(v);
+			v->missed = 1;
+		}
+	}
+	blanked = now;
+	for (int i = 0; i < nwindows; i++)
+		if (windows[i].type == WIN_TYPE_TARGET)
+			update_target_damage(windows[i].ctx);
+	for (int i = 0; i < nwindows && !now; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		if (v->missed && !view_hidden(v)) {
+			v->missed = 0;
+			view_damaged(v);
+		}
+	}
+}
+
+/*
+ * keep the current capture area in a pixmap that serves all further
+ * exposes of a frozen view
+ */
+void
+freeze_view(view_ctx_t *v)
+{
+	target_ctx_t *t = v->t;
+
+	if (v->still || !t->cache || !v->gc)
+		return;
+
+	sync_target_cache(t);
+	v->still = xcb_generate_id(c);
+	xcb_create_pixmap(c, v->depth, v->still, v->window,
+		v->cap_width, v->cap_height);
+	xcb_copy_area(c, t->cache, v->still, v->gc,
+		v->cap_x - t->cache_x, v->cap_y - t->cache_y,
+		0, 0, v->cap_width, v->cap_height);
+}
+
+void
+set_refresh_policy(view_ctx_t *v, refresh_policy_t policy, int fps)
+{
+	refresh_policy_t old = v->refresh;
+
+	if (policy < REFRESH_LIVE || policy > REFRESH_FROZEN)
+		policy = REFRESH_LIVE;
+	v->refresh = policy;
+	v->refresh_fps = fps > 0 ? fps : 1;
+
+	if (old == REFRESH_FROZEN && policy != REFRESH_FROZEN && v->still) {
+		xcb_free_pixmap(c, v->still);
+		v->still = 0;
+		v->stale = 1;
+	}
+
+	if (policy == REFRESH_FROZEN) {
+		clear_view_dirty(v);
+		freeze_view(v);
+	} else if (view_wait_ms(v) < 0) {
+		if (v->dirty) {
+			clear_view_dirty(v);
+			v->stale = 1;
+		}
+	} else if (v->stale) {
+		/* catch up on what was missed */
+		redraw_view(v);
+	}
+	deb("view 0x%x refresh policy %d (%d fps)\n", v->window,
+		v->refresh, v->refresh_fps);
+
+	update_target_damage(v->t);
+}
+
+/*
+ * explicit refresh: copy the current content, a frozen view takes a
+ * new still
+ */
+void
+refresh_view(view_ctx_t *v)
+{
+	if (v->refresh == REFRESH_FROZEN && v->still &&
+	    !v->t->disconnected) {
+		xcb_free_pixmap(c, v->still);
+		v->still = 0;
+		freeze_view(v);
+	}
+	clear_view_dirty(v);
+	v->hist_show = 0;
+	redraw_view(v);
+}
+
+/*
+ * step through v's history, back from the content if it shows none.
+ * Forward past the newest frame shows the content again.
+ */
+void
+scrub_history(view_ctx_t *v, int back)
+{
+	unsigned show = v->hist_show ? v->hist_show : v->hist.seq;
+
+	if (!v->hist.n || (!back && !v->hist_show))
+		return;
+	if (back && show != hist_oldest(&v->hist))
+		show--;
+	else if (!back)
+		show++;
+	v->hist_show = show == v->hist.seq ? 0 : show;
+	redraw_view(v);
+	xcb_flush(c);
+}
+
+void
+initialize_state_path(void)
+{
+	const char *home = getenv("HOME");
+	if (!home)
+		return;
+	char dir1[512], dir2[512];
+	snprintf(dir1, sizeof(dir1), "%s/.config", home);
+	mkdir(dir1, 0755);
+	snprintf(dir2, sizeof(dir2), "%s/.config/sniptotop", home);
+	mkdir(dir2, 0755);
+	snprintf(state_path, sizeof(state_path),
+		"%s/.config/sniptotop/state", home);
+	snprintf(thumbs_path, sizeof(thumbs_path), "%s.thumbs", state_path);
+	snprintf(config_path, sizeof(config_path),
+		"%s/.config/sniptotop/config.yaml", home);
+	snprintf(rules_path, sizeof(rules_path),
+		"%s/.config/sniptotop/rules.yaml", home);
+	snprintf(rules_dir, sizeof(rules_dir), "%s", dir2);
+}
+
+/*
+ * (re)read the config file, a broken file keeps the settings in use.
+ * The border width only applies at startup, existing views are sized
+ * for the old one.
+ */
+void
+load_config(int startup)
+{
+	config_t old = cfg;
+	char err[640];
+	int ret;
+
+	if (config_path[0] == '\0')
+		return;
+	recorded_file("config", config_path);
+	ret = config_load(config_path, &cfg, err, sizeof(err));
+	if (ret < 0) {
+		fprintf(stderr, "%s, keeping the %s settings\n", err,
+			startup ? "default" : "current");
+		return;
+	}
+	deb("config %s\n", ret ? "file missing, using defaults" : "loaded");
+	if (replaying)
+		cfg.stats_file[0] = '\0';
+	snap_distance = cfg.snap_distance;
+	hist_configure(cfg.history_frames, cfg.history_s * 1000,
+		(long)cfg.history_mb << 20, drop_history_frame);
+	if (startup) {
+		border_width = cfg.border_width;
+		return;
+	}
+
+	if (cfg.border_width != border_width)
+		fprintf(stderr, "border_width %d takes effect on restart\n",
+			cfg.border_width);
+	if (cfg.damage_level != old.damage_level) {
+		for (int i = 0; i < nwindows; i++)
+			if (windows[i].type == WIN_TYPE_TARGET)
+				set_damage_level(windows[i].ctx,
+					initial_damage_level());
+		for (int i = 0; i < n_disconnected; i++)
+			((target_ctx_t *)disconnected_targets[i])->level =
+				initial_damage_level();
+	}
+	if (cfg.stats_interval_s != old.stats_interval_s)
+		now_tv(&last_stats);
+}
+
+/*
+ * (re)read the rules, a broken file keeps the rules in use
+ */
+void
+load_rules(void)
+{
+	char err[640];
+	int ret;
+
+	if (rules_path[0] == '\0')
+		return;
+	recorded_file("rules", rules_path);
+	ret = rules_load(rules_path, rules_dir, &rules, err, sizeof(err));
+	if (ret < 0) {
+		fprintf(stderr, "%s, keeping the current rules\n", err);
+		return;
+	}
+	deb("%d rules\n", rules.n);
+	for (int i = 0; i < nwindows; i++)
+		if (windows[i].type == WIN_TYPE_VIEW)
+			assign_rules(windows[i].ctx);
+}
+
+/*
+ * watch the config directory rather than the file, editors tend to
+ * replace it
+ */
+void
+initialize_config_watch(void)
+{
+	char dir[520];
+
+	if (config_path[0] == '\0')
+		return;
+	snprintf(dir, sizeof(dir), "%s", config_path);
+	*strrchr(dir, '/') = '\0';
+
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		deb("inotify_init1: %s, config is not reloaded\n",
+			strerror(errno));
+		return;
+	}
+	if (inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE |
+			IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+		deb("watching %s: %s, config is not reloaded\n",
+			dir, strerror(errno));
+		close(inotify_fd);
+		inotify_fd = -1;
+	}
+}
+
+/*
+ * drain the inotify events, reload if one of them is about the config
+ * or rules file. Both are read either way, so a replay knows which
+ * files come.
+ */
+void
+check_config_watch(void)
+{
+	char buf[4096]
+		__attribute__((aligned(__alignof__(struct inotify_event))));
+	const char *base = strrchr(config_path, '/') + 1;
+	const char *rules_base = strrchr(rules_path, '/') + 1;
+	int changed = 0;
+	ssize_t len;
+
+	while ((len = read(inotify_fd, buf, sizeof(buf))) > 0) {
+		for (char *p = buf; p < buf + len; ) {
+			struct inotify_event *ev = (void *)p;
+			if (ev->len && (strcmp(ev->name, base) == 0 ||
+			    strcmp(ev->name, rules_base) == 0))
+				changed = 1;
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+	if (changed) {
+		load_config(0);
+		load_rules();
+	}
+}
+
+/*
+ * fetch the frames that changed since the last save, all requests go
+ * out before the first reply is waited for, and hand the whole set to
+ * the background writer
+ */
+void
+save_thumbnails(void)
+{
+	xcb_get_image_cookie_t *cookies;
+	view_ctx_t **views;
+	int n = 0;
+
+	now_tv(&last_thumbs);
+	if (thumbs_path[0] == '\0' || xcb_connection_has_error(c))
+		return;
+
+	cookies = malloc(nwindows * sizeof(*cookies));
+	views = malloc(nwindows * sizeof(*views));
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		target_ctx_t *t = v->t;
+		if (t->mirror ||
+		    (v->thumb && v->thumb_seq == v->frame_seq))
+			continue;
+		if (v->depth != 24 && v->depth != 32)
+			continue;
+		if (v->still) {
+			cookies[n] = xcb_get_image(c, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				v->still, 0, 0,
+				v->cap_width, v->cap_height, ~0);
+		} else if (t->cache) {
+			sync_target_cache(t);
+			cookies[n] = xcb_get_image(c, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				t->cache,
+				v->cap_x - t->cache_x, v->cap_y - t->cache_y,
+				v->cap_width, v->cap_height, ~0);
+		} else {
+			continue;
+		}
+		views[n++] = v;
+	}
+
+	for (int i = 0; i < n; i++) {
+		view_ctx_t *v = views[i];
+		xcb_get_image_reply_t *r =
+			REPLY(xcb_get_image_reply, cookies[i], NULL);
+		if (!r)
+			continue;
+		int len = xcb_get_image_data_length(r);
+		int stride = len / v->cap_height;
+		if (stride >= v->cap_width * 4 &&
+		    stride * v->cap_height == len) {
+			thumb_buf_unref(v->thumb);
+			v->thumb = thumb_buf_new(r->depth, v->cap_width,
+				v->cap_height, stride, xcb_get_image_data(r));
+			v->thumb_seq = v->frame_seq;
+		}
+		free(r);
+	}
+	free(cookies);
+	free(views);
+	if (n == 0 && !thumbs_stale)
+		return;
+	thumbs_stale = 0;
+
+	thumb_set_t *ts = thumb_set_new();
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		if (v->thumb)
+			thumb_set_add(ts, v->t->name, v->cap_x, v->cap_y,
+				v->cap_width, v->cap_height, v->thumb);
+	}
+	thumbs_write_async(thumbs_path, ts);
+}
+
+/*
+ * the shared segment, at least size bytes. The server attaches it
+ * with the request, IPC_RMID waits for the first reply that used it.
+ */
+int
+shm_reserve(size_t size)
+{
+	if (shm.addr && shm.size >= size)
+		return 0;
+	shm_release();
+	size = (size + 0xffff) & ~(size_t)0xffff;
+	shm.id = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+	if (shm.id < 0)
+		return -1;
+	shm.addr = shmat(shm.id, NULL, 0);
+	if (shm.addr == (void *)-1) {
+		shmctl(shm.id, IPC_RMID, NULL);
+		shm.addr = NULL;
+		return -1;
+	}
+	shm.seg = xcb_generate_id(c);
+	xcb_shm_attach(c, shm.seg, shm.id, 0);
+	shm.size = size;
+	shm.removed = 0;
+	return 0;
+}
+
+void
+shm_release(void)
+{
+	if (!shm.addr)
+		return;
+	xcb_shm_detach(c, shm.seg);
+	shmdt(shm.addr);
+	if (!shm.removed)
+		shmctl(shm.id, IPC_RMID, NULL);
+	shm.addr = NULL;
+}
+
+/*
+ * a fetch of part of a capture area: the request goes out with others,
+ * the reply is read after all of them were sent, so fetching many
+ * views costs one round trip
+ */
+typedef struct {
+	frame_t *f;
+	xcb_drawable_t d;
+	int x;			/* in d */
+	int y;
+	int shm;		/* into the shared segment at offset */
+	size_t offset;
+	xcb_shm_get_image_cookie_t sc;
+	xcb_get_image_cookie_t gc;
+} fetch_t;
+
+/*
+ * where part of the capture area is, as it is in the cache (or the
+ * still of a frozen view); -1 if there is nothing to fetch
+ */
+int
+fetch_locate(view_ctx_t *v, int x, int y, int w, int h, frame_t *f,
+	fetch_t *q)
+{
+	target_ctx_t *t = v->t;
+
+	if (v->depth != 24 && v->depth != 32)
+		return -1;
+	if (v->still) {
+		q->d = v->still;
+	} else if (t->cache) {
+		sync_target_cache(t);
+		q->d = t->cache;
+		x += v->cap_x - t->cache_x;
+		y += v->cap_y - t->cache_y;
+	} else {
+		return -1;
+	}
+	q->f = f;
+	q->x = x;
+	q->y = y;
+	f->width = w;
+	f->height = h;
+	f->stride = w * 4;
+	f->msb_first = xcb_get_setup(c)->image_byte_order ==
+		XCB_IMAGE_ORDER_MSB_FIRST;
+	f->data = NULL;
+	return 0;
+}
+
+/*
+ * the requests of n fetches, one after the other in the shared
+ * segment if there is one
+ */
+void
+fetch_send(fetch_t *q, int n)
+{
+	size_t total = 0;
+	int use_shm;
+
+	for (int i = 0; i < n; i++) {
+		q[i].offset = total;
+		total += (size_t)q[i].f->stride * q[i].f->height;
+	}
+	use_shm = n && shm_present && shm_reserve(total) == 0;
+	for (int i = 0; i < n; i++) {
+		frame_t *f = q[i].f;
+		q[i].shm = use_shm;
+		if (use_shm)
+			q[i].sc = xcb_shm_get_image(c, q[i].d, q[i].x,
+				q[i].y, f->width, f->height, ~0,
+				XCB_IMAGE_FORMAT_Z_PIXMAP, shm.seg,
+				q[i].offset);
+		else
+			q[i].gc = xcb_get_image(c, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				q[i].d, q[i].x, q[i].y, f->width, f->height,
+				~0);
+	}
+}
+
+/*
+ * the reply of a fetch into its frame, -1 if there is none
+ */
+int
+fetch_recv(fetch_t *q)
+{
+	frame_t *f = q->f;
+	size_t size = (size_t)f->stride * f->height;
+
+	if (q->shm) {
+		xcb_shm_get_image_cookie_t sc = q->sc;
+		xcb_shm_get_image_reply_t *sr;
+
+		sr = REPLY(xcb_shm_get_image_reply, sc, NULL);
+		/* an earlier fetch of the batch may have dropped it */
+		if (sr && shm.addr) {
+			if (!shm.removed) {
+				shmctl(shm.id, IPC_RMID, NULL);
+				shm.removed = 1;
+			}
+			free(sr);
+			f->data = malloc(size);
+			if (!f->data)
+				return -1;
+			memcpy(f->data, shm.addr + q->offset, size);
+			return 0;
+		}
+		free(sr);
+		if (shm.addr) {
+			/* the attach failed too, don't try again */
+			deb("MIT-SHM GetImage failed, using GetImage\n");
+			shm_release();
+			shm_present = 0;
+		}
+		q->gc = xcb_get_image(c, XCB_IMAGE_FORMAT_Z_PIXMAP, q->d,
+			q->x, q->y, f->width, f->height, ~0);
+	}
+
+	xcb_get_image_cookie_t gc = q->gc;
+	xcb_get_image_reply_t *r = REPLY(xcb_get_image_reply, gc, NULL);
+	if (!r)
+		return -1;
+	int len = xcb_get_image_data_length(r);
+	f->stride = len / f->height;
+	if (f->stride < f->width * 4 || f->stride * f->height != len ||
+	    !(f->data = malloc(len))) {
+		free(r);
+		return -1;
+	}
+	memcpy(f->data, xcb_get_image_data(r), len);
+	free(r);
+	return 0;
+}
+
+/*
+ * part of the capture area into f, -1 if there is nothing to fetch
+ */
+int
+fetch_area(view_ctx_t *v, int x, int y, int w, int h, frame_t *f)
+{
+	fetch_t q;
+
+	if (fetch_locate(v, x, y, w, h, f, &q) < 0)
+		return -1;
+	fetch_send(&q, 1);
+	return fetch_recv(&q);
+}
+
+int
+fetch_frame(view_ctx_t *v, frame_t *f)
+{
+	return fetch_area(v, 0, 0, v->cap_width, v->cap_height, f);
+}
+
+/*
+ * <capture_dir>/<target name>-<date>-<time>-<ms>.<ext>. A replay
+ * writes to /dev/null.
+ */
+void
+capture_path(view_ctx_t *v, const char *ext, char *path, int len)
+{
+	const char *dir = cfg.capture_dir[0] ? cfg.capture_dir : ".";
+	struct timeval now;
+	struct tm tm;
+	char name[64], stamp[32];
+	int i;
+
+	now_tv(&now);
+	if (replaying) {
+		snprintf(path, len, "/dev/null");
+		return;
+	}
+	for (i = 0; v->t->name[i] && i < (int)sizeof(name) - 1; i++) {
+		char ch = v->t->name[i];
+		name[i] = isalnum((unsigned char)ch) || ch == '-' ||
+			ch == '.' ? ch : '_';
+	}
+	name[i] = '\0';
+	localtime_r(&now.tv_sec, &tm);
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	snprintf(path, len, "%s/%s-%s-%03ld.%s", dir, i ? name : "snip",
+		stamp, (long)now.tv_usec / 1000, ext);
+}
+
+/*
+ * 's': the capture area to a PPM file
+ */
+void
+snapshot_view(view_ctx_t *v)
+{
+	char path[640];
+	frame_t f;
+
+	if (fetch_frame(v, &f) < 0) {
+		fprintf(stderr, "warning: no frame of '%s' to save\n",
+			v->t->name);
+		return;
+	}
+	capture_path(v, "ppm", path, sizeof(path));
+	frames_snapshot(path, &f);
+	printf("snapshot: %s\n", path);
+	fflush(stdout);
+}
+
+void
+stop_recording(view_ctx_t *v)
+{
+	frames_close(v->stream);
+	v->stream = NULL;
+	n_recordings--;
+	printf("recording stopped: %ld frames, %ld dropped\n",
+		v->stream_frames, v->stream_dropped);
+	fflush(stdout);
+	if (v->hud)
+		draw_hud(v);
+}
+
+/*
+ * shift+s: record the view at its throttled rate, cfg.record_fps
+ * otherwise. Frames are taken on a fixed clock and repeated while
+ * the view isn't copied, so the video keeps real time.
+ */
+void
+toggle_recording(view_ctx_t *v)
+{
+	char path[640];
+
+	if (v->stream) {
+		stop_recording(v);
+		return;
+	}
+	if (v->depth != 24 && v->depth != 32) {
+		fprintf(stderr, "warning: can't record a depth %d snip\n",
+			v->depth);
+		return;
+	}
+	capture_path(v, "y4m", path, sizeof(path));
+	v->stream_fps = v->refresh == REFRESH_THROTTLED ?
+		v->refresh_fps : cfg.record_fps;
+	v->stream = frames_open(path, v->cap_width, v->cap_height,
+		v->stream_fps);
+	if (!v->stream)
+		fail("out of memory for a %dx%d recording", v->cap_width,
+			v->cap_height);
+	now_tv(&v->stream_start);
+	v->stream_frames = 0;
+	v->stream_dropped = 0;
+	n_recordings++;
+	printf("recording: %s\n", path);
+	fflush(stdout);
+	if (v->hud)
+		draw_hud(v);
+}
+
+/*
+ * ms until the next recording frame is due, -1 if none
+ */
+int
+recording_wait_ms(void)
+{
+	int wait_ms = -1;
+
+	if (n_recordings == 0)
+		return -1;
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		if (!v->stream)
+			continue;
+		long ms = v->stream_frames * 1000 / v->stream_fps -
+			ms_since(&v->stream_start);
+		if (ms < 0)
+			ms = 0;
+		if (wait_ms < 0 || ms < wait_ms)
+			wait_ms = ms;
+	}
+	return wait_ms;
+}
+
+/*
+ * recording frames are fetched at the end of a pass and read at the
+ * start of the next, so the server copies them out while the main
+ * loop sleeps instead of stalling the pass. Nothing else waits for a
+ * reply in between, so the replies are read in the order they were
+ * asked for, also in a replay.
+ */
+view_ctx_t **rec_views;
+long *rec_due;			/* frames each fetch stands for */
+frame_t *rec_frames;
+fetch_t *rec_fetches;
+int rec_alloc = 0;
+int rec_pending = 0;
+
+/*
+ * due frames into the stream, fp first and repeats of the last frame
+ * after it
+ */
+void
+put_frames(view_ctx_t *v, frame_t *fp, long due)
+{
+	for (; due > 0; due--, v->stream_frames++) {
+		if (frames_put(v->stream, fp) < 0) {
+			v->stream_dropped++;
+			/* fetch it again next time */
+			if (fp)
+				v->stream_seq = v->frame_seq - 1;
+		}
+		fp = NULL;
+	}
+}
+
+/*
+ * the fetches record_frames sent at the end of the last pass
+ */
+void
+collect_frames(void)
+{
+	for (int i = 0; i < rec_pending; i++) {
+		view_ctx_t *v = rec_views[i];
+		frame_t *fp = &rec_frames[i];
+
+		if (fetch_recv(&rec_fetches[i]) < 0) {
+			fp = NULL;
+			v->stream_seq = v->frame_seq - 1;
+		}
+		put_frames(v, fp, rec_due[i]);
+	}
+	rec_pending = 0;
+}
+
+/*
+ * queue the recording frames that are due: a fresh one if the view
+ * was copied since the last, else repeats. After a stall of more than
+ * a second the rest is skipped, the video loses that time. Runs last
+ * in a pass, the fresh frames go in with the next one.
+ */
+void
+record_frames(void)
+{
+	if (n_recordings == 0)
+		return;
+	if (rec_alloc < n_recordings) {
+		rec_alloc = n_recordings;
+		rec_views = realloc(rec_views, rec_alloc * sizeof(*rec_views));
+		rec_due = realloc(rec_due, rec_alloc * sizeof(*rec_due));
+		rec_frames = realloc(rec_frames,
+			rec_alloc * sizeof(*rec_frames));
+		rec_fetches = realloc(rec_fetches,
+			rec_alloc * sizeof(*rec_fetches));
+		if (!rec_views || !rec_due || !rec_frames || !rec_fetches)
+			fail("out of memory for %d recordings", rec_alloc);
+	}
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		if (!v->stream)
+			continue;
+		long due = ms_since(&v->stream_start) * v->stream_fps / 1000 +
+			1 - v->stream_frames;
+		if (due <= 0)
+			continue;
+		if (due > v->stream_fps) {
+			v->stream_frames += due - v->stream_fps;
+			due = v->stream_fps;
+		}
+
+		int k = rec_pending;
+		if ((v->stream_frames == 0 || v->stream_seq != v->frame_seq) &&
+		    fetch_locate(v, 0, 0, v->cap_width, v->cap_height,
+		    &rec_frames[k], &rec_fetches[k]) == 0) {
+			rec_views[k] = v;
+			rec_due[k] = due;
+			rec_pending++;
+			v->stream_seq = v->frame_seq;
+			continue;
+		}
+		put_frames(v, NULL, due);
+	}
+	fetch_send(rec_fetches, rec_pending);
+}
+
+/*
+ * rule i's region in capture area coordinates, clipped to it. 0 if
+ * nothing is left, or a match image doesn't fit completely.
+ */
+int
+rule_region(view_ctx_t *v, int i, int *x, int *y, int *w, int *h)
+{
+	const rule_t *r = &rules.r[i];
+
+	*x = r->x;
+	*y = r->y;
+	*w = r->w ? r->w : v->cap_width;
+	*h = r->h ? r->h : v->cap_height;
+	if (r->kind == RULE_MATCH)
+		return *x + *w <= v->cap_width && *y + *h <= v->cap_height;
+	if (*x + *w > v->cap_width)
+		*w = v->cap_width - *x;
+	if (*y + *h > v->cap_height)
+		*h = v->cap_height - *y;
+	return *w > 0 && *h > 0;
+}
+
+/*
+ * v goes on rule_views while it has rules to fetch or results to
+ * wait for, and off it again after
+ */
+void
+update_rule_views(view_ctx_t *v)
+{
+	int want = v->rules_dirty || v->rule_job;
+
+	if (want && !v->rule_pos) {
+		if (n_rule_views == rule_views_alloc) {
+			rule_views_alloc = rule_views_alloc ?
+				rule_views_alloc * 2 : 16;
+			rule_views = realloc(rule_views, rule_views_alloc *
+				sizeof(*rule_views));
+			if (!rule_views)
+				fail("out of memory for %d rule views",
+					rule_views_alloc);
+		}
+		rule_views[n_rule_views++] = v;
+		v->rule_pos = n_rule_views;
+	} else if (!want && v->rule_pos) {
+		/* the last one moves into the hole */
+		view_ctx_t *last = rule_views[--n_rule_views];
+		last->rule_pos = v->rule_pos;
+		rule_views[v->rule_pos - 1] = last;
+		v->rule_pos = 0;
+	}
+}
+
+/*
+ * the rules for v's target, checked from scratch: the first results
+ * only set the state, flashes come when a rule turns true after that
+ */
+void
+assign_rules(view_ctx_t *v)
+{
+	v->rule_mask = 0;
+	for (int i = 0; i < rules.n; i++)
+		if (strcmp(rules.r[i].snip, v->t->name) == 0)
+			v->rule_mask |= 1ULL << i;
+	v->rule_state = 0;
+	v->rule_known = 0;
+	v->rules_dirty = v->rule_mask != 0;
+	/* a result that is still out belongs to the old rules */
+	v->rule_job = 0;
+	update_rule_views(v);
+}
+
+/*
+ * whether damage at x, y, w, h (target coordinates) touches a rule
+ * region of v
+ */
+int
+rules_damaged(view_ctx_t *v, int x, int y, int w, int h)
+{
+	int rx, ry, rw, rh;
+
+	for (int i = 0; i < rules.n; i++) {
+		if (!(v->rule_mask & 1ULL << i) ||
+		    !rule_region(v, i, &rx, &ry, &rw, &rh))
+			continue;
+		if (overlap(x, w, v->cap_x + rx, rw) &&
+		    overlap(y, h, v->cap_y + ry, rh))
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * the bounding box of v's rule regions, in capture area coordinates.
+ * 0 if all of them are outside the capture area, then there is
+ * nothing to check and none of them is true.
+ */
+int
+rules_area(view_ctx_t *v, int *x1, int *y1, int *x2, int *y2)
+{
+	int x, y, w, h;
+
+	*x1 = *y1 = INT_MAX;
+	*x2 = *y2 = INT_MIN;
+	for (int i = 0; i < rules.n; i++) {
+		if (!(v->rule_mask & 1ULL << i) ||
+		    !rule_region(v, i, &x, &y, &w, &h))
+			continue;
+		*x1 = x < *x1 ? x : *x1;
+		*y1 = y < *y1 ? y : *y1;
+		*x2 = x + w > *x2 ? x + w : *x2;
+		*y2 = y + h > *y2 ? y + h : *y2;
+	}
+	if (*x1 == INT_MAX) {
+		v->rule_known = v->rule_mask;
+		v->rule_state = 0;
+		v->rules_dirty = 0;
+		update_rule_views(v);
+		return 0;
+	}
+	return 1;
+}
+
+/*
+ * queue the checks of v on j, whose frame holds v's rules area from
+ * x1, y1. A replay only fetches, the results are in the recording.
+ */
+void
+submit_rules(view_ctx_t *v, rule_job_t *j, int x1, int y1)
+{
+	int x, y, w, h;
+
+	for (int i = 0; i < rules.n; i++) {
+		if (!(v->rule_mask & 1ULL << i) ||
+		    !rule_region(v, i, &x, &y, &w, &h))
+			continue;
+		if (rule_check_init(&j->c[j->n++], &rules.r[i], i, x - x1,
+				y - y1, w, h, j->f.msb_first) < 0)
+			fail("out of memory for a rule job");
+	}
+	if (++rule_seq == 0)
+		rule_seq = 1;
+	j->seq = rule_seq;
+	v->rule_job = j->seq;
+	v->rules_dirty = 0;
+	rule_jobs++;
+	n_rule_checks += j->n;
+	if (replaying)
+		rule_job_free(j);
+	else
+		rules_submit(j);
+}
+
+/*
+ * fetch the rules areas of the marked views, all requests first and
+ * then the replies, and queue their checks
+ */
+void
+fetch_rules(void)
+{
+	struct {
+		view_ctx_t *v;
+		rule_job_t *j;
+		int x1;
+		int y1;
+	} *m = NULL;
+	fetch_t *q = NULL;
+	int n = 0, x1, y1, x2, y2;
+
+	/* backwards, a view rules_area drops only moves a visited one */
+	for (int i = n_rule_views - 1; i >= 0; i--) {
+		view_ctx_t *v = rule_views[i];
+		if (!v->rules_dirty || !v->notify || v->rule_job ||
+		    !rules_area(v, &x1, &y1, &x2, &y2))
+			continue;
+		if (!m) {
+			m = malloc(n_rule_views * sizeof(*m));
+			q = malloc(n_rule_views * sizeof(*q));
+			if (!m || !q)
+				fail("out of memory for rule fetches");
+		}
+		rule_job_t *j = calloc(1, sizeof(*j));
+		if (!j)
+			fail("out of memory for a rule job");
+		if (fetch_locate(v, x1, y1, x2 - x1, y2 - y1, &j->f,
+				&q[n]) < 0) {
+			/* no frame yet, try again next pass */
+			free(j);
+			continue;
+		}
+		m[n].v = v;
+		m[n].j = j;
+		m[n].x1 = x1;
+		m[n].y1 = y1;
+		n++;
+	}
+	fetch_send(q, n);
+	for (int k = 0; k < n; k++) {
+		if (fetch_recv(&q[k]) < 0) {
+			free(m[k].j);
+			continue;
+		}
+		submit_rules(m[k].v, m[k].j, m[k].x1, m[k].y1);
+	}
+	free(m);
+	free(q);
+}
+
+/*
+ * queue the marked views and take in the results that are back: each
+ * result is a job number and the rules (set indices) that are true.
+ * Only rules that were false before flash the view.
+ */
+void
+check_rules(void)
+{
+	struct rule_result { unsigned seq; uint64_t hits; } *res = NULL;
+	uint32_t len = 0;
+	int n = 0;
+
+	if (n_rule_views)
+		fetch_rules();
+	if (rule_jobs == 0)
+		return;
+
+	if (replaying) {
+		res = replay_get(REC_POLL, "rules", &len);
+		n = len / sizeof(*res);
+	} else {
+		int err;
+		rule_job_t *list = rules_collect(&err);
+		if (err)
+			fail("rules: can't wake the main loop: %s",
+				strerror(err));
+		for (rule_job_t *j = list; j; j = j->next)
+			n++;
+		res = malloc(n * sizeof(*res) + 1);
+		if (!res)
+			fail("out of memory for %d rule results", n);
+		n = 0;
+		while (list) {
+			rule_job_t *j = list;
+			list = j->next;
+			res[n].seq = j->seq;
+			res[n].hits = 0;
+			for (int k = 0; k < j->n; k++)
+				if (j->hits & 1ULL << k)
+					res[n].hits |= 1ULL << j->c[k].rule;
+			n++;
+			rule_job_free(j);
+		}
+		if (recording)
+			rec_put(&rec, REC_POLL, "rules", res,
+				n * sizeof(*res));
+	}
+
+	rule_jobs -= n;
+	for (int r = 0; r < n; r++) {
+		view_ctx_t *v = NULL;
+		for (int i = 0; i < n_rule_views && !v; i++)
+			if (rule_views[i]->rule_job == res[r].seq)
+				v = rule_views[i];
+		if (!v)
+			continue;	/* closed or rules reloaded */
+		v->rule_job = 0;
+		update_rule_views(v);
+		uint64_t hits = res[r].hits & v->rule_mask;
+		uint64_t turned = hits & ~v->rule_state & v->rule_known;
+		v->rule_state = hits;
+		v->rule_known = v->rule_mask;
+		if (turned && v->notify) {
+			n_rule_hits += __builtin_popcountll(turned);
+			deb("rules 0x%llx turned true in a view of '%s'\n",
+				(unsigned long long)turned, v->t->name);
+			start_notify_flash(v);
+		}
+	}
+	free(res);
+}
+
+/*
+ * title of w on the connection sc is name, _NET_WM_NAME or WM_NAME
+ */
+int
+mirror_title_is(xcb_connection_t *sc, xcb_window_t w, const char *name,
+	xcb_atom_t net_wm_name, xcb_atom_t utf8)
+{
+	xcb_get_property_cookie_t pc[2];
+	int found = 0;
+
+	pc[0] = xcb_get_property(sc, 0, w, net_wm_name, utf8, 0, 256);
+	pc[1] = xcb_get_property(sc, 0, w, XCB_ATOM_WM_NAME,
+		XCB_ATOM_ANY, 0, 256);
+	for (int k = 0; k < 2; k++) {
+		xcb_get_property_reply_t *r =
+			xcb_get_property_reply(sc, pc[k], NULL);
+		if (r && !found && xcb_get_property_value_length(r) > 0) {
+			int len = xcb_get_property_value_length(r);
+			found = len == (int)strlen(name) &&
+				!memcmp(xcb_get_property_value(r), name, len);
+			/* _NET_WM_NAME decides when it is set */
+			if (k == 0)
+				found |= 2;
+		}
+		free(r);
+	}
+	return found & 1;
+}
+
+/*
+ * window with that title below w: a top level window or the client in
+ * a window manager frame
+ */
+xcb_window_t
+mirror_find(xcb_connection_t *sc, xcb_window_t w, const char *name,
+	int levels, xcb_atom_t net_wm_name, xcb_atom_t utf8)
+{
+	xcb_query_tree_reply_t *tree;
+	xcb_window_t found = XCB_WINDOW_NONE;
+
+	tree = xcb_query_tree_reply(sc, xcb_query_tree(sc, w), NULL);
+	if (!tree)
+		return XCB_WINDOW_NONE;
+	int n = xcb_query_tree_children_length(tree);
+	xcb_window_t *children = xcb_query_tree_children(tree);
+	for (int i = 0; i < n && !found; i++)
+		if (mirror_title_is(sc, children[i], name, net_wm_name, utf8))
+			found = children[i];
+	for (int i = 0; i < n && !found && levels > 1; i++)
+		found = mirror_find(sc, children[i], name, levels - 1,
+			net_wm_name, utf8);
+	free(tree);
+	return found;
+}
+
+/*
+ * follow the window named mw->name on the reader's connection, once it
+ * is there; all of the cache area is fetched first
+ */
+void
+mirror_watch(xcb_connection_t *sc, mirror_win_t *mw, xcb_window_t root,
+	xcb_atom_t net_wm_name, xcb_atom_t utf8)
+{
+	xcb_get_geometry_reply_t *geom;
+	xcb_window_t w;
+	uint32_t mask = XCB_EVENT_MASK_STRUCTURE_NOTIFY;
+	int closed;
+
+	pthread_mutex_lock(&mw->src->lock);
+	closed = mw->closed;
+	pthread_mutex_unlock(&mw->src->lock);
+	if (closed)
+		return;
+	w = mirror_find(sc, root, mw->name, 2, net_wm_name, utf8);
+	if (!w)
+		return;
+	geom = xcb_get_geometry_reply(sc, xcb_get_geometry(sc, w), NULL);
+	if (!geom)
+		return;
+	if (geom->depth != 24 && geom->depth != 32) {
+		if (!mw->warned)
+			fprintf(stderr, "warning: %s: '%s' has depth %d, "
+				"only 24 and 32 are mirrored\n",
+				mw->src->display, mw->name, geom->depth);
+		mw->warned = 1;
+		free(geom);
+		return;
+	}
+	deb("mirror: '%s' is 0x%x on %s, %dx%d\n", mw->name, w,
+		mw->src->display, geom->width, geom->height);
+	xcb_change_window_attributes(sc, w, XCB_CW_EVENT_MASK, &mask);
+	mw->damage = xcb_generate_id(sc);
+	xcb_damage_create(sc, mw->damage, w,
+		XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+	mw->window = w;
+	mw->win_w = geom->width;
+	mw->win_h = geom->height;
+	free(geom);
+
+	pthread_mutex_lock(&mw->src->lock);
+	mw->dmg_x1 = mw->area_x1;
+	mw->dmg_y1 = mw->area_y1;
+	mw->dmg_x2 = mw->area_x2;
+	mw->dmg_y2 = mw->area_y2;
+	pthread_mutex_unlock(&mw->src->lock);
+}
+
+/*
+ * merge into the damage of mw, one bounding box
+ */
+void
+mirror_damage(mirror_win_t *mw, int x, int y, int w, int h)
+{
+	pthread_mutex_lock(&mw->src->lock);
+	if (mw->dmg_x1 >= mw->dmg_x2) {
+		mw->dmg_x1 = mw->dmg_x2 = x;
+		mw->dmg_y1 = mw->dmg_y2 = y;
+	}
+	if (x < mw->dmg_x1) mw->dmg_x1 = x;
+	if (y < mw->dmg_y1) mw->dmg_y1 = y;
+	if (x + w > mw->dmg_x2) mw->dmg_x2 = x + w;
+	if (y + h > mw->dmg_y2) mw->dmg_y2 = y + h;
+	pthread_mutex_unlock(&mw->src->lock);
+}
+
+/*
+ * a free buffer of at least size bytes. Segments are attached on the
+ * source right away and on our display by the main loop; the main
+ * loop also detaches a replaced one there.
+ */
+int
+mirror_reserve(xcb_connection_t *sc, int shm_ok, mirror_src_t *s,
+	mirror_buf_t *b, size_t size)
+{
+	if (b->addr && b->size >= size)
+		return 0;
+	if (b->addr) {
+		if (b->src_seg)
+			xcb_shm_detach(sc, b->src_seg);
+		if (b->shmid >= 0) {
+			shmdt(b->addr);
+			if (!b->removed)
+				shmctl(b->shmid, IPC_RMID, NULL);
+		} else {
+			free(b->addr);
+		}
+	}
+	/* mirror_detach may drop the segments on ours meanwhile */
+	pthread_mutex_lock(&s->lock);
+	if (b->seg)
+		b->old_seg = b->seg;
+	b->seg = 0;
+	b->no_seg = 0;
+	pthread_mutex_unlock(&s->lock);
+	b->addr = NULL;
+	b->src_seg = 0;
+	b->removed = 0;
+	size = (size + 0xffff) & ~(size_t)0xffff;
+	b->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+	if (b->shmid >= 0) {
+		b->addr = shmat(b->shmid, NULL, 0);
+		if (b->addr == (void *)-1) {
+			shmctl(b->shmid, IPC_RMID, NULL);
+			b->addr = NULL;
+			b->shmid = -1;
+		}
+	}
+	if (!b->addr) {
+		b->addr = malloc(size);
+		if (!b->addr)
+			return -1;
+	} else if (shm_ok) {
+		b->src_seg = xcb_generate_id(sc);
+		xcb_shm_attach(sc, b->src_seg, b->shmid, 0);
+	}
+	b->size = size;
+	return 0;
+}
+
+/*
+ * the damage of mw, clipped to the cache area and the window, into a
+ * free buffer for the main loop. Without a free buffer the damage
+ * stays and merges with what comes next, after a failed fetch it goes
+ * back for the next try.
+ */
+void
+mirror_fetch(xcb_connection_t *sc, int *shm_ok, int swap, mirror_win_t *mw)
+{
+	mirror_src_t *s = mw->src;
+	mirror_buf_t *b = NULL;
+	int x1, y1, x2, y2;
+
+	pthread_mutex_lock(&s->lock);
+	for (int k = 0; k < MIRROR_BUFS && !b; k++)
+		if (mw->buf[k].state == MBUF_FREE)
+			b = &mw->buf[k];
+	x1 = mw->dmg_x1 > mw->area_x1 ? mw->dmg_x1 : mw->area_x1;
+	y1 = mw->dmg_y1 > mw->area_y1 ? mw->dmg_y1 : mw->area_y1;
+	x2 = mw->dmg_x2 < mw->area_x2 ? mw->dmg_x2 : mw->area_x2;
+	y2 = mw->dmg_y2 < mw->area_y2 ? mw->dmg_y2 : mw->area_y2;
+	if (x1 < 0) x1 = 0;
+	if (y1 < 0) y1 = 0;
+	if (x2 > mw->win_w) x2 = mw->win_w;
+	if (y2 > mw->win_h) y2 = mw->win_h;
+	if (x1 >= x2 || y1 >= y2)
+		mw->dmg_x1 = mw->dmg_x2 = 0;
+	if (mw->closed || !b || mw->dmg_x1 >= mw->dmg_x2) {
+		pthread_mutex_unlock(&s->lock);
+		return;
+	}
+	mw->dmg_x1 = mw->dmg_x2 = 0;
+	pthread_mutex_unlock(&s->lock);
+
+	int w = x2 - x1, h = y2 - y1;
+	size_t size = (size_t)w * h * 4;
+	if (mirror_reserve(sc, *shm_ok, s, b, size) < 0) {
+		mirror_damage(mw, x1, y1, w, h);
+		return;
+	}
+
+	int ok = 0;
+	if (b->src_seg) {
+		xcb_generic_error_t *err = NULL;
+		xcb_shm_get_image_reply_t *sr = xcb_shm_get_image_reply(sc,
+			xcb_shm_get_image(sc, mw->window, x1, y1, w, h, ~0,
+				XCB_IMAGE_FORMAT_Z_PIXMAP, b->src_seg, 0),
+			&err);
+		ok = sr != NULL;
+		free(sr);
+		/* BadMatch: not viewable; anything else is the segment */
+		if (err && err->error_code == XCB_MATCH) {
+			free(err);
+			mirror_damage(mw, x1, y1, w, h);
+			return;
+		} else if (err) {
+			deb("mirror: %s can't attach segments, "
+				"using GetImage\n", s->display);
+			xcb_shm_detach(sc, b->src_seg);
+			b->src_seg = 0;
+			*shm_ok = 0;
+			free(err);
+		}
+	}
+	if (!ok) {
+		xcb_get_image_reply_t *r = xcb_get_image_reply(sc,
+			xcb_get_image(sc, XCB_IMAGE_FORMAT_Z_PIXMAP,
+				mw->window, x1, y1, w, h, ~0), NULL);
+		if (r && xcb_get_image_data_length(r) != (int)size) {
+			free(r);
+			r = NULL;
+		}
+		if (!r) {
+			mirror_damage(mw, x1, y1, w, h);
+			return;
+		}
+		memcpy(b->addr, xcb_get_image_data(r), size);
+		free(r);
+	}
+	if (swap) {
+		uint32_t *p = (uint32_t *)b->addr;
+		for (size_t i = 0; i < size / 4; i++)
+			p[i] = __builtin_bswap32(p[i]);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	b->x = x1;
+	b->y = y1;
+	b->w = w;
+	b->h = h;
+	b->state = MBUF_READY;
+	/* a full pipe already wakes the main loop, check_mirrors fails */
+	if (write(mirror_fd[1], "", 1) < 0 && errno != EAGAIN &&
+	    !s->wake_errno)
+		s->wake_errno = errno;
+	pthread_mutex_unlock(&s->lock);
+}
+
+long
+mirror_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000L + ts.tv_nsec / 1000000;
+}
+
+/*
+ * reader thread of a source display: its own connection, so a slow
+ * or busy display only delays its own mirrors. Windows that aren't
+ * there yet are looked for once a second.
+ */
+void *
+mirror_reader(void *arg)
+{
+	mirror_src_t *s = arg;
+	const xcb_query_extension_reply_t *qe;
+	xcb_generic_event_t *e;
+	xcb_connection_t *sc;
+	int damage_event, shm_ok, swap;
+	long last_search = 0;
+	char drain[64];
+
+	sc = xcb_connect(s->display, NULL);
+	if (xcb_connection_has_error(sc)) {
+		fprintf(stderr, "warning: can't open display %s, "
+			"its mirrors stay empty\n", s->display);
+		xcb_disconnect(sc);
+		return NULL;
+	}
+	qe = xcb_get_extension_data(sc, &xcb_damage_id);
+	if (!qe || !qe->present) {
+		fprintf(stderr, "warning: display %s has no DAMAGE "
+			"extension, its mirrors stay empty\n", s->display);
+		xcb_disconnect(sc);
+		return NULL;
+	}
+	damage_event = qe->first_event + XCB_DAMAGE_NOTIFY;
+	free(xcb_damage_query_version_reply(sc,
+		xcb_damage_query_version(sc, 1, 1), NULL));
+	qe = xcb_get_extension_data(sc, &xcb_shm_id);
+	shm_ok = qe && qe->present;
+
+	const xcb_setup_t *setup = xcb_get_setup(sc);
+	xcb_window_t root = xcb_setup_roots_iterator(setup).data->root;
+	swap = (setup->image_byte_order == XCB_IMAGE_ORDER_MSB_FIRST) !=
+		s->msb_first;
+	xcb_intern_atom_reply_t *ar[2] = {
+		xcb_intern_atom_reply(sc, xcb_intern_atom(sc, 0, 12,
+			"_NET_WM_NAME"), NULL),
+		xcb_intern_atom_reply(sc, xcb_intern_atom(sc, 0, 11,
+			"UTF8_STRING"), NULL),
+	};
+	xcb_atom_t net_wm_name = ar[0] ? ar[0]->atom : XCB_ATOM_NONE;
+	xcb_atom_t utf8 = ar[1] ? ar[1]->atom : XCB_ATOM_NONE;
+	free(ar[0]);
+	free(ar[1]);
+
+	struct pollfd pfd[2] = {
+		{ .fd = xcb_get_file_descriptor(sc), .events = POLLIN },
+		{ .fd = s->wake[0], .events = POLLIN },
+	};
+	while (!xcb_connection_has_error(sc)) {
+		int missing = 0;
+		/* the list is complete before the thread starts */
+		for (mirror_win_t *mw = s->wins; mw; mw = mw->next) {
+			pthread_mutex_lock(&s->lock);
+			int closed = mw->closed;
+			pthread_mutex_unlock(&s->lock);
+			if (closed && mw->window) {
+				uint32_t mask = 0;
+				xcb_damage_destroy(sc, mw->damage);
+				xcb_change_window_attributes(sc, mw->window,
+					XCB_CW_EVENT_MASK, &mask);
+				mw->window = 0;
+			} else if (!closed && !mw->window) {
+				missing = 1;
+			}
+		}
+		if (missing && mirror_ms() - last_search >= 1000) {
+			for (mirror_win_t *mw = s->wins; mw; mw = mw->next)
+				if (!mw->window)
+					mirror_watch(sc, mw, root,
+						net_wm_name, utf8);
+			last_search = mirror_ms();
+		}
+		for (mirror_win_t *mw = s->wins; mw; mw = mw->next)
+			if (mw->window)
+				mirror_fetch(sc, &shm_ok, swap, mw);
+		xcb_flush(sc);
+
+		poll(pfd, 2, missing ? 1000 : -1);
+		while (read(s->wake[0], drain, sizeof(drain)) > 0)
+			;
+		while ((e = xcb_poll_for_event(sc))) {
+			int rt = e->response_type & ~0x80;
+			for (mirror_win_t *mw = s->wins; mw; mw = mw->next) {
+				if (rt == damage_event) {
+					xcb_damage_notify_event_t *dev =
+						(void *)e;
+					if (dev->damage != mw->damage ||
+					    !mw->window)
+						continue;
+					mirror_damage(mw, dev->area.x,
+						dev->area.y, dev->area.width,
+						dev->area.height);
+				} else if (rt == XCB_CONFIGURE_NOTIFY) {
+					xcb_configure_notify_event_t *cn =
+						(void *)e;
+					if (cn->window != mw->window)
+						continue;
+					mw->win_w = cn->width;
+					mw->win_h = cn->height;
+				} else if (rt == XCB_DESTROY_NOTIFY) {
+					xcb_destroy_notify_event_t *dn =
+						(void *)e;
+					if (dn->window != mw->window)
+						continue;
+					/* the damage object went with it */
+					deb("mirror: '%s' on %s is gone\n",
+						mw->name, s->display);
+					mw->window = 0;
+				}
+			}
+			free(e);
+		}
+	}
+	fprintf(stderr, "warning: lost display %s, its mirrors stand "
+		"still\n", s->display);
+	xcb_disconnect(sc);
+	return NULL;
+}
+
+void
+mirror_wake(mirror_src_t *s)
+{
+	if (write(s->wake[1], "", 1) < 0 && errno != EAGAIN)
+		fail("mirror: can't wake the reader of %s: %s", s->display,
+			strerror(errno));
+}
+
+/*
+ * the cache of a mirror target moved or grew: the reader fetches all
+ * of it again
+ */
+void
+mirror_area(target_ctx_t *t)
+{
+	mirror_win_t *mw = t->mirror;
+
+	pthread_mutex_lock(&mw->src->lock);
+	mw->area_x1 = mw->dmg_x1 = t->cache_x;
+	mw->area_y1 = mw->dmg_y1 = t->cache_y;
+	mw->area_x2 = mw->dmg_x2 = t->cache_x + t->cache_w;
+	mw->area_y2 = mw->dmg_y2 = t->cache_y + t->cache_h;
+	pthread_mutex_unlock(&mw->src->lock);
+	mirror_wake(mw->src);
+}
+
+/* the last view of a mirror target is gone */
+void
+mirror_detach(target_ctx_t *t)
+{
+	mirror_win_t *mw = t->mirror;
+
+	pthread_mutex_lock(&mw->src->lock);
+	mw->closed = 1;
+	mw->t = NULL;
+	/* a busy one is detached when its put completes */
+	for (int k = 0; k < MIRROR_BUFS; k++) {
+		mirror_buf_t *b = &mw->buf[k];
+		if (b->old_seg)
+			xcb_shm_detach(c, b->old_seg);
+		b->old_seg = 0;
+		if (b->seg && b->state != MBUF_BUSY) {
+			xcb_shm_detach(c, b->seg);
+			b->seg = 0;
+		}
+	}
+	pthread_mutex_unlock(&mw->src->lock);
+	mirror_wake(mw->src);
+}
+
+/*
+ * a filled buffer into the cache, 1 if it is free again right away.
+ * With a segment our display attached, the put reads it there and a
+ * ShmCompletion event hands the buffer back.
+ */
+int
+mirror_put(mirror_win_t *mw, mirror_buf_t *b)
+{
+	target_ctx_t *t = mw->t;
+	int dx, dy;
+
+	if (b->old_seg) {
+		xcb_shm_detach(c, b->old_seg);
+		b->old_seg = 0;
+	}
+	if (!t || !t->cache)
+		return 1;
+	/* an error comes to mirror_put_error, for the put too */
+	if (shm_present && b->shmid >= 0 && !b->seg && !b->no_seg) {
+		b->seg = xcb_generate_id(c);
+		b->attach_seq = xcb_shm_attach(c, b->seg, b->shmid,
+			1).sequence;
+	}
+	/* only the reader needs it, else the first completion removes it */
+	if (b->shmid >= 0 && !b->removed && b->no_seg) {
+		shmctl(b->shmid, IPC_RMID, NULL);
+		b->removed = 1;
+	}
+
+	dx = b->x - t->cache_x;
+	dy = b->y - t->cache_y;
+	if (b->seg)
+		b->put_seq = xcb_shm_put_image(c, t->cache, t->gc, b->w,
+			b->h, 0, 0, b->w, b->h, dx, dy, t->depth,
+			XCB_IMAGE_FORMAT_Z_PIXMAP, 1, b->seg, 0).sequence;
+	else
+		put_image_rows(t->cache, t->gc, dx, dy, b->w, b->h,
+			t->depth, b->w * 4, b->addr);
+	account_copy((long)b->w * b->h);
+	n_mirror_puts++;
+	n_mirror_px += (unsigned long)b->w * b->h;
+	t->n_damage++;
+	damage_views(t, b->x, b->y, b->w, b->h);
+	return !b->seg;
+}
+
+/*
+ * put what the readers fetched, once per pass before the views are
+ * copied
+ */
+void
+check_mirrors(void)
+{
+	mirror_buf_t *ready[MIRROR_BUFS];
+	char drain[64];
+
+	if (mirror_fd[0] < 0)
+		return;
+	while (read(mirror_fd[0], drain, sizeof(drain)) > 0)
+		;
+	for (mirror_src_t *s = mirror_srcs; s; s = s->next) {
+		pthread_mutex_lock(&s->lock);
+		int err = s->wake_errno;
+		pthread_mutex_unlock(&s->lock);
+		if (err)
+			fail("mirror: the reader of %s can't wake the main "
+				"loop: %s", s->display, strerror(err));
+		for (mirror_win_t *mw = s->wins; mw; mw = mw->next) {
+			int n = 0, freed = 0;
+			pthread_mutex_lock(&s->lock);
+			for (int k = 0; k < MIRROR_BUFS; k++)
+				if (mw->buf[k].state == MBUF_READY)
+					ready[n++] = &mw->buf[k];
+			pthread_mutex_unlock(&s->lock);
+			/* ready buffers are ours until handed back */
+			for (int k = 0; k < n; k++) {
+				int done = mirror_put(mw, ready[k]);
+				pthread_mutex_lock(&s->lock);
+				ready[k]->state = done ? MBUF_FREE : MBUF_BUSY;
+				pthread_mutex_unlock(&s->lock);
+				freed |= done;
+			}
+			if (freed)
+				mirror_wake(s);
+		}
+	}
+}
+
+/*
+ * ShmCompletion of a mirror put: the buffer can be refilled
+ */
+void
+mirror_completion(xcb_generic_event_t *e)
+{
+	xcb_shm_completion_event_t *ce = (void *)e;
+
+	for (mirror_src_t *s = mirror_srcs; s; s = s->next) {
+		pthread_mutex_lock(&s->lock);
+		for (mirror_win_t *mw = s->wins; mw; mw = mw->next)
+			for (int k = 0; k < MIRROR_BUFS; k++) {
+				mirror_buf_t *b = &mw->buf[k];
+				if (b->state == MBUF_BUSY &&
+				    b->seg == ce->shmseg) {
+					b->state = MBUF_FREE;
+					/* both servers have it now */
+					if (b->shmid >= 0 && !b->removed) {
+						shmctl(b->shmid, IPC_RMID,
+							NULL);
+						b->removed = 1;
+					}
+					if (mw->closed) {
+						xcb_shm_detach(c, b->seg);
+						b->seg = 0;
+					}
+					pthread_mutex_unlock(&s->lock);
+					mirror_wake(s);
+					return;
+				}
+			}
+		pthread_mutex_unlock(&s->lock);
+	}
+}
+
+/*
+ * an error to a mirror put never completes: the buffer goes back to
+ * the reader, which fetches the area again for a plain PutImage. A
+ * failed attach only marks the segment, the put after it fails too.
+ * 1 if err was one.
+ */
+int
+mirror_put_error(xcb_generic_error_t *err)
+{
+	for (mirror_src_t *s = mirror_srcs; s; s = s->next) {
+		pthread_mutex_lock(&s->lock);
+		for (mirror_win_t *mw = s->wins; mw; mw = mw->next)
+			for (int k = 0; k < MIRROR_BUFS; k++) {
+				mirror_buf_t *b = &mw->buf[k];
+				if (b->state == MBUF_BUSY && b->seg &&
+				    b->attach_seq == err->full_sequence) {
+					deb("mirror: can't attach the segment "
+						"of '%s'\n", mw->name);
+					b->seg = 0;
+					b->no_seg = 1;
+					pthread_mutex_unlock(&s->lock);
+					return 1;
+				}
+				if (b->state != MBUF_BUSY ||
+				    b->put_seq != err->full_sequence)
+					continue;
+				fprintf(stderr, "warning: MIT-SHM PutImage of "
+					"'%s' failed (error %d), using "
+					"PutImage\n", mw->name,
+					err->error_code);
+				int x = b->x, y = b->y, w = b->w, h = b->h;
+				if (b->seg)
+					xcb_shm_detach(c, b->seg);
+				b->seg = 0;
+				b->no_seg = 1;
+				b->state = MBUF_FREE;
+				pthread_mutex_unlock(&s->lock);
+				mirror_damage(mw, x, y, w, h);
+				mirror_wake(s);
+				return 1;
+			}
+		pthread_mutex_unlock(&s->lock);
+	}
+	return 0;
+}
+
+/* segments the readers made but never handed over */
+void
+mirror_cleanup(void)
+{
+	for (mirror_src_t *s = mirror_srcs; s; s = s->next)
+		for (mirror_win_t *mw = s->wins; mw; mw = mw->next)
+			for (int k = 0; k < MIRROR_BUFS; k++)
+				if (mw->buf[k].shmid >= 0 &&
+				    !mw->buf[k].removed)
+					shmctl(mw->buf[k].shmid, IPC_RMID,
+						NULL);
+}
+
+/*
+ * view of a mirror, cascaded from the top left. The target has no
+ * window on our display, only the cache the main loop puts into.
+ */
+void
+create_mirror_view(mirror_win_t *mw, int cap_x, int cap_y, int cap_w,
+	int cap_h, int i)
+{
+	uint32_t black = 0xff000000;
+	int view_x = 32 * (i + 1), view_y = 32 * (i + 1);
+
+	xcb_window_t new_window = create_view_window(screen->root_depth,
+		screen->root_visual, screen->default_colormap,
+		view_x, view_y, cap_w + 2 * border_width,
+		cap_h + 2 * border_width, black);
+
+	view_ctx_t *v = pool_get(&view_pool);
+	v->window = new_window;
+	v->gc = copy_gc_get(screen->root_depth, new_window);
+	v->cap_x = cap_x;
+	v->cap_y = cap_y;
+	v->cap_width = cap_w;
+	v->cap_height = cap_h;
+	v->view_x = view_x;
+	v->view_y = view_y;
+	v->depth = screen->root_depth;
+	v->refresh_fps = cfg.refresh_fps;
+	add_window(new_window, WIN_TYPE_VIEW, v);
+
+	target_ctx_t *t = pool_get(&target_pool);
+	t->name = str_intern(mw->name);
+	t->level = initial_damage_level();
+	now_tv(&t->level_since);
+	t->rate_since = t->level_since;
+	t->depth = screen->root_depth;
+	t->gc = copy_gc_get(t->depth, screen->root);
+	t->mirror = mw;
+	mw->t = t;
+	attach_view(t, v);
+}
+
+/*
+ * -m 'DISPLAY WxH+X+Y NAME': the views, then one reader per display
+ */
+void
+initialize_mirrors(void)
+{
+	pthread_t th;
+
+	if (!n_mirror_specs)
+		return;
+	if (recording || replaying) {
+		fprintf(stderr, "warning: -m is ignored when recording "
+			"or replaying\n");
+		return;
+	}
+	if (screen->root_depth != 24 && screen->root_depth != 32) {
+		fprintf(stderr, "warning: -m needs a screen of depth 24 "
+			"or 32, not %d\n", screen->root_depth);
+		return;
+	}
+	if (pipe(mirror_fd) < 0)
+		fail("mirrors: %s", strerror(errno));
+	for (int k = 0; k < 2; k++) {
+		fcntl(mirror_fd[k], F_SETFL, O_NONBLOCK);
+		fcntl(mirror_fd[k], F_SETFD, FD_CLOEXEC);
+	}
+
+	for (int i = 0; i < n_mirror_specs; i++) {
+		const char *spec = mirror_specs[i];
+		char display[256];
+		int x, y, w, h, n = 0;
+		mirror_src_t *s;
+
+		if (sscanf(spec, "%255s %dx%d+%d+%d %n", display, &w, &h,
+			    &x, &y, &n) != 5 || !n || !spec[n] ||
+		    w < 1 || h < 1)
+			fail("-m '%s': expected 'DISPLAY WxH+X+Y NAME'",
+				spec);
+		for (s = mirror_srcs; s; s = s->next)
+			if (!strcmp(s->display, display))
+				break;
+		if (!s) {
+			s = calloc(1, sizeof(*s));
+			if (!s || !(s->display = strdup(display)) ||
+			    pipe(s->wake) < 0)
+				fail("mirrors: out of resources");
+			for (int k = 0; k < 2; k++) {
+				fcntl(s->wake[k], F_SETFL, O_NONBLOCK);
+				fcntl(s->wake[k], F_SETFD, FD_CLOEXEC);
+			}
+			s->msb_first = xcb_get_setup(c)->image_byte_order ==
+				XCB_IMAGE_ORDER_MSB_FIRST;
+			pthread_mutex_init(&s->lock, NULL);
+			s->next = mirror_srcs;
+			mirror_srcs = s;
+		}
+
+		mirror_win_t *mw = calloc(1, sizeof(*mw));
+		if (!mw || !(mw->name = strdup(spec + n)))
+			fail("mirrors: out of memory");
+		mw->src = s;
+		for (int k = 0; k < MIRROR_BUFS; k++)
+			mw->buf[k].shmid = -1;
+		mw->next = s->wins;
+		s->wins = mw;
+		create_mirror_view(mw, x, y, w, h, i);
+	}
+
+	atexit(mirror_cleanup);
+	for (mirror_src_t *s = mirror_srcs; s; s = s->next) {
+		if (pthread_create(&th, NULL, mirror_reader, s) != 0)
+			fail("mirrors: can't start the reader of %s",
+				s->display);
+		pthread_detach(th);
+	}
+}
+
+void
+save_state(void)
+{
+	char tmp_path[520];
+	struct timeval start;
+	FILE *f;
+
+	save_pending = 0;
+	if (state_path[0] == '\0')
+		return;
+	now_tv(&start);
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", state_path);
+	f = fopen(tmp_path, "w");
+	if (!f)
+		return;
+
+	fprintf(f, "# sniptotop state %d: target_name cap_x cap_y "
+		"cap_width cap_height view_x view_y notify refresh fps "
+		"group\n", STATE_VERSION);
+
+	/*
+	 * connected and disconnected views, the sub-captures of a
+	 * composite in their order and with its number
+	 */
+	int ngroups = 0;
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW || is_member(i))
+			continue;
+		view_ctx_t *g = windows[i].ctx;
+		int group = g->next_member ? ++ngroups : 0;
+		for (view_ctx_t *v = g; v; v = v->next_member) {
+			/* mirrors come from the command line */
+			if (v->t->mirror)
+				continue;
+			fprintf(f, "%s %d %d %d %d %d %d %d %d %d %d\n",
+				v->t->name,
+				v->cap_x, v->cap_y,
+				v->cap_width, v->cap_height,
+				g->view_x, g->view_y,
+				v->notify, v->refresh, v->refresh_fps,
+				group);
+		}
+	}
+
+	fclose(f);
+	rename(tmp_path, state_path);
+	thumbs_stale = 1;
+
+	last_save_ms = ms_since(&start);
+	if (last_save_ms > max_save_ms)
+		max_save_ms = last_save_ms;
+}
+
+/*
+ * get the window title: try _NET_WM_NAME first, fall back to WM_NAME.
+ * returns a malloc'd string or NULL.
+ */
+char *
+get_window_title(xcb_window_t win)
+{
+	xcb_generic_error_t *err;
+	xcb_get_property_cookie_t pr_c;
+	xcb_get_property_reply_t *pr_r;
+	xcb_atom_t atom_net_wm_name = get_atom(c, "_NET_WM_NAME");
+	xcb_atom_t atom_utf8 = get_atom(c, "UTF8_STRING");
+
+	pr_c = xcb_get_property(c, 0, win, atom_net_wm_name,
+		atom_utf8, 0, 256);
+	pr_r = REPLY(xcb_get_property_reply, pr_c, &err);
+	if (pr_r && xcb_get_property_value_length(pr_r) > 0) {
+		int len = xcb_get_property_value_length(pr_r);
+		char *name = malloc(len + 1);
+		memcpy(name, xcb_get_property_value(pr_r), len);
+		name[len] = '\0';
+		free(pr_r);
+		return name;
+	}
+	free(pr_r);
+
+	pr_c = xcb_get_property(c, 0, win, XCB_ATOM_WM_NAME,
+		XCB_ATOM_ANY, 0, 256);
+	pr_r = REPLY(xcb_get_property_reply, pr_c, &err);
+	if (pr_r && xcb_get_property_value_length(pr_r) > 0) {
+		int len = xcb_get_property_value_length(pr_r);
+		char *name = malloc(len + 1);
+		memcpy(name, xcb_get_property_value(pr_r), len);
+		name[len] = '\0';
+		free(pr_r);
+		return name;
+	}
+	free(pr_r);
+	return NULL;
+}
+
+/*
+ * titles of the top level windows, scanned once per restore instead
+ * of once per state line
+ */
+typedef struct {
+	int n;
+	struct {
+		const char *name;	/* interned */
+		xcb_window_t wm_win;
+		xcb_window_t client;
+	} *e;
+} title_map_t;
+
+void
+scan_titles(title_map_t *m)
+{
+	xcb_generic_error_t *err;
+	xcb_query_tree_cookie_t tree_cookie;
+	xcb_query_tree_reply_t *tree_reply;
+
+	m->n = 0;
+	m->e = NULL;
+	tree_cookie = xcb_query_tree(c, screen->root);
+	tree_reply = REPLY(xcb_query_tree_reply, tree_cookie, &err);
+	if (!tree_reply)
+		return;
 
 	int n = xcb_query_tree_children_length(tree_reply);
 	xcb_window_t *children = xcb_query_tree_children(tree_reply);
 
+	m->e = calloc(n ? n : 1, sizeof(m->e[0]));
+	if (!m->e)
+		fail("out of memory for %d titles", n);
 	for (int i = 0; i < n; i++) {
 		xcb_window_t client = find_wm_window(children[i]);
 		if (client == XCB_WINDOW_NONE)
@@ -790,17 +4741,44 @@ find_window_by_name(const char *name, xcb_window_t *wm_win,
 		if (!cls)
 			continue;
 
-		if (strcmp(cls, name) == 0) {
-			*wm_win = children[i];
-			*client_win = client;
-			free(cls);
-			free(tree_reply);
-			return 1;
-		}
+		m->e[m->n].name = str_intern(cls);
+		m->e[m->n].wm_win = children[i];
+		m->e[m->n].client = client;
+		m->n++;
 		free(cls);
 	}
 
 	free(tree_reply);
+}
+
+void
+free_titles(title_map_t *m)
+{
+	for (int i = 0; i < m->n; i++)
+		str_unref(m->e[i].name);
+	free(m->e);
+	m->n = 0;
+	m->e = NULL;
+}
+
+/*
+ * the bottom-most top level window with that title
+ */
+int
+find_window_by_name(title_map_t *m, const char *name, xcb_window_t *wm_win,
+	xcb_window_t *client_win)
+{
+	const char *iname = str_find(name);
+
+	if (!iname)
+		return 0;
+	for (int i = 0; i < m->n; i++) {
+		if (m->e[i].name == iname) {
+			*wm_win = m->e[i].wm_win;
+			*client_win = m->e[i].client;
+			return 1;
+		}
+	}
 	return 0;
 }
 
@@ -808,31 +4786,19 @@ void
 create_disconnected_view(const char *name, int cap_x, int cap_y,
 	int cap_w, int cap_h, int view_x, int view_y)
 {
-	uint32_t values[20];
-	uint32_t black = 0xff000000;
 	uint32_t grey = 0xff808080;
 
-	int n_border_width = 2;
-	int width = cap_w + 2 * n_border_width;
-	int height = cap_h + 2 * n_border_width;
+	int width = cap_w + 2 * border_width;
+	int height = cap_h + 2 * border_width;
 
-	xcb_colormap_t cmap = xcb_generate_id(c);
-	xcb_create_colormap(c, XCB_COLORMAP_ALLOC_NONE, cmap,
-		screen->root, screen->root_visual);
 	xcb_window_t new_window = create_view_window(screen->root_depth,
-		screen->root_visual, cmap,
+		screen->root_visual, screen->default_colormap,
 		view_x, view_y, width, height, grey);
 
-	/* create GC on the view window itself (no target available) */
-	xcb_gcontext_t gc = xcb_generate_id(c);
-	values[0] = grey;
-	values[1] = black;
-	values[2] = 0; /* graphics_exposures: disable to avoid feedback loop */
-	xcb_create_gc(c, gc, new_window,
-		XCB_GC_FOREGROUND | XCB_GC_BACKGROUND | XCB_GC_GRAPHICS_EXPOSURES,
-		values);
+	/* no target available, the view window has the same depth */
+	xcb_gcontext_t gc = copy_gc_get(screen->root_depth, new_window);
 
-	view_ctx_t *v = calloc(sizeof(view_ctx_t), 1);
+	view_ctx_t *v = pool_get(&view_pool);
 	v->window = new_window;
 	v->gc = gc;
 	v->cap_x = cap_x;
@@ -841,17 +4807,70 @@ create_disconnected_view(const char *name, int cap_x, int cap_y,
 	v->cap_height = cap_h;
 	v->view_x = view_x;
 	v->view_y = view_y;
+	v->depth = screen->root_depth;
+	v->refresh_fps = 1;
 	add_window(new_window, WIN_TYPE_VIEW, v);
 
-	target_ctx_t *t = calloc(sizeof(target_ctx_t), 1);
-	t->name = strdup(name);
+	target_ctx_t *t = pool_get(&target_pool);
+	t->name = str_intern(name);
+	t->level = initial_damage_level();
 	t->disconnected = 1;
-	t->first_view = v;
-	v->t = t;
+	attach_view(t, v);
+	add_disconnected(t);
+}
 
-	if (n_disconnected >= MAX_DISCONNECTED)
-		fail("too many disconnected targets");
-	disconnected_targets[n_disconnected++] = t;
+/*
+ * upload ZPixmap data, split in bands that fit into a request
+ */
+void
+put_image_rows(xcb_drawable_t d, xcb_gcontext_t gc, int x, int y,
+	int w, int h, int depth, int stride, const uint8_t *data)
+{
+	uint32_t max = xcb_get_maximum_request_length(c) * 4 - 64;
+	int rows = max / stride;
+
+	if (rows < 1)
+		rows = 1;
+	for (int r = 0; r < h; r += rows) {
+		int n = h - r < rows ? h - r : rows;
+		xcb_put_image(c, XCB_IMAGE_FORMAT_Z_PIXMAP, d, gc, w, n,
+			x, y + r, 0, depth, n * stride,
+			data + (size_t)r * stride);
+	}
+}
+
+/*
+ * seed the frame cache of a view whose target isn't there yet with
+ * its persisted last frame; the expose after mapping shows it
+ */
+void
+load_thumbnail(view_ctx_t *v, thumb_file_t *tf)
+{
+	target_ctx_t *t = v->t;
+	const thumb_entry_t *e;
+
+	e = thumbs_find(tf, t->name, v->cap_x, v->cap_y,
+		v->cap_width, v->cap_height);
+	if (!e || e->depth != v->depth)
+		return;
+
+	if (!t->gc) {
+		t->depth = v->depth;
+		t->gc = copy_gc_get(t->depth, v->window);
+	}
+	if (t->depth != v->depth)
+		return;
+	update_target_cache(t);
+
+	deb("restore: thumbnail for '%s' %dx%d\n", t->name,
+		e->cap_w, e->cap_h);
+	put_image_rows(t->cache, t->gc,
+		v->cap_x - t->cache_x, v->cap_y - t->cache_y,
+		e->cap_w, e->cap_h, e->depth, e->stride, thumbs_data(tf, e));
+
+	v->thumb = thumb_buf_new(e->depth, e->cap_w, e->cap_h, e->stride,
+		thumbs_data(tf, e));
+	v->thumb_seq = v->frame_seq;
 }
 
 void
@@ -859,88 +4878,71 @@ restore_state(void)
 {
 	FILE *f;
 	char line[1024];
+	thumb_file_t tf;
+	title_map_t titles;
+	view_ctx_t *group_head = NULL;
+	int group = 0;
+	int nfields = 0;	/* numbers per line, 0: no header yet */
 
-	if (no_restore || state_path[0] == '\0')
+	if (state_path[0] == '\0')
+		return;
+	recorded_file("state", no_restore ? NULL : state_path);
+	if (no_restore)
 		return;
 
 	f = fopen(state_path, "r");
 	if (!f)
 		return;
+	thumbs_open(&tf, thumbs_path);
+	scan_titles(&titles);
 
 	while (fgets(line, sizeof(line), f)) {
 		/* strip newline */
 		int len = strlen(line);
 		if (len > 0 && line[len - 1] == '\n')
 			line[--len] = '\0';
-		if (len == 0 || line[0] == '#')
+		if (line[0] == '#') {
+			int n = parse_state_header(line);
+			if (n)
+				nfields = n;
 			continue;
-
-		/* parse from the end: last 7 fields are ints,
-		 * everything before is the name.
-		 * (backward compat: 6 fields also accepted) */
-		int vals[7] = {0};
-		int nvals = 7;
-		char *p = line + len;
-		int got = 0;
-		for (got = nvals - 1; got >= 0; got--) {
-			/* skip trailing spaces */
-			while (p > line && *(p - 1) == ' ')
-				p--;
-			/* find start of number */
-			while (p > line && *(p - 1) != ' ')
-				p--;
-			vals[got] = atoi(p);
-			p--; /* skip the space */
-			if (p < line)
-				break;
-		}
-		if (got > 0) {
-			/* try 6-field format (no notify) */
-			nvals = 6;
-			p = line + len;
-			for (got = nvals - 1; got >= 0; got--) {
-				while (p > line && *(p - 1) == ' ')
-					p--;
-				while (p > line && *(p - 1) != ' ')
-					p--;
-				vals[got] = atoi(p);
-				p--;
-				if (p < line)
-					break;
-			}
-			vals[6] = 0;
-			if (got > 0) {
-				deb("restore_state: failed to parse line: %s\n",
-					line);
-				continue;
-			}
 		}
+		if (len == 0)
+			continue;
 
-		/* name is everything before the space before first int */
-		/* p currently points one before the space separator */
-		int name_len = p - line;
-		if (name_len <= 0) {
+		/* parse from the end: the trailing fields are ints,
+		 * everything before is the name. The header says how
+		 * many there are. */
+		int vals[STATE_NVALS];
+		int name_len = parse_state_line(line, len, nfields, vals);
+		if (name_len < 0) {
+			deb("restore_state: failed to parse line: %s\n",
+				line);
+			continue;
+		}
+		if (name_len == 0) {
 			deb("restore_state: no name in line\n");
 			continue;
 		}
 		char name[512];
+		view_ctx_t *v = NULL;
 		if (name_len >= (int)sizeof(name))
 			name_len = sizeof(name) - 1;
 		memcpy(name, line, name_len);
 		name[name_len] = '\0';
 
 		deb("restore: name='%s' cap=%d,%d %dx%d view=%d,%d "
-			"notify=%d\n",
+			"notify=%d refresh=%d fps=%d group=%d\n",
 			name, vals[0], vals[1], vals[2], vals[3],
-			vals[4], vals[5], vals[6]);
+			vals[4], vals[5], vals[6], vals[7], vals[8], vals[9]);
 
 		xcb_window_t wm_win, client_win;
-		if (find_window_by_name(name, &wm_win, &client_win)) {
+		if (find_window_by_name(&titles, name, &wm_win, &client_win)) {
 			if (wm_win == top_window || client_win == top_window) {
 				deb("restore: skipping own window\n");
 				continue;
 			}
-			char *n = strdup(name);
+			const char *n = str_intern(name);
 			/* create_view expects absolute coords,
 			 * but we saved cap-relative coords.
 			 * We need to reconstruct x1,y1,x2,y2 as
@@ -952,9 +4954,9 @@ restore_state(void)
 			xcb_get_geometry_cookie_t gc =
 				xcb_get_geometry(c, wm_win);
 			xcb_get_geometry_reply_t *geom =
-				xcb_get_geometry_reply(c, gc, &err);
+				REPLY(xcb_get_geometry_reply, gc, &err);
 			if (!geom) {
-				free(n);
+				str_unref(n);
 				continue;
 			}
 			int abs_x1 = vals[0] + geom->x;
@@ -964,6 +4966,7 @@ restore_state(void)
 			free(geom);
 			create_view(wm_win, client_win, n,
 				abs_x1, abs_y1, abs_x2, abs_y2);
+			str_unref(n);
 			/* reposition to saved location */
 			uint32_t pos[2];
 			pos[0] = vals[4];
@@ -973,7 +4976,7 @@ restore_state(void)
 			int t_ix = find_window(wm_win);
 			if (t_ix >= 0) {
 				target_ctx_t *t = windows[t_ix].ctx;
-				view_ctx_t *v = t->first_view;
+				v = t->first_view;
 				v->view_x = pos[0];
 				v->view_y = pos[1];
 				xcb_configure_window(c, v->window,
@@ -983,34 +4986,47 @@ restore_state(void)
 					v->notify = 1;
 					set_border_color(v, 0xff00ff00);
 				}
+				set_refresh_policy(v, vals[7], vals[8]);
 			}
 		} else {
 			create_disconnected_view(name,
 				vals[0], vals[1], vals[2], vals[3],
 				vals[4], vals[5]);
+			/* last added window is the view */
+			v = windows[nwindows - 1].ctx;
 			if (vals[6]) {
-				/* last added window is the view */
-				view_ctx_t *v = windows[nwindows - 1].ctx;
 				v->notify = 1;
 				set_border_color(v, 0xff00ff00);
 			}
+			set_refresh_policy(v, vals[7], vals[8]);
+			load_thumbnail(v, &tf);
+		}
+
+		/* the sub-captures of a composite are consecutive lines */
+		if (v && vals[9] && vals[9] == group) {
+			merge_views(group_head, v);
+		} else if (v) {
+			group = vals[9];
+			group_head = v;
 		}
 	}
 
 	fclose(f);
+	thumbs_close(&tf);
+	free_titles(&titles);
 }
 
 void
 hide_tooltip(void)
 {
-	if (tooltip_window != XCB_WINDOW_NONE) {
-		xcb_destroy_window(c, tooltip_window);
-		tooltip_window = XCB_WINDOW_NONE;
+	if (tooltip_shown) {
+		xcb_unmap_window(c, tooltip_window);
+		tooltip_shown = 0;
 	}
 }
 
 void
-show_tooltip(int root_x, int root_y)
+create_tooltip(void)
 {
 	uint32_t mask, values[5];
 	int char_w = 7, line_h = 13, pad = 4;
@@ -1019,7 +5035,7 @@ show_tooltip(int root_x, int root_y)
 	/* allocate light yellow (#FFFFE0) */
 	xcb_alloc_color_cookie_t ac = xcb_alloc_color(c,
 		screen->default_colormap, 0xffff, 0xffff, 0xe0e0);
-	xcb_alloc_color_reply_t *ar = xcb_alloc_color_reply(c, ac, NULL);
+	xcb_alloc_color_reply_t *ar = REPLY(xcb_alloc_color_reply, ac, NULL);
 	uint32_t bg_pixel = ar ? ar->pixel : screen->white_pixel;
 	free(ar);
 
@@ -1029,18 +5045,8 @@ show_tooltip(int root_x, int root_y)
 			max_len = len;
 	}
 
-	int win_w = max_len * char_w + 2 * pad + 2;
-	int win_h = TOOLTIP_NLINES * line_h + 2 * pad + 2;
-	int x = root_x + 15;
-	int y = root_y + 15;
-
-	/* clamp to screen edges */
-	if (x + win_w > screen->width_in_pixels)
-		x = screen->width_in_pixels - win_w;
-	if (y + win_h > screen->height_in_pixels)
-		y = root_y - win_h - 5;
-	if (x < 0) x = 0;
-	if (y < 0) y = 0;
+	tooltip_w = max_len * char_w + 2 * pad + 2;
+	tooltip_h = TOOLTIP_NLINES * line_h + 2 * pad + 2;
 
 	tooltip_window = xcb_generate_id(c);
 	mask = XCB_CW_BACK_PIXEL |
@@ -1049,7 +5055,7 @@ show_tooltip(int root_x, int root_y)
 	values[1] = 1;
 	values[2] = 0; /* no events on tooltip */
 	xcb_create_window(c, XCB_COPY_FROM_PARENT, tooltip_window,
-		screen->root, x, y, win_w, win_h,
+		screen->root, 0, 0, tooltip_w, tooltip_h,
 		0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
 		XCB_COPY_FROM_PARENT, mask, values);
 
@@ -1058,8 +5064,37 @@ show_tooltip(int root_x, int root_y)
 	values[1] = bg_pixel;
 	xcb_create_gc(c, tooltip_gc, tooltip_window,
 		XCB_GC_FOREGROUND | XCB_GC_BACKGROUND, values);
+}
+
+void
+show_tooltip(int root_x, int root_y)
+{
+	uint32_t values[2];
+	int line_h = 13, pad = 4;
+	int win_w, win_h;
+
+	if (tooltip_window == XCB_WINDOW_NONE)
+		create_tooltip();
+	win_w = tooltip_w;
+	win_h = tooltip_h;
+
+	int x = root_x + 15;
+	int y = root_y + 15;
+
+	/* clamp to screen edges */
+	if (x + win_w > screen->width_in_pixels)
+		x = screen->width_in_pixels - win_w;
+	if (y + win_h > screen->height_in_pixels)
+		y = root_y - win_h - 5;
+	if (x < 0) x = 0;
+	if (y < 0) y = 0;
 
+	values[0] = x;
+	values[1] = y;
+	xcb_configure_window(c, tooltip_window,
+		XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, values);
 	xcb_map_window(c, tooltip_window);
+	tooltip_shown = 1;
 
 	/* draw border manually */
 	xcb_rectangle_t border = { 0, 0, win_w - 1, win_h - 1 };
@@ -1132,9 +5167,10 @@ handle_top_event(xcb_generic_event_t *e, void *ctx)
 			 screen->root,
 			 cursor,
 			 XCB_TIME_CURRENT_TIME);
-		gr_r = xcb_grab_pointer_reply (c, gr_c, &err);
-		if (gr_r->status != XCB_GRAB_STATUS_SUCCESS)
+		gr_r = REPLY(xcb_grab_pointer_reply, gr_c, &err);
+		if (!gr_r || gr_r->status != XCB_GRAB_STATUS_SUCCESS)
 			fail("grabbing mouse failed");
+		free(gr_r);
 		/*
 		 * events will be delivered for the root window,
 		 * so add it here as well
@@ -1174,9 +5210,11 @@ handle_top_event(xcb_generic_event_t *e, void *ctx)
 				t->state = TST_IDLE;
 				return;
 			}
-			t->sel_name = name;
+			str_unref(t->sel_name);
+			t->sel_name = str_intern(name);
+			free(name);
 			deb("Selected window 0x%x title '%s'\n",
-				t->sel_target, name);
+				t->sel_target, t->sel_name);
 
 			/*
 			 * regrab the pointer, now confining it to the
@@ -1193,15 +5231,20 @@ handle_top_event(xcb_generic_event_t *e, void *ctx)
 				 t->sel_target,
 				 cursor,
 				 XCB_TIME_CURRENT_TIME);
-			gr_r = xcb_grab_pointer_reply (c, gr_c, &err);
-			if (gr_r->status != XCB_GRAB_STATUS_SUCCESS)
+			gr_r = REPLY(xcb_grab_pointer_reply, gr_c, &err);
+			if (!gr_r || gr_r->status != XCB_GRAB_STATUS_SUCCESS)
 				fail("grabbing mouse failed");
+			free(gr_r);
 			xcb_visualtype_t *argb_vis = find_argb_visual();
 			if (argb_vis) {
-				t->sel_cmap = xcb_generate_id(c);
-				xcb_create_colormap(c, XCB_COLORMAP_ALLOC_NONE,
-					t->sel_cmap, screen->root,
-					argb_vis->visual_id);
+				/* kept for the next selection */
+				if (!t->sel_cmap) {
+					t->sel_cmap = xcb_generate_id(c);
+					xcb_create_colormap(c,
+						XCB_COLORMAP_ALLOC_NONE,
+						t->sel_cmap, screen->root,
+						argb_vis->visual_id);
+				}
 				t->sel_overlay = xcb_generate_id(c);
 				uint32_t ov_mask =
 					XCB_CW_BACK_PIXEL |
@@ -1235,7 +5278,6 @@ handle_top_event(xcb_generic_event_t *e, void *ctx)
 			xcb_ungrab_pointer(c, XCB_TIME_CURRENT_TIME);
 			if (t->sel_overlay != XCB_WINDOW_NONE) {
 				xcb_destroy_window(c, t->sel_overlay);
-				xcb_free_colormap(c, t->sel_cmap);
 				t->sel_overlay = XCB_WINDOW_NONE;
 			}
 			t->state = TST_IDLE;
@@ -1252,8 +5294,17 @@ handle_top_event(xcb_generic_event_t *e, void *ctx)
 			ret = create_view(t->sel_target, t->sel_wm_target,
 				t->sel_name,
 				t->sel_x1, t->sel_y1, t->sel_x2, t->sel_y2);
+			str_unref(t->sel_name);
+			t->sel_name = NULL;
 			if (ret != 0)
 				fail("Failed to create view\n");
+			if (cfg.refresh != REFRESH_LIVE) {
+				/* the new view is first in its target's list */
+				target_ctx_t *nt =
+					windows[find_window(t->sel_target)].ctx;
+				set_refresh_policy(nt->first_view, cfg.refresh,
+					cfg.refresh_fps);
+			}
 			save_state();
 		}
 	} else if (t->state == TST_SELECT && rt == XCB_MOTION_NOTIFY) {
@@ -1284,10 +5335,12 @@ handle_top_event(xcb_generic_event_t *e, void *ctx)
 void
 resize_view(view_ctx_t *v)
 {
-	int width = v->cap_width + 2 * border_width;
-	int height = v->cap_height + 2 * border_width;
+	int width, height;
 	uint32_t values[2];
 
+	v = view_group(v);
+	view_window_size(v, &width, &height);
+
 	xcb_size_hints_t hints;
 	xcb_icccm_size_hints_set_min_size(&hints, width, height);
 	xcb_icccm_size_hints_set_max_size(&hints, width, height);
@@ -1302,47 +5355,615 @@ resize_view(view_ctx_t *v)
 }
 
 void
-set_border_color(view_ctx_t *v, uint32_t color)
+set_border_color(view_ctx_t *v, uint32_t color)
+{
+	int w, h;
+
+	xcb_change_window_attributes(c, v->window, XCB_CW_BACK_PIXEL,
+		&color);
+	view_window_size(view_group(v), &w, &h);
+	xcb_rectangle_t rects[4] = {
+		{ 0, 0, w, border_width },                         /* top */
+		{ 0, h - border_width, w, border_width },          /* bottom */
+		{ 0, border_width, border_width, h - 2 * border_width }, /* left */
+		{ w - border_width, border_width, border_width, h - 2 * border_width }, /* right */
+	};
+	xcb_clear_area(c, 0, v->window, rects[0].x, rects[0].y,
+		rects[0].width, rects[0].height);
+	xcb_clear_area(c, 0, v->window, rects[1].x, rects[1].y,
+		rects[1].width, rects[1].height);
+	xcb_clear_area(c, 0, v->window, rects[2].x, rects[2].y,
+		rects[2].width, rects[2].height);
+	xcb_clear_area(c, 0, v->window, rects[3].x, rects[3].y,
+		rects[3].width, rects[3].height);
+
+	/* a composite also shows it between and below the sub-captures */
+	for (view_ctx_t *m = view_group(v); m; m = m->next_member) {
+		int x = border_width + m->sub_x + m->cap_width;
+		int y = border_width + m->sub_y + m->cap_height;
+		int gap = m->next_member ?
+			m->next_member->sub_x - m->sub_x - m->cap_width : 0;
+		if (gap > 0)
+			xcb_clear_area(c, 0, v->window, x, border_width,
+				gap, h - 2 * border_width);
+		if (y < h - border_width)
+			xcb_clear_area(c, 0, v->window, x - m->cap_width, y,
+				m->cap_width, h - border_width - y);
+	}
+}
+
+/*
+ * repaint all sub-captures of group g
+ */
+void
+redraw_group(view_ctx_t *g)
+{
+	for (view_ctx_t *m = g; m; m = m->next_member)
+		redraw_view(m);
+}
+
+/*
+ * place the sub-captures of group g in a row, the border between
+ * them, and size the window to fit
+ */
+void
+layout_group(view_ctx_t *g)
+{
+	int x = 0;
+	int moved = 0;
+
+	for (view_ctx_t *m = g; m; m = m->next_member) {
+		if (m->sub_x != x || m->sub_y != 0)
+			moved = 1;
+		m->sub_x = x;
+		m->sub_y = 0;
+		x += m->cap_width + border_width;
+	}
+	resize_view(g);
+	/* the expose repaints everything at its new place */
+	if (moved || g->next_member)
+		xcb_clear_area(c, 1, g->window, 0, 0, 0, 0);
+}
+
+/*
+ * take v out of its composite, the next sub-capture takes the window
+ * over if it was v's. Returns what is left of the group, NULL if v
+ * was alone. v keeps the window id and its registry entry, the caller
+ * moves or drops them.
+ */
+view_ctx_t *
+leave_group(view_ctx_t *v)
+{
+	view_ctx_t *g = view_group(v);
+
+	if (!v->group && !v->next_member)
+		return NULL;
+
+	/* a resize drag on the composite ends where it is */
+	if (g->resizing) {
+		g->resizing = 0;
+		g->resize_m = NULL;
+		save_later();
+	}
+
+	if (v == g) {
+		g = v->next_member;
+		g->group = NULL;
+		g->view_x = v->view_x;
+		g->view_y = v->view_y;
+		for (view_ctx_t *m = g->next_member; m; m = m->next_member)
+			m->group = g;
+	} else {
+		view_ctx_t *p = g;
+		while (p->next_member != v)
+			p = p->next_member;
+		p->next_member = v->next_member;
+	}
+	v->group = NULL;
+	v->next_member = NULL;
+	v->sub_x = v->sub_y = 0;
+	return g;
+}
+
+/*
+ * move the sub-captures of src's composite behind the ones of dst's,
+ * into its window. Each keeps its own target and damage, so it is
+ * still only copied when its own capture area changes.
+ */
+void
+merge_views(view_ctx_t *dst, view_ctx_t *src)
+{
+	view_ctx_t *g = view_group(dst);
+	view_ctx_t *last;
+	xcb_window_t old;
+
+	src = view_group(src);
+	if (g == src)
+		return;
+	if (g->depth != src->depth) {
+		deb("can't merge depth %d into depth %d\n",
+			src->depth, g->depth);
+		return;
+	}
+	old = src->window;
+
+	for (last = g; last->next_member; last = last->next_member)
+		;
+	last->next_member = src;
+	for (view_ctx_t *m = src; m; m = m->next_member) {
+		rem_view_entry(m);
+		m->group = g;
+		m->window = g->window;
+		m->view_x = g->view_x;
+		m->view_y = g->view_y;
+		add_window(g->window, WIN_TYPE_VIEW, m);
+		set_view_visibility(m, g->obscured, g->unmapped);
+	}
+	xcb_destroy_window(c, old);
+	deb("merged window 0x%x into 0x%x\n", old, g->window);
+	layout_group(g);
+}
+
+/*
+ * give sub-capture v a window of its own again, below its composite
+ */
+void
+split_view(view_ctx_t *v)
+{
+	xcb_generic_error_t *err;
+	xcb_get_window_attributes_cookie_t attr_cookie;
+	xcb_get_window_attributes_reply_t *attrs;
+	int x = view_group(v)->view_x + v->sub_x;
+	int y = view_group(v)->view_y;
+	int w, h;
+	view_ctx_t *g = leave_group(v);
+
+	if (!g)
+		return;
+	view_window_size(g, &w, &h);
+	y += h;
+	rem_view_entry(v);
+
+	attr_cookie = xcb_get_window_attributes(c, g->window);
+	attrs = REPLY(xcb_get_window_attributes_reply, attr_cookie, &err);
+	if (!attrs)
+		fail("can't get attributes of view window 0x%x", g->window);
+	view_window_size(v, &w, &h);
+	v->window = create_view_window(v->depth, attrs->visual,
+		attrs->colormap, x, y, w, h,
+		v->notify ? 0xff00ff00 : 0xff000000);
+	free(attrs);
+	v->view_x = x;
+	v->view_y = y;
+	add_window(v->window, WIN_TYPE_VIEW, v);
+	deb("split view 0x%x off 0x%x\n", v->window, g->window);
+	layout_group(g);
+}
+
+void
+start_notify_flash(view_ctx_t *v)
+{
+	if (v->notify_flash)
+		return;
+	v->notify_flash = 1;
+	now_tv(&v->notify_flash_start);
+	notify_flashing_count++;
+}
+
+void
+update_notify_borders(void)
+{
+	struct timeval now;
+	now_tv(&now);
+
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		if (!v->notify_flash)
+			continue;
+		long elapsed_ms =
+			(now.tv_sec - v->notify_flash_start.tv_sec) * 1000 +
+			(now.tv_usec - v->notify_flash_start.tv_usec) / 1000;
+		long phase = elapsed_ms % cfg.flash_period_ms;
+		uint32_t color = (phase < cfg.flash_on_ms) ?
+			0xffff0000 : 0xff00ff00;
+		set_border_color(v, color);
+	}
+}
+
+/*
+ * give v's capture area new edges, the rest follows with the next
+ * frame in apply_resizes
+ */
+void
+set_capture(view_ctx_t *v, int x, int y, int w, int h)
+{
+	if (x == v->cap_x && y == v->cap_y &&
+	    w == v->cap_width && h == v->cap_height)
+		return;
+	if (w != v->cap_width || h != v->cap_height)
+		v->resize_size = 1;
+	v->cap_x = x;
+	v->cap_y = y;
+	v->cap_width = w;
+	v->cap_height = h;
+	cap_set_update(&v->t->caps, v->cap_ix, x, y, w, h);
+	if (!v->resize_pending) {
+		v->resize_pending = 1;
+		n_resize_pending++;
+	}
+}
+
+/*
+ * ms until the capture edits are due, -1 if there are none
+ */
+long
+resize_wait_ms(void)
+{
+	long left;
+
+	if (n_resize_pending == 0)
+		return -1;
+	left = SOFT_VBLANK_US / 1000 - ms_since(&last_resize);
+	return left > 0 ? left : 0;
+}
+
+/*
+ * the cache, window size and copy of the edited views, once a frame
+ * unless now
+ */
+void
+apply_resizes(int now)
+{
+	if (n_resize_pending == 0 || (!now && resize_wait_ms() > 0))
+		return;
+
+	for (int i = 0; i < nwindows && n_resize_pending; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW)
+			continue;
+		view_ctx_t *v = windows[i].ctx;
+		view_ctx_t *g = view_group(v);
+		if (!v->resize_pending)
+			continue;
+		v->resize_pending = 0;
+		n_resize_pending--;
+		update_target_cache(v->t);
+		if (g->move_pending) {
+			int values[2] = { g->move_x, g->move_y };
+			g->move_pending = 0;
+			g->view_x = g->move_x;
+			g->view_y = g->move_y;
+			xcb_configure_window(c, g->window,
+				XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y,
+				values);
+		}
+		if (v->resize_size) {
+			v->resize_size = 0;
+			layout_group(g);
+		}
+		refresh_view(v);
+	}
+	now_tv(&last_resize);
+	xcb_flush(c);
+}
+
+/*
+ * save the state once the key repeat stopped
+ */
+void
+save_later(void)
+{
+	save_pending = 1;
+	now_tv(&save_requested);
+}
+
+long
+save_wait_ms(void)
+{
+	long left;
+
+	if (!save_pending)
+		return -1;
+	left = KEY_SAVE_DELAY_MS - ms_since(&save_requested);
+	return left > 0 ? left : 0;
+}
+
+/*
+ * left click: the target window of sub-capture m goes on top
+ */
+void
+raise_target(view_ctx_t *m)
+{
+	if (m->t->disconnected || m->t->mirror)
+		return;
+	deb("raise window 0x%x\n", m->t->wm_target);
+	uint32_t values[1];
+	values[0] = XCB_STACK_MODE_ABOVE;
+	xcb_configure_window(c, m->t->wm_target,
+		XCB_CONFIG_WINDOW_STACK_MODE, values);
+}
+
+/*
+ * EDGE_* of g's window in reach of x, y in window coordinates
+ */
+int
+resize_edges(view_ctx_t *g, int x, int y)
+{
+	int reach = border_width + 3;
+	int w, h, edges = 0;
+
+	view_window_size(g, &w, &h);
+	if (x < reach)
+		edges |= EDGE_LEFT;
+	else if (x >= w - reach)
+		edges |= EDGE_RIGHT;
+	if (y < reach)
+		edges |= EDGE_TOP;
+	else if (y >= h - reach)
+		edges |= EDGE_BOTTOM;
+	return edges;
+}
+
+/*
+ * start dragging the edges of the sub-capture under x of g's window,
+ * with a pointer that shows which
+ */
+void
+start_resize(view_ctx_t *g, int edges, xcb_button_press_event_t *bp)
+{
+	view_ctx_t *m = g;
+	uint16_t glyph;
+
+	for (view_ctx_t *o = g; o; o = o->next_member)
+		if (bp->event_x - border_width >= o->sub_x)
+			m = o;
+	g->resizing = edges;
+	g->resize_m = m;
+	g->drag_root_x = bp->root_x;
+	g->drag_root_y = bp->root_y;
+	g->drag_cap[0] = m->cap_x;
+	g->drag_cap[1] = m->cap_y;
+	g->drag_cap[2] = m->cap_width;
+	g->drag_cap[3] = m->cap_height;
+	g->drag_view_x = g->view_x;
+	g->drag_view_y = g->view_y;
+	g->drag_moved = 0;
+
+	/* the capture stays on the target */
+	g->drag_max[0] = g->drag_max[1] = 0;
+	if (m->t->mirror) {
+		mirror_win_t *mw = m->t->mirror;
+		pthread_mutex_lock(&mw->src->lock);
+		g->drag_max[0] = mw->win_w;
+		g->drag_max[1] = mw->win_h;
+		pthread_mutex_unlock(&mw->src->lock);
+	} else {
+		xcb_generic_error_t *err;
+		xcb_get_geometry_cookie_t ck = xcb_get_geometry(c,
+			m->t->target);
+		xcb_get_geometry_reply_t *geom = REPLY(xcb_get_geometry_reply,
+			ck, &err);
+		if (geom) {
+			g->drag_max[0] = geom->width;
+			g->drag_max[1] = geom->height;
+			free(geom);
+		} else {
+			free(err);
+		}
+	}
+
+	switch (edges) {
+	case EDGE_LEFT: glyph = XC_left_side; break;
+	case EDGE_RIGHT: glyph = XC_right_side; break;
+	case EDGE_TOP: glyph = XC_top_side; break;
+	case EDGE_BOTTOM: glyph = XC_bottom_side; break;
+	case EDGE_LEFT | EDGE_TOP: glyph = XC_top_left_corner; break;
+	case EDGE_RIGHT | EDGE_TOP: glyph = XC_top_right_corner; break;
+	case EDGE_LEFT | EDGE_BOTTOM: glyph = XC_bottom_left_corner; break;
+	default: glyph = XC_bottom_right_corner; break;
+	}
+	xcb_change_active_pointer_grab(c, get_cursor(glyph), bp->time,
+		XCB_EVENT_MASK_BUTTON_RELEASE | XCB_EVENT_MASK_BUTTON_1_MOTION);
+	xcb_flush(c);
+}
+
+/*
+ * the dragged edges follow the pointer, the opposite ones stay. The
+ * window moves with a dragged left or top edge, so the content stays
+ * where it is on screen.
+ */
+void
+drag_resize(view_ctx_t *g, int root_x, int root_y)
+{
+	view_ctx_t *m = g->resize_m;
+	int dx = root_x - g->drag_root_x;
+	int dy = root_y - g->drag_root_y;
+	int x = g->drag_cap[0], y = g->drag_cap[1];
+	int w = g->drag_cap[2], h = g->drag_cap[3];
+	int mw = g->drag_max[0], mh = g->drag_max[1];
+
+	if (dx || dy)
+		g->drag_moved = 1;
+	if (g->resizing & EDGE_LEFT) {
+		if (dx > w - 1)
+			dx = w - 1;
+		if (mw && x + dx < 0 && x >= 0)
+			dx = -x;
+		x += dx;
+		w -= dx;
+	} else if (g->resizing & EDGE_RIGHT) {
+		if (mw && x + w + dx > mw && x + w <= mw)
+			dx = mw - x - w;
+		w = w + dx > 1 ? w + dx : 1;
+	}
+	if (g->resizing & EDGE_TOP) {
+		if (dy > h - 1)
+			dy = h - 1;
+		if (mh && y + dy < 0 && y >= 0)
+			dy = -y;
+		y += dy;
+		h -= dy;
+	} else if (g->resizing & EDGE_BOTTOM) {
+		if (mh && y + h + dy > mh && y + h <= mh)
+			dy = mh - y - h;
+		h = h + dy > 1 ? h + dy : 1;
+	}
+	set_capture(m, x, y, w, h);
+
+	/* in a composite, only the first sub-capture moves the window */
+	if (m == g && (g->resizing & (EDGE_LEFT | EDGE_TOP))) {
+		g->move_x = g->drag_view_x + x - g->drag_cap[0];
+		g->move_y = g->drag_view_y;
+		if (!g->next_member)
+			g->move_y += y - g->drag_cap[1];
+		g->move_pending = 1;
+	}
+}
+
+void
+end_resize(view_ctx_t *g)
+{
+	view_ctx_t *m = g->resize_m;
+
+	if (!g->drag_moved)
+		raise_target(m);
+	g->resizing = 0;
+	g->resize_m = NULL;
+	apply_resizes(1);
+	save_state();
+}
+
+/* scratch for the rectangles a moving view snaps to */
+snap_rect_t *snap_others;
+int snap_alloc;
+
+/*
+ * snap x, y of v's window to the screen edges and the other view
+ * windows, returns SNAP_X and SNAP_Y for the axes that snapped
+ */
+int
+snap_view(view_ctx_t *v, int *x, int *y)
+{
+	int n = 0;
+	int w, h;
+
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type != WIN_TYPE_VIEW || is_member(i))
+			continue;
+		view_ctx_t *o = windows[i].ctx;
+		if (o == v)
+			continue;
+		if (n == snap_alloc) {
+			snap_alloc = snap_alloc ? snap_alloc * 2 : 64;
+			snap_others = realloc(snap_others,
+				snap_alloc * sizeof(*snap_others));
+			if (!snap_others)
+				fail("out of memory for %d views", snap_alloc);
+		}
+		view_window_size(o, &w, &h);
+		snap_others[n].x = o->view_x;
+		snap_others[n].y = o->view_y;
+		snap_others[n].w = w;
+		snap_others[n].h = h;
+		n++;
+	}
+	view_window_size(v, &w, &h);
+	return snap_rect(x, y, w, h, screen->width_in_pixels,
+		screen->height_in_pixels, snap_others, n);
+}
+
+/*
+ * hand a right button drag to the window manager. It grabs the
+ * pointer, so the end shows as the grab going away (or a release
+ * if it ignored the request).
+ */
+void
+start_wm_move(view_ctx_t *v, int root_x, int root_y)
 {
-	xcb_change_window_attributes(c, v->window, XCB_CW_BACK_PIXEL,
-		&color);
-	int w = v->cap_width + 2 * border_width;
-	int h = v->cap_height + 2 * border_width;
-	xcb_rectangle_t rects[4] = {
-		{ 0, 0, w, border_width },                         /* top */
-		{ 0, h - border_width, w, border_width },          /* bottom */
-		{ 0, border_width, border_width, h - 2 * border_width }, /* left */
-		{ w - border_width, border_width, border_width, h - 2 * border_width }, /* right */
-	};
-	xcb_clear_area(c, 0, v->window, rects[0].x, rects[0].y,
-		rects[0].width, rects[0].height);
-	xcb_clear_area(c, 0, v->window, rects[1].x, rects[1].y,
-		rects[1].width, rects[1].height);
-	xcb_clear_area(c, 0, v->window, rects[2].x, rects[2].y,
-		rects[2].width, rects[2].height);
-	xcb_clear_area(c, 0, v->window, rects[3].x, rects[3].y,
-		rects[3].width, rects[3].height);
+	xcb_client_message_event_t ev = { 0 };
+
+	/* the WM can only grab once the implicit grab is gone */
+	xcb_ungrab_pointer(c, XCB_CURRENT_TIME);
+	ev.response_type = XCB_CLIENT_MESSAGE;
+	ev.format = 32;
+	ev.window = v->window;
+	ev.type = atom_moveresize;
+	ev.data.data32[0] = root_x;
+	ev.data.data32[1] = root_y;
+	ev.data.data32[2] = 8;	/* _NET_WM_MOVERESIZE_MOVE */
+	ev.data.data32[3] = XCB_BUTTON_INDEX_3;
+	ev.data.data32[4] = 1;	/* source: application */
+	xcb_send_event(c, 0, screen->root,
+		XCB_EVENT_MASK_SUBSTRUCTURE_REDIRECT |
+		XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY, (const char *)&ev);
+	xcb_flush(c);
+	v->wm_moving = 1;
+	wm_move_view = v;
+	now_tv(&wm_move_check);
+	deb("view 0x%x moved by the window manager\n", v->window);
 }
 
+/*
+ * the window manager let go of v where the last synthetic
+ * ConfigureNotify put it, snap from there once
+ */
 void
-update_notify_borders(void)
+finish_wm_move(view_ctx_t *v, int shift)
 {
-	struct timeval now;
-	gettimeofday(&now, NULL);
+	int x = v->view_x, y = v->view_y;
 
-	for (int i = 0; i < nwindows; i++) {
-		if (windows[i].type != WIN_TYPE_VIEW)
-			continue;
-		view_ctx_t *v = windows[i].ctx;
-		if (!v->notify_flash)
-			continue;
-		long elapsed_ms =
-			(now.tv_sec - v->notify_flash_start.tv_sec) * 1000 +
-			(now.tv_usec - v->notify_flash_start.tv_usec) / 1000;
-		long phase = elapsed_ms % 1000;
-		uint32_t color = (phase < 200) ? 0xffff0000 : 0xff00ff00;
-		set_border_color(v, color);
+	v->wm_moving = 0;
+	wm_move_view = NULL;
+	v->button3_pressed = 0;
+	v->docked_x = 0;
+	v->docked_y = 0;
+	if (!shift && snap_view(v, &x, &y) &&
+	    (x != v->view_x || y != v->view_y)) {
+		int values[2] = { x, y };
+		v->view_x = x;
+		v->view_y = y;
+		xcb_configure_window(c, v->window,
+			XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y, values);
+		xcb_flush(c);
+	}
+	save_state();
+}
+
+/*
+ * ends a wm move whose release went past us: button 3 is up but
+ * neither the release nor the EnterNotify came
+ */
+void
+check_wm_move(void)
+{
+	if (!wm_move_view || ms_since(&wm_move_check) < WM_MOVE_CHECK_MS)
+		return;
+	now_tv(&wm_move_check);
+
+	xcb_query_pointer_cookie_t ck = xcb_query_pointer(c, screen->root);
+	xcb_query_pointer_reply_t *r = REPLY(xcb_query_pointer_reply, ck,
+		NULL);
+	if (!r)
+		return;
+	if (!(r->mask & XCB_BUTTON_MASK_3)) {
+		deb("view 0x%x: wm move ended without a release\n",
+			wm_move_view->window);
+		finish_wm_move(wm_move_view, r->mask & XCB_MOD_MASK_SHIFT);
 	}
+	free(r);
+}
+
+/*
+ * ms until check_wm_move is due, -1 without a wm move
+ */
+long
+wm_move_wait_ms(void)
+{
+	if (!wm_move_view)
+		return -1;
+	long left = WM_MOVE_CHECK_MS - ms_since(&wm_move_check);
+	return left > 0 ? left : 0;
 }
 
 void
@@ -1358,7 +5979,7 @@ handle_view_event(xcb_generic_event_t *e, void *ctx)
 			"location (%d,%d), with dimension (%d,%d)\n",
 		ev->window, ev->x, ev->y, ev->width, ev->height);
 
-		redraw_view(v);
+		redraw_group(v);
 	} else if (rt == XCB_GRAPHICS_EXPOSURE) {
 		xcb_graphics_exposure_event_t *ev = (void *)e;
 
@@ -1366,18 +5987,26 @@ handle_view_event(xcb_generic_event_t *e, void *ctx)
 			"location (%d,%d), with dimension (%d,%d)\n",
 		ev->drawable, ev->x, ev->y, ev->width, ev->height);
 
-		redraw_view(v);
+		redraw_group(v);
 	} else if (rt == XCB_BUTTON_PRESS) {
 		xcb_button_press_event_t *bp = (void *)e;
+		view_ctx_t *m = view_at(v, bp->event_x, bp->event_y);
+		int edges = resize_edges(v, bp->event_x, bp->event_y);
 		deb("button press event, detail %d\n", bp->detail);
-		if (bp->detail == XCB_BUTTON_INDEX_1 &&
-		    !v->t->disconnected) {
-			deb("raise window 0x%x\n", v->window);
-			/* left button, raise target window */
-			uint32_t values[1];
-			values[0] = XCB_STACK_MODE_ABOVE;
-			xcb_configure_window(c, v->t->wm_target,
-				XCB_CONFIG_WINDOW_STACK_MODE, values);
+		/* a press reaching us means the window manager let go */
+		if (wm_move_view)
+			finish_wm_move(wm_move_view,
+				bp->state & XCB_MOD_MASK_SHIFT);
+		if (bp->detail == XCB_BUTTON_INDEX_1 && edges &&
+		    !m->t->disconnected) {
+			start_resize(v, edges, bp);
+		} else if (bp->detail == XCB_BUTTON_INDEX_1) {
+			raise_target(m);
+		}
+		if (bp->detail == XCB_BUTTON_INDEX_4 ||
+		    bp->detail == XCB_BUTTON_INDEX_5) {
+			/* wheel up: back in the history, down: forward */
+			scrub_history(m, bp->detail == XCB_BUTTON_INDEX_4);
 		}
 		if (bp->detail == XCB_BUTTON_INDEX_3) {
 			v->button3_pressed = 1;
@@ -1385,11 +6014,17 @@ handle_view_event(xcb_generic_event_t *e, void *ctx)
 			v->move_offset_x = bp->event_x;
 			v->move_offset_y = bp->event_y;
 			deb("button 3 pressed\n");
+			if (cfg.drag == CONFIG_DRAG_WM && atom_moveresize)
+				start_wm_move(v, bp->root_x, bp->root_y);
 		}
 	} else if (rt == XCB_BUTTON_RELEASE) {
 		xcb_button_release_event_t *br = (void *)e;
 		deb("button release event, detail %d\n", br->detail);
-		if ((br->detail == XCB_BUTTON_INDEX_3) &&
+		if (br->detail == XCB_BUTTON_INDEX_1 && v->resizing) {
+			end_resize(v);
+		} else if (br->detail == XCB_BUTTON_INDEX_3 && v->wm_moving) {
+			finish_wm_move(v, br->state & XCB_MOD_MASK_SHIFT);
+		} else if ((br->detail == XCB_BUTTON_INDEX_3) &&
 		    v->button3_pressed) {
 			deb("button 3 released\n");
 			v->button3_pressed = 0;
@@ -1398,7 +6033,11 @@ handle_view_event(xcb_generic_event_t *e, void *ctx)
 			save_state();
 		}
 
-	} else if (rt == XCB_MOTION_NOTIFY) {
+	} else if (rt == XCB_MOTION_NOTIFY && v->resizing) {
+		xcb_motion_notify_event_t *mv = (void *)e;
+		drag_resize(v, mv->root_x, mv->root_y);
+	} else if (rt == XCB_MOTION_NOTIFY && v->button3_pressed &&
+	    !v->wm_moving) {
 		xcb_motion_notify_event_t *mv = (void *)e;
 
 		deb("motion notify event at root %d,%d event %d,%d state %d\n",
@@ -1417,10 +6056,12 @@ handle_view_event(xcb_generic_event_t *e, void *ctx)
 			goto apply_move;
 		}
 
-		/* Break free from docking after 12px mouse movement per axis */
-		if (v->docked_x && abs(mv->root_x - v->dock_mouse_x) >= 12)
+		/* Break free from docking after some mouse movement per axis */
+		if (v->docked_x && abs(mv->root_x - v->dock_mouse_x) >=
+		    cfg.undock_distance)
 			v->docked_x = 0;
-		if (v->docked_y && abs(mv->root_y - v->dock_mouse_y) >= 12)
+		if (v->docked_y && abs(mv->root_y - v->dock_mouse_y) >=
+		    cfg.undock_distance)
 			v->docked_y = 0;
 
 		/* Hold docked axis at its docked position */
@@ -1429,75 +6070,10 @@ handle_view_event(xcb_generic_event_t *e, void *ctx)
 		if (v->docked_y)
 			new_y = v->dock_view_y;
 
-		int snapped_x = 0, snapped_y = 0;
-		int sw = screen->width_in_pixels;
-		int sh = screen->height_in_pixels;
-		int bw2 = 2 * border_width;
-		int w = v->cap_width + bw2;
-		int h = v->cap_height + bw2;
-
-		/* Snap to screen edges */
-		if (abs(new_x) <= 1) { new_x = 0; snapped_x = 1; }
-		if (abs(new_y) <= 1) { new_y = 0; snapped_y = 1; }
-		if (abs(new_x + w - sw) <= 1) { new_x = sw - w; snapped_x = 1; }
-		if (abs(new_y + h - sh) <= 1) { new_y = sh - h; snapped_y = 1; }
-
-		/* Snap to other view windows */
-		for (int i = 0; i < nwindows; i++) {
-			if (windows[i].type != WIN_TYPE_VIEW)
-				continue;
-			view_ctx_t *o = windows[i].ctx;
-			if (o == v)
-				continue;
-			int ow = o->cap_width + bw2;
-			int oh = o->cap_height + bw2;
-			int ox = o->view_x;
-			int oy = o->view_y;
-
-			/* Check vertical overlap for left/right snapping */
-			int v_overlap = (new_y < oy + oh) &&
-					(new_y + h > oy);
-			if (v_overlap) {
-				/* My right edge to other's left edge */
-				if (abs(new_x + w - ox) <= 1)
-					{ new_x = ox - w; snapped_x = 1; }
-				/* My left edge to other's right edge */
-				if (abs(new_x - (ox + ow)) <= 1)
-					{ new_x = ox + ow; snapped_x = 1; }
-			}
-
-			/* Check horizontal overlap for top/bottom snapping */
-			int h_overlap = (new_x < ox + ow) &&
-					(new_x + w > ox);
-			if (h_overlap) {
-				/* My bottom edge to other's top edge */
-				if (abs(new_y + h - oy) <= 1)
-					{ new_y = oy - h; snapped_y = 1; }
-				/* My top edge to other's bottom edge */
-				if (abs(new_y - (oy + oh)) <= 1)
-					{ new_y = oy + oh; snapped_y = 1; }
-			}
-
-			/* When side-by-side, align tops/bottoms */
-			int h_adj = (abs(new_x + w - ox) <= 1) ||
-				    (abs(new_x - (ox + ow)) <= 1);
-			if (h_adj) {
-				if (abs(new_y - oy) <= 1)
-					{ new_y = oy; snapped_y = 1; }
-				if (abs(new_y + h - (oy + oh)) <= 1)
-					{ new_y = oy + oh - h; snapped_y = 1; }
-			}
-
-			/* When stacked, align lefts/rights */
-			int v_adj = (abs(new_y + h - oy) <= 1) ||
-				    (abs(new_y - (oy + oh)) <= 1);
-			if (v_adj) {
-				if (abs(new_x - ox) <= 1)
-					{ new_x = ox; snapped_x = 1; }
-				if (abs(new_x + w - (ox + ow)) <= 1)
-					{ new_x = ox + ow - w; snapped_x = 1; }
-			}
-		}
+		/* Snap to screen edges and other view windows */
+		int snapped = snap_view(v, &new_x, &new_y);
+		int snapped_x = snapped & SNAP_X;
+		int snapped_y = snapped & SNAP_Y;
 
 		if (snapped_x && !v->docked_x) {
 			v->docked_x = 1;
@@ -1534,18 +6110,77 @@ handle_view_event(xcb_generic_event_t *e, void *ctx)
 		xcb_key_press_event_t *kp = (void *)e;
 		deb("key press event, detail %d state 0x%x\n",
 			kp->detail, kp->state);
-		if (kp->detail == 57) { /* 'n' — toggle notify mode */
+		/* in a composite, keys go to the sub-capture under the pointer */
+		v = view_at(v, kp->event_x, kp->event_y);
+		if (kp->detail == 58) { /* 'm' — merge, shift: split off */
+			view_ctx_t *g = view_group(v);
+			if (kp->state & 0x01) {
+				split_view(v);
+			} else if (!merge_pending) {
+				merge_pending = g;
+				set_border_color(g, 0xffffff00);
+			} else {
+				view_ctx_t *src = merge_pending;
+				merge_pending = NULL;
+				set_border_color(src, src->notify ?
+					0xff00ff00 : 0xff000000);
+				merge_views(g, src);
+			}
+			xcb_flush(c);
+			save_state();
+		} else if (kp->detail == 57) { /* 'n' — toggle notify mode */
 			v->notify = !v->notify;
 			if (v->notify) {
 				set_border_color(v, 0xff00ff00);
+				assign_rules(v);
+				push_history(v);
 			} else {
 				if (v->notify_flash) {
 					v->notify_flash = 0;
 					notify_flashing_count--;
 				}
 				set_border_color(v, 0xff000000);
+				hist_clear(&v->hist);
+				if (v->hist_show) {
+					v->hist_show = 0;
+					redraw_view(v);
+				}
+			}
+			update_target_damage(v->t);
+			xcb_flush(c);
+			save_state();
+		} else if (kp->detail == 27) { /* 'r' — cycle refresh policy */
+			set_refresh_policy(v, (v->refresh + 1) % (REFRESH_FROZEN + 1),
+				v->refresh_fps);
+			xcb_flush(c);
+			save_state();
+		} else if (kp->detail == 65) { /* space — refresh now */
+			refresh_view(v);
+		} else if (kp->detail == 39) { /* 's' — snapshot, shift: record */
+			if (kp->state & 0x01)
+				toggle_recording(v);
+			else
+				snapshot_view(v);
+			xcb_flush(c);
+		} else if (kp->detail == 59 || kp->detail == 60) {
+			/* ',' '.' — step back, forward in the history */
+			scrub_history(v, kp->detail == 59);
+		} else if (kp->detail == 31) { /* 'i' — toggle the HUD */
+			v->hud = !v->hud;
+			n_huds += v->hud ? 1 : -1;
+			if (v->hud) {
+				reset_hud(v);
+				draw_hud(v);
+			} else {
+				/* paint over it from the cache */
+				redraw_view(v);
+				if (n_huds == 0)
+					free_hud_gcs();
 			}
 			xcb_flush(c);
+		} else if (v->refresh == REFRESH_THROTTLED &&
+		    kp->detail >= 10 && kp->detail <= 18) { /* 1-9 — fps */
+			set_refresh_policy(v, REFRESH_THROTTLED, kp->detail - 9);
 			save_state();
 		// Escape or backspace or del
 		} else if (kp->detail == 9 || kp->detail == 22 ||
@@ -1588,25 +6223,37 @@ handle_view_event(xcb_generic_event_t *e, void *ctx)
 				if (new_w < 1) { new_w = 1; dx = 0; }
 				if (new_h < 1) { new_h = 1; dy = 0; }
 
-				int size_changed = (new_w != v->cap_width ||
-						    new_h != v->cap_height);
-				v->cap_x += dx;
-				v->cap_y += dy;
-				v->cap_width = new_w;
-				v->cap_height = new_h;
-
-				if (size_changed)
-					resize_view(v);
-				redraw_view(v);
-				save_state();
+				/* key repeats pile up into one frame */
+				set_capture(v, v->cap_x + dx, v->cap_y + dy,
+					new_w, new_h);
+				save_later();
 			}
 		}
+	} else if (rt == XCB_VISIBILITY_NOTIFY) {
+		xcb_visibility_notify_event_t *vn = (void *)e;
+		for (view_ctx_t *m = v; m; m = m->next_member)
+			set_view_visibility(m,
+				vn->state == XCB_VISIBILITY_FULLY_OBSCURED,
+				m->unmapped);
+	} else if (rt == XCB_MAP_NOTIFY) {
+		for (view_ctx_t *m = v; m; m = m->next_member)
+			set_view_visibility(m, m->obscured, 0);
+	} else if (rt == XCB_UNMAP_NOTIFY) {
+		for (view_ctx_t *m = v; m; m = m->next_member)
+			set_view_visibility(m, m->obscured, 1);
 	} else if (rt == XCB_ENTER_NOTIFY) {
-		if (v->notify_flash) {
-			v->notify_flash = 0;
-			notify_flashing_count--;
-			set_border_color(v, 0xff00ff00);
-			xcb_flush(c);
+		xcb_enter_notify_event_t *en = (void *)e;
+		if (v->wm_moving && en->mode == XCB_NOTIFY_MODE_UNGRAB)
+			finish_wm_move(v, en->state & XCB_MOD_MASK_SHIFT);
+		for (view_ctx_t *m = v; m; m = m->next_member) {
+			if (m->refresh == REFRESH_ON_DEMAND && m->stale)
+				redraw_view(m);
+			if (m->notify_flash) {
+				m->notify_flash = 0;
+				notify_flashing_count--;
+				set_border_color(m, 0xff00ff00);
+				xcb_flush(c);
+			}
 		}
 	} else {
 		deb("view: discarding event type %d\n", rt);
@@ -1624,28 +6271,18 @@ disconnect_target(target_ctx_t *t)
 	rem_window(t->target);
 
 	/* destroy damage object */
-	xcb_damage_destroy(c, t->damage);
+	if (t->damage)
+		xcb_damage_destroy(c, t->damage);
 	t->damage = 0;
 
 	t->disconnected = 1;
+	t->dmg_x1 = t->dmg_x2 = 0;
 
-	/* blank all views and free their GCs */
-	for (v = t->first_view; v != NULL; v = v->next_view) {
-		xcb_rectangle_t r = {
-			.x = border_width,
-			.y = border_width,
-			.width = v->cap_width,
-			.height = v->cap_height,
-		};
-		xcb_poly_fill_rectangle(c, v->window, v->gc, 1, &r);
-		xcb_free_gc(c, v->gc);
-		v->gc = 0;
-	}
+	/* views keep showing the last frame from the cache */
+	for (v = t->first_view; v != NULL; v = v->next_view)
+		clear_view_dirty(v);
 
-	/* add to disconnected list */
-	if (n_disconnected >= MAX_DISCONNECTED)
-		fail("too many disconnected targets");
-	disconnected_targets[n_disconnected++] = t;
+	add_disconnected(t);
 }
 
 void
@@ -1662,6 +6299,7 @@ reconnect_target(target_ctx_t *t, xcb_window_t new_target,
 	t->target = new_target;
 	t->wm_target = new_wm_target;
 	t->disconnected = 0;
+	t->unmapped = 0;
 
 	/* subscribe to events on new target */
 	values[0] = XCB_EVENT_MASK_STRUCTURE_NOTIFY |
@@ -1669,10 +6307,8 @@ reconnect_target(target_ctx_t *t, xcb_window_t new_target,
 	xcb_change_window_attributes(c, new_target, XCB_CW_EVENT_MASK,
 		values);
 
-	/* create new damage object */
-	t->damage = xcb_generate_id(c);
-	xcb_damage_create(c, t->damage, new_target,
-		XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES);
+	/* create new damage object, unless all views are frozen */
+	update_target_damage(t);
 
 	/* register in window registry */
 	add_window(new_target, WIN_TYPE_TARGET, t);
@@ -1684,20 +6320,28 @@ reconnect_target(target_ctx_t *t, xcb_window_t new_target,
 	xcb_get_geometry_reply_t *target_geom;
 
 	attr_cookie = xcb_get_window_attributes(c, new_target);
-	win_attrs = xcb_get_window_attributes_reply(c, attr_cookie, &err);
+	win_attrs = REPLY(xcb_get_window_attributes_reply, attr_cookie, &err);
 	geom_cookie = xcb_get_geometry(c, new_target);
-	target_geom = xcb_get_geometry_reply(c, geom_cookie, &err);
+	target_geom = REPLY(xcb_get_geometry_reply, geom_cookie, &err);
+
+	/* the cache keeps the old frame unless the depth changed */
+	if (target_geom && (!t->gc || target_geom->depth != t->depth)) {
+		free_target_cache(t);
+		t->depth = target_geom->depth;
+		t->gc = copy_gc_get(t->depth, new_target);
+	}
+	update_target_cache(t);
+	damage_target_cache_all(t);
 
 	/* recreate GCs and redraw all views */
 	for (v = t->first_view; v != NULL; v = v->next_view) {
-		uint32_t grey = 0xff808080;
 		uint32_t black = 0xff000000;
 
 		/* check if view window depth matches target */
 		xcb_get_geometry_cookie_t vg_c =
 			xcb_get_geometry(c, v->window);
 		xcb_get_geometry_reply_t *vg =
-			xcb_get_geometry_reply(c, vg_c, &err);
+			REPLY(xcb_get_geometry_reply, vg_c, &err);
 		if (vg && target_geom && win_attrs &&
 		    vg->depth != target_geom->depth) {
 			int vx = vg->x, vy = vg->y;
@@ -1707,6 +6351,14 @@ reconnect_target(target_ctx_t *t, xcb_window_t new_target,
 				"recreating view window\n",
 				vg->depth, target_geom->depth);
 
+			/* a composite holds a single depth */
+			if (v->group || v->next_member) {
+				split_view(v);
+				vx = v->view_x;
+				vy = v->view_y;
+				view_window_size(v, &vw, &vh);
+			}
+
 			rem_window(v->window);
 			xcb_destroy_window(c, v->window);
 
@@ -1716,21 +6368,20 @@ reconnect_target(target_ctx_t *t, xcb_window_t new_target,
 				win_attrs->colormap,
 				vx, vy, vw, vh, black);
 			v->window = nw;
+			v->depth = target_geom->depth;
+			if (v->still) {
+				/* wrong depth now, freeze again below */
+				xcb_free_pixmap(c, v->still);
+				v->still = 0;
+			}
 			add_window(nw, WIN_TYPE_VIEW, v);
 		}
 		free(vg);
 
-		if (v->gc)
-			xcb_free_gc(c, v->gc);
-		v->gc = xcb_generate_id(c);
-		values[0] = grey;
-		values[1] = black;
-		values[2] = XCB_SUBWINDOW_MODE_INCLUDE_INFERIORS;
-		values[3] = 0; /* graphics_exposures: disable to avoid feedback loop */
-		xcb_create_gc(c, v->gc, new_target,
-			XCB_GC_FOREGROUND | XCB_GC_BACKGROUND |
-			XCB_GC_SUBWINDOW_MODE | XCB_GC_GRAPHICS_EXPOSURES,
-			values);
+		copy_gc_put(v->gc);
+		v->gc = copy_gc_get(v->depth, v->window);
+		if (v->refresh == REFRESH_FROZEN)
+			freeze_view(v);
 		redraw_view(v);
 	}
 
@@ -1738,20 +6389,14 @@ reconnect_target(target_ctx_t *t, xcb_window_t new_target,
 	if (win_attrs)
 		free(win_attrs);
 
-	/* remove from disconnected list */
-	for (int i = 0; i < n_disconnected; i++) {
-		if (disconnected_targets[i] == t) {
-			disconnected_targets[i] =
-				disconnected_targets[--n_disconnected];
-			break;
-		}
-	}
+	rem_disconnected(t);
 }
 
 void
 check_new_window(xcb_window_t window)
 {
 	xcb_window_t client;
+	const char *iname;
 	char *name;
 
 	if (n_disconnected == 0)
@@ -1768,17 +6413,55 @@ check_new_window(xcb_window_t window)
 	deb("new window 0x%x (client 0x%x) title '%s'\n",
 		window, client, name);
 
+	/* names are interned, a title nobody uses can't match */
+	iname = str_find(name);
+	free(name);
+	if (!iname)
+		return;
 	for (int i = 0; i < n_disconnected; i++) {
 		target_ctx_t *t = disconnected_targets[i];
-		if (strcmp(t->name, name) == 0) {
-			deb("matched disconnected target '%s'\n", name);
-			free(name);
+		if (t->name == iname) {
+			deb("matched disconnected target '%s'\n", iname);
 			reconnect_target(t, window, client);
 			return;
 		}
 	}
+}
 
-	free(name);
+/*
+ * the views whose capture area the damage touches
+ */
+void
+damage_views(target_ctx_t *t, int x, int y, int w, int h)
+{
+	int nhits = cap_set_intersect(&t->caps, x, y, w, h);
+	if (nhits == 0)
+		deb("damage outside capture areas, ignoring\n");
+
+	for (int i = 0; i < nhits; i++) {
+		view_ctx_t *v = t->caps.owner[t->caps.hits[i]];
+		if (v->refresh == REFRESH_FROZEN)
+			continue;
+		v->hist_new = v->notify;
+		if (v->hud && !v->damage_pending) {
+			v->damage_pending = 1;
+			now_tv(&v->damaged_at);
+		}
+		if (view_hidden(v))
+			v->missed = 1;
+		else
+			view_damaged(v);
+		/* with rules, only their results flash */
+		if (v->notify && v->rule_mask) {
+			if (!v->rules_dirty &&
+			    rules_damaged(v, x, y, w, h)) {
+				v->rules_dirty = 1;
+				update_rule_views(v);
+			}
+		} else if (v->notify) {
+			start_notify_flash(v);
+		}
+	}
 }
 
 void
@@ -1795,46 +6478,59 @@ handle_target_event(xcb_generic_event_t *e, void *ctx)
 			"area x %d y %d width %d height%d\n",
 			dev->drawable, dev->level, dev->area.x, dev->area.y,
 			dev->area.width, dev->area.height);
+		if (!t->damage || dev->damage != t->damage) {
+			/* left over from a damage object we dropped */
+			return;
+		}
 		xcb_damage_subtract(c, t->damage, None, None);
 
-		for (v = t->first_view; v != NULL; v = v->next_view) {
-			/*
-			 * check if damage lies within our capture area
-			 */
-			if ( (dev->area.x + dev->area.width < v->cap_x) ||
-			     (dev->area.x > v->cap_x + v->cap_width) ||
-			     (dev->area.y + dev->area.height < v->cap_y) ||
-			     (dev->area.y > v->cap_y + v->cap_height) ) {
-				deb("damage outside capture area, ignoring\n");
-				continue;
-			}
-			redraw_view(v);
-			if (v->notify && !v->notify_flash) {
-				v->notify_flash = 1;
-				gettimeofday(&v->notify_flash_start, NULL);
-				notify_flashing_count++;
-			}
+		/* non-empty reports carry no area */
+		int x = dev->area.x, y = dev->area.y;
+		int w = dev->area.width, h = dev->area.height;
+		if (w == 0 || h == 0) {
+			x = t->cache_x;
+			y = t->cache_y;
+			w = t->cache_w;
+			h = t->cache_h;
 		}
+		damage_target_cache(t, x, y, w, h);
+		t->n_damage++;
+
+		t->rate_events++;
+		t->rate_px += (long)w * h;
+		t->rate_px_in += (long)overlap(x, w, t->cache_x, t->cache_w) *
+			overlap(y, h, t->cache_y, t->cache_h);
+		if (cfg.damage_level == CONFIG_DAMAGE_AUTO)
+			adapt_damage_level(t);
+
+		damage_views(t, x, y, w, h);
 	} else if (rt == XCB_UNMAP_NOTIFY) {
 		xcb_unmap_notify_event_t *um = (void *)e;
 		if (um->window == t->target) {
-			deb("target window unmapped, blanking view\n");
-			for (v = t->first_view; v != NULL; v = v->next_view) {
-				// fill with grey (gc foreground)
-				xcb_rectangle_t r = {
-					.x = border_width,
-					.y = border_width,
-					.width = v->cap_width,
-					.height = v->cap_height,
-				};
-				xcb_poly_fill_rectangle(c, v->window,
-					v->gc, 1, &r);
-			}
+			/* its content is undefined now, views keep
+			 * showing the cache */
+			deb("target window unmapped, keeping last frame\n");
+			t->unmapped = 1;
 		} else {
 			deb("ignoring unmap notify for window 0x%x "
 				"event 0x%x, my window is 0x%x\n",
 				um->window, um->event, t->target);
 		}
+	} else if (rt == XCB_MAP_NOTIFY) {
+		xcb_map_notify_event_t *mn = (void *)e;
+		if (mn->window == t->target && t->unmapped) {
+			deb("target window mapped again\n");
+			t->unmapped = 0;
+			damage_target_cache_all(t);
+			for (v = t->first_view; v != NULL; v = v->next_view) {
+				if (v->refresh == REFRESH_FROZEN)
+					continue;
+				if (view_hidden(v))
+					v->missed = 1;
+				else
+					view_damaged(v);
+			}
+		}
 	} else if (rt == XCB_DESTROY_NOTIFY) {
 		xcb_destroy_notify_event_t *dn = (void *)e;
 		if (dn->window == t->target) {
@@ -1852,10 +6548,11 @@ handle_event(xcb_generic_event_t *e)
 
 	int rt = e->response_type & ~0x80;
 
-	/* intercept MAP_NOTIFY on root for reconnection */
+	/* intercept MAP_NOTIFY on root for reconnection, known targets
+	 * get to see their own mapping */
 	if (rt == XCB_MAP_NOTIFY) {
 		xcb_map_notify_event_t *mn = (void *)e;
-		if (mn->event == screen->root) {
+		if (mn->event == screen->root && find_window(mn->window) < 0) {
 			deb("map notify on root for window 0x%x\n",
 				mn->window);
 			check_new_window(mn->window);
@@ -1863,6 +6560,46 @@ handle_event(xcb_generic_event_t *e)
 		}
 	}
 
+	if (rt == screensaver_event) {
+		xcb_screensaver_notify_event_t *sn = (void *)e;
+		deb("screensaver state %d\n", sn->state);
+		saver_on = sn->state == XCB_SCREENSAVER_STATE_ON;
+		update_blanked();
+		return;
+	}
+
+	if (rt == XCB_GE_GENERIC) {
+		xcb_ge_generic_event_t *ge = (void *)e;
+		if (ge->extension == dpms_opcode &&
+		    ge->event_type == XCB_DPMS_INFO_NOTIFY) {
+			xcb_dpms_info_notify_event_t *in = (void *)e;
+			deb("dpms power level %d\n", in->power_level);
+			dpms_off = in->state &&
+				in->power_level != XCB_DPMS_DPMS_MODE_ON;
+			update_blanked();
+			return;
+		}
+		handle_present_event(e);
+		return;
+	}
+
+	if (rt == shm_completion_event) {
+		mirror_completion(e);
+		return;
+	}
+
+	if (rt == 0) {
+		/* unchecked requests, e.g. a copy from a target that
+		 * was destroyed before we saw it */
+		xcb_generic_error_t *err = (void *)e;
+		if (mirror_put_error(err) || cache_copy_error(err))
+			return;
+		deb("X error code %d major %d minor %d resource 0x%x\n",
+			err->error_code, err->major_code, err->minor_code,
+			err->resource_id);
+		return;
+	}
+
 	/* filter root SubstructureNotify events we don't handle */
 	if (rt == XCB_CREATE_NOTIFY || rt == XCB_REPARENT_NOTIFY) {
 		deb("ignoring root event type %d\n", rt);
@@ -1884,6 +6621,8 @@ handle_event(xcb_generic_event_t *e)
 		win = ((xcb_motion_notify_event_t *)e)->event;
 	} else if (rt == XCB_CONFIGURE_NOTIFY) {
 		win = ((xcb_configure_notify_event_t *)e)->window;
+	} else if (rt == XCB_MAP_NOTIFY) {
+		win = ((xcb_map_notify_event_t *)e)->window;
 	} else if (rt == XCB_UNMAP_NOTIFY) {
 		xcb_unmap_notify_event_t *um = (void *)e;
 		deb("unmap notify for window 0x%x event 0x%x\n",
@@ -1899,6 +6638,10 @@ handle_event(xcb_generic_event_t *e)
 			dn->window, dn->event);
 		/* route by the destroyed window, not the event window */
 		win = dn->window;
+	} else if (rt == XCB_VISIBILITY_NOTIFY) {
+		win = ((xcb_visibility_notify_event_t *)e)->window;
+	} else if (rt == XCB_FOCUS_IN || rt == XCB_FOCUS_OUT) {
+		win = ((xcb_focus_in_event_t *)e)->event;
 	} else if (rt == XCB_ENTER_NOTIFY) {
 		win = ((xcb_enter_notify_event_t *)e)->event;
 	} else if (rt == XCB_LEAVE_NOTIFY) {
@@ -1911,14 +6654,25 @@ handle_event(xcb_generic_event_t *e)
 	}
 
 	/* handle hover tracking for tooltips */
+	if (rt == XCB_FOCUS_IN || rt == XCB_FOCUS_OUT) {
+		xcb_focus_in_event_t *fe = (void *)e;
+		if (rt == XCB_FOCUS_IN)
+			focus_window = fe->event;
+		else if (focus_window == fe->event)
+			focus_window = XCB_WINDOW_NONE;
+		return;
+	}
 	if (rt == XCB_ENTER_NOTIFY) {
 		xcb_enter_notify_event_t *en = (void *)e;
+		pointer_window = en->event;
 		hover_window = en->event;
 		hover_x = en->root_x;
 		hover_y = en->root_y;
-		gettimeofday(&hover_start, NULL);
+		now_tv(&hover_start);
 	}
 	if (rt == XCB_LEAVE_NOTIFY) {
+		if (pointer_window == ((xcb_leave_notify_event_t *)e)->event)
+			pointer_window = XCB_WINDOW_NONE;
 		hover_window = XCB_WINDOW_NONE;
 		hide_tooltip();
 		return;
@@ -1949,12 +6703,387 @@ handle_event(xcb_generic_event_t *e)
 	}
 }
 
+void
+request_stats(int sig)
+{
+	stats_requested = 1;
+}
+
+void
+request_quit(int sig)
+{
+	quit_requested = 1;
+}
+
+/*
+ * the final save, thumbnails included while the server is still there
+ */
+void
+save_on_exit(void)
+{
+	save_state();
+	save_thumbnails();
+}
+
+/*
+ * live server resources and contexts, on SIGUSR1 and every
+ * cfg.stats_interval_s
+ */
+long
+pixmap_bytes(int depth, int w, int h)
+{
+	return (long)w * h * (depth > 16 ? 4 : depth > 8 ? 2 : 1);
+}
+
+/*
+ * the server resources the registry accounts for
+ */
+void
+expected_resources(int *n, long *bytes)
+{
+	int tooltip = tooltip_window != XCB_WINDOW_NONE; /* window + GC */
+
+	memset(n, 0, NRES * sizeof(*n));
+	*bytes = 0;
+	n[RES_WINDOW] = tooltip;
+	n[RES_GC] = tooltip;
+	n[RES_CURSOR] = ncursors;
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type == WIN_TYPE_VIEW) {
+			view_ctx_t *v = windows[i].ctx;
+			if (!is_member(i))
+				n[RES_WINDOW]++;
+			if (v->still) {
+				n[RES_PIXMAP]++;
+				*bytes += pixmap_bytes(v->depth, v->cap_width,
+					v->cap_height);
+			}
+			for (int k = 0; k < v->hist.n; k++) {
+				n[RES_PIXMAP]++;
+				*bytes += v->hist.f[(v->hist.head + k) %
+					v->hist.alloc].bytes;
+			}
+		} else if (windows[i].type == WIN_TYPE_TARGET) {
+			target_ctx_t *t = windows[i].ctx;
+			if (t->damage)
+				n[RES_DAMAGE]++;
+			if (t->cache) {
+				n[RES_PIXMAP]++;
+				*bytes += pixmap_bytes(t->depth, t->cache_w,
+					t->cache_h);
+			}
+		} else if (windows[i].window == top_window) {
+			/* not the root, registered while selecting */
+			top_ctx_t *top = windows[i].ctx;
+			n[RES_WINDOW]++;
+			n[RES_GC]++;
+			if (top->sel_overlay)
+				n[RES_WINDOW]++;
+			if (top->sel_cmap)
+				n[RES_COLORMAP]++;
+		}
+	}
+	for (int i = 0; i < n_disconnected; i++) {
+		target_ctx_t *t = disconnected_targets[i];
+		if (t->cache) {
+			n[RES_PIXMAP]++;
+			*bytes += pixmap_bytes(t->depth, t->cache_w, t->cache_h);
+		}
+	}
+	for (mirror_src_t *s = mirror_srcs; s; s = s->next)
+		for (mirror_win_t *mw = s->wins; mw; mw = mw->next)
+			if (mw->t && mw->t->cache) {
+				n[RES_PIXMAP]++;
+				*bytes += pixmap_bytes(mw->t->depth,
+					mw->t->cache_w, mw->t->cache_h);
+			}
+	for (int i = 0; i < 33; i++)
+		n[RES_GC] += !!copy_gcs[i].refs + !!hud_gcs[i];
+}
+
+/*
+ * ask the server what it holds for us. Prints a stats line to out if
+ * given, warns when the difference to the expected counts grew.
+ */
+void
+check_xres(FILE *out)
+{
+	xcb_res_query_client_resources_cookie_t rc;
+	xcb_res_query_client_resources_reply_t *rr;
+	xcb_res_query_client_pixmap_bytes_cookie_t pc;
+	xcb_res_query_client_pixmap_bytes_reply_t *pr;
+	int expected[NRES], server[NRES] = { 0 };
+	long bytes, server_bytes;
+
+	now_tv(&last_xres);
+	rc = xcb_res_query_client_resources(c, top_window);
+	pc = xcb_res_query_client_pixmap_bytes(c, top_window);
+	rr = REPLY(xcb_res_query_client_resources_reply, rc, NULL);
+	pr = REPLY(xcb_res_query_client_pixmap_bytes_reply, pc, NULL);
+	if (!rr || !pr) {
+		free(rr);
+		free(pr);
+		return;
+	}
+	xcb_res_type_t *types = xcb_res_query_client_resources_types(rr);
+	int ntypes = xcb_res_query_client_resources_types_length(rr);
+	for (int i = 0; i < ntypes; i++)
+		for (int k = 0; k < NRES; k++)
+			if (types[i].resource_type == res_atoms[k])
+				server[k] = types[i].count;
+	expected_resources(expected, &bytes);
+	server_bytes = (uint64_t)pr->bytes_overflow << 32 | pr->bytes;
+
+	if (out)
+		fprintf(out, "stats: server windows %d/%d pixmaps %d/%d "
+			"(%lu/%ld kB) gcs %d/%d cursors %d/%d colormaps %d/%d "
+			"damage %d/%d\n",
+			server[RES_WINDOW], expected[RES_WINDOW],
+			server[RES_PIXMAP], expected[RES_PIXMAP],
+			server_bytes >> 10, bytes >> 10,
+			server[RES_GC], expected[RES_GC],
+			server[RES_CURSOR], expected[RES_CURSOR],
+			server[RES_COLORMAP], expected[RES_COLORMAP],
+			server[RES_DAMAGE], expected[RES_DAMAGE]);
+
+	/* the first sample sets the baseline */
+	for (int k = 0; k < NRES; k++) {
+		int excess = server[k] - expected[k];
+		if (xres_sampled && excess > xres_excess[k])
+			fprintf(stderr, "warning: the X server holds %d %s "
+				"resources of sniptotop, %d expected (%+d "
+				"since start)\n", server[k], res_names[k],
+				expected[k], excess - xres_excess[k]);
+		if (!xres_sampled || excess > xres_excess[k])
+			xres_excess[k] = excess;
+	}
+	long excess = server_bytes - bytes;
+	if (xres_sampled &&
+	    excess > xres_excess_bytes + XRES_BYTES_SLACK)
+		fprintf(stderr, "warning: the X server holds %ld kB of "
+			"pixmaps of sniptotop, %ld kB expected (%+ld kB since "
+			"start)\n", server_bytes >> 10, bytes >> 10,
+			(excess - xres_excess_bytes) >> 10);
+	if (!xres_sampled || excess > xres_excess_bytes + XRES_BYTES_SLACK)
+		xres_excess_bytes = excess;
+	xres_sampled = 1;
+	free(rr);
+	free(pr);
+}
+
+void
+print_stats(void)
+{
+	FILE *out = stdout;
+	int nviews = 0, nhidden = 0, ntargets = 0, ncoarse = 0;
+	int n[NRES];
+	long bytes;
+	int tooltip = tooltip_window != XCB_WINDOW_NONE; /* window + GC */
+	int nmirrors = 0;
+
+	for (mirror_src_t *s = mirror_srcs; s; s = s->next)
+		for (mirror_win_t *mw = s->wins; mw; mw = mw->next)
+			nmirrors += mw->t != NULL;
+	for (int i = 0; i < nwindows; i++) {
+		if (windows[i].type == WIN_TYPE_VIEW) {
+			view_ctx_t *v = windows[i].ctx;
+			nviews++;
+			nhidden += view_hidden(v);
+		} else if (windows[i].type == WIN_TYPE_TARGET) {
+			target_ctx_t *t = windows[i].ctx;
+			ntargets++;
+			if (t->damage && t->level !=
+			    XCB_DAMAGE_REPORT_LEVEL_RAW_RECTANGLES)
+				ncoarse++;
+		}
+	}
+	expected_resources(n, &bytes);
+
+	if (cfg.stats_file[0]) {
+		out = fopen(cfg.stats_file, "a");
+		if (!out) {
+			deb("%s: %s\n", cfg.stats_file, strerror(errno));
+			out = stdout;
+		}
+	}
+	fprintf(out, "stats: views %d (pool %d) hidden %d targets %d+%d "
+		"disconnected (pool %d) names %d\n"
+		"stats: pixmaps %d gcs %d cursors %d colormaps %d "
+		"damage %d (coarse %d) tooltip %d\n"
+		"stats: in flight %ld px, throttled %lu, late %lu, "
+		"level switches %lu, flushes %lu\n"
+		"stats: max stall %ld ms, save %ld ms (max %ld ms)\n"
+		"stats: rules %d, checks %lu, hits %lu\n"
+		"stats: history %d frames, %ld KiB of %d MiB\n"
+		"stats: mirrors %d, puts %lu, %lu px\n",
+		nviews, view_pool.live, nhidden, ntargets, n_disconnected,
+		target_pool.live, str_count(),
+		n[RES_PIXMAP], n[RES_GC] - tooltip, n[RES_CURSOR],
+		n[RES_COLORMAP], n[RES_DAMAGE], ncoarse, tooltip,
+		inflight_px, n_throttled, n_late, n_level_switches, n_flushes,
+		max_stall_ms, last_save_ms, max_save_ms,
+		rules.n, n_rule_checks, n_rule_hits,
+		hist_count(), hist_bytes() >> 10, cfg.history_mb,
+		nmirrors, n_mirror_puts, n_mirror_px);
+	if (xres_present)
+		check_xres(out);
+	if (out != stdout)
+		fclose(out);
+	else
+		fflush(stdout);
+	now_tv(&last_stats);
+}
+
+/*
+ * poll timeout of the main loop, -1 if nothing is due
+ */
+int
+loop_timeout_ms(void)
+{
+	int timeout_ms = (hover_window != XCB_WINDOW_NONE &&
+			  !tooltip_shown) ? 500 : -1;
+	if (notify_flashing_count > 0 && !blanked) {
+		/* wake for the shorter of the two colors */
+		int flash_ms = cfg.flash_on_ms;
+		if (cfg.flash_period_ms - flash_ms < flash_ms)
+			flash_ms = cfg.flash_period_ms - flash_ms;
+		if (flash_ms <= 0)
+			flash_ms = cfg.flash_period_ms;
+		if (timeout_ms < 0 || timeout_ms > flash_ms)
+			timeout_ms = flash_ms;
+	}
+	if (n_huds > 0 && !blanked &&
+	    (timeout_ms < 0 || timeout_ms > 1000))
+		timeout_ms = 1000;
+	if (cfg.stats_interval_s) {
+		long left = cfg.stats_interval_s * 1000L -
+			ms_since(&last_stats);
+		if (left < 0)
+			left = 0;
+		if (timeout_ms < 0 || timeout_ms > left)
+			timeout_ms = left;
+	}
+	if (xres_present && cfg.xres_interval_s) {
+		long left = cfg.xres_interval_s * 1000L - ms_since(&last_xres);
+		if (left < 0)
+			left = 0;
+		if (timeout_ms < 0 || timeout_ms > left)
+			timeout_ms = left;
+	}
+	int redraw_ms = redraw_timeout_ms();
+	if (redraw_ms >= 0 && (timeout_ms < 0 || timeout_ms > redraw_ms))
+		timeout_ms = redraw_ms;
+	int record_ms = recording_wait_ms();
+	if (record_ms >= 0 && (timeout_ms < 0 || timeout_ms > record_ms))
+		timeout_ms = record_ms;
+	int resize_ms = resize_wait_ms();
+	if (resize_ms >= 0 && (timeout_ms < 0 || timeout_ms > resize_ms))
+		timeout_ms = resize_ms;
+	int save_ms = save_wait_ms();
+	if (save_ms >= 0 && (timeout_ms < 0 || timeout_ms > save_ms))
+		timeout_ms = save_ms;
+	int level_ms = level_wait_ms();
+	if (level_ms >= 0 && (timeout_ms < 0 || timeout_ms > level_ms))
+		timeout_ms = level_ms;
+	int move_ms = wm_move_wait_ms();
+	if (move_ms >= 0 && (timeout_ms < 0 || timeout_ms > move_ms))
+		timeout_ms = move_ms;
+	return timeout_ms;
+}
+
+/*
+ * timers and redraws after the events of a main loop pass
+ */
+void
+end_pass(struct timeval *pass_start, int stats)
+{
+	/* check hover timeout */
+	if (hover_window != XCB_WINDOW_NONE &&
+	    !tooltip_shown) {
+		struct timeval now;
+		now_tv(&now);
+		long elapsed_ms = (now.tv_sec - hover_start.tv_sec) * 1000 +
+			(now.tv_usec - hover_start.tv_usec) / 1000;
+		if (elapsed_ms >= cfg.tooltip_delay_ms)
+			show_tooltip(hover_x, hover_y);
+	}
+
+	if (notify_flashing_count > 0 && !blanked)
+		update_notify_borders();
+
+	apply_resizes(0);
+	if (save_wait_ms() == 0)
+		save_state();
+	if (ms_since(&last_thumbs) >= THUMB_SAVE_S * 1000L)
+		save_thumbnails();
+	check_mirrors();
+	check_damage_levels();
+	check_wm_move();
+	service_dirty_views();
+	check_rules();
+	hist_expire(pass_start);
+	if (!blanked)
+		update_huds();
+
+	if (cfg.stats_interval_s &&
+	    ms_since(&last_stats) >= cfg.stats_interval_s * 1000L)
+		stats = 1;
+	if (stats)
+		print_stats();
+	else if (xres_present && cfg.xres_interval_s &&
+		 ms_since(&last_xres) >= cfg.xres_interval_s * 1000L)
+		check_xres(NULL);
+
+	/* no round trips after this */
+	record_frames();
+
+	long pass_ms = ms_since(pass_start);
+	if (pass_ms > max_stall_ms)
+		max_stall_ms = pass_ms;
+
+	xcb_flush(c);
+}
+
+/*
+ * run the passes of a recording as fast as they come, the timing is
+ * on the real clock. Never returns.
+ */
+void
+replay(void)
+{
+	struct timeval pass_start;
+	int *stats;
+
+	gettimeofday(&replay_start, NULL);
+	while (1) {
+		loop_timeout_ms();
+		now_tv(&pass_start);
+		collect_frames();
+		while (rec_peek(&rec) == REC_FILE) {
+			load_config(0);
+			load_rules();
+		}
+		while (rec_peek(&rec) == REC_EVENT) {
+			xcb_generic_event_t *e = replay_get(REC_EVENT, NULL,
+				NULL);
+			handle_event(e);
+			free(e);
+			replay_events++;
+		}
+		stats = replay_get(REC_PASS, NULL, NULL);
+		end_pass(&pass_start, *stats);
+		free(stats);
+		replay_passes++;
+	}
+}
+
 int
 main(int argc, char **argv)
 {
 	xcb_generic_event_t *e;
 	int opt;
-	while ((opt = getopt(argc, argv, "dn")) != -1) {
+	const char *record_path = NULL, *replay_path = NULL;
+	while ((opt = getopt(argc, argv, "dnv:R:P:m:")) != -1) {
 		switch (opt) {
 		case 'd':
 			debug = 1;
@@ -1962,8 +7091,26 @@ main(int argc, char **argv)
 		case 'n':
 			no_restore = 1;
 			break;
+		case 'v':
+			vsync_divisor = atoi(optarg);
+			if (vsync_divisor < 1)
+				fail("-v needs a vblank count >= 1");
+			break;
+		case 'R':
+			record_path = optarg;
+			break;
+		case 'P':
+			replay_path = optarg;
+			break;
+		case 'm':
+			if (n_mirror_specs == 16)
+				fail("at most 16 -m mirrors");
+			mirror_specs[n_mirror_specs++] = optarg;
+			break;
 		default:
-			fprintf(stderr, "Usage: %s [-d] [-n]\n", argv[0]);
+			fprintf(stderr, "Usage: %s [-d] [-n] [-v vblanks] "
+				"[-R record | -P replay] "
+				"[-m 'DISPLAY WxH+X+Y NAME']...\n", argv[0]);
 			exit(EXIT_FAILURE);
 		}
 	}
@@ -1973,14 +7120,43 @@ main(int argc, char **argv)
 	       "Then drag a rectangle with the left mouse button.\n"
 	       "To move a snip, hold down the right mouse button and drag.\n"
 	       "To close a snip, focus it and press escape.\n"
-	       "Arrow keys/hjkl resize (lower-right), shift: upper-left.\n");
-
+	       "Arrow keys/hjkl resize (lower-right), shift: upper-left.\n"
+	       "r cycles refresh: live, throttled (1-9 fps), on demand, frozen.\n"
+	       "i shows rates, latency and policy in a snip.\n"
+	       "m on two snips puts both in one window, shift+m splits.\n"
+	       "s saves a snip as PPM, shift+s records it to Y4M.\n");
+
+	pool_init(&view_pool, sizeof(view_ctx_t), 32);
+	pool_init(&target_pool, sizeof(target_ctx_t), 32);
+	config_defaults(&cfg);
 	initialize_state_path();
+	if (replay_path)
+		initialize_replay(replay_path);
+	else if (record_path)
+		initialize_recording(record_path);
+	load_config(1);
+	load_rules();
+	if (!replaying) {
+		initialize_config_watch();
+		rules_fd = rules_start(cfg.rule_threads);
+	}
 	initialize_xcb();
 	initialize_xdamage();
 	initialize_top_window();
+	initialize_present();
+	initialize_blanking();
+	initialize_xres();
+	initialize_shm();
+	initialize_moveresize();
 	restore_state();
-	atexit(save_state);
+	initialize_mirrors();
+	signal(SIGUSR1, request_stats);
+	signal(SIGTERM, request_quit);
+	signal(SIGINT, request_quit);
+	/* runs after the final save */
+	atexit(thumbs_wait);
+	atexit(frames_wait);
+	atexit(save_on_exit);
 
 	/* subscribe to root events to detect new windows for reconnection */
 	uint32_t root_mask = XCB_EVENT_MASK_SUBSTRUCTURE_NOTIFY;
@@ -1990,39 +7166,46 @@ main(int argc, char **argv)
 	/* main loop */
 	xcb_flush(c);
 	int xfd = xcb_get_file_descriptor(c);
-	struct pollfd pfd = { .fd = xfd, .events = POLLIN };
+	struct pollfd pfd[4] = {
+		{ .fd = xfd, .events = POLLIN },
+		{ .fd = inotify_fd, .events = POLLIN },	/* ignored if -1 */
+		{ .fd = rules_fd, .events = POLLIN },	/* drained by check_rules */
+		{ .fd = mirror_fd[0], .events = POLLIN }, /* check_mirrors */
+	};
+	now_tv(&last_stats);
+	now_tv(&last_thumbs);
+
+	if (replaying)
+		replay();
 
 	while (1) {
-		int timeout_ms = (hover_window != XCB_WINDOW_NONE &&
-				  tooltip_window == XCB_WINDOW_NONE) ? 500 : -1;
-		if (notify_flashing_count > 0 &&
-		    (timeout_ms < 0 || timeout_ms > 200))
-			timeout_ms = 200;
-		poll(&pfd, 1, timeout_ms);
+		poll(pfd, 4, loop_timeout_ms());
+		if (quit_requested)
+			break;
+		struct timeval pass_start;
+		now_tv(&pass_start);
+		collect_frames();
+
+		if (pfd[1].revents & POLLIN)
+			check_config_watch();
 
 		while ((e = xcb_poll_for_event(c))) {
 			deb("got event, response_type %d\n", e->response_type);
+			if (recording)
+				rec_put(&rec, REC_EVENT, NULL, e, event_size(e));
 			handle_event(e);
 			free(e);
 		}
 		if (xcb_connection_has_error(c))
 			break;
 
-		/* check hover timeout */
-		if (hover_window != XCB_WINDOW_NONE &&
-		    tooltip_window == XCB_WINDOW_NONE) {
-			struct timeval now;
-			gettimeofday(&now, NULL);
-			long elapsed_ms = (now.tv_sec - hover_start.tv_sec) * 1000 +
-				(now.tv_usec - hover_start.tv_usec) / 1000;
-			if (elapsed_ms >= 3000)
-				show_tooltip(hover_x, hover_y);
-		}
-
-		if (notify_flashing_count > 0)
-			update_notify_borders();
-
-		xcb_flush(c);
+		int stats = stats_requested;
+		stats_requested = 0;
+		if (recording)
+			rec_put(&rec, REC_PASS, NULL, &stats, sizeof(stats));
+		end_pass(&pass_start, stats);
+		if (recording)
+			flush_recording();
 	}
 
 	return EXIT_SUCCESS;
@@ -0,0 +1,196 @@
+/*
+ * slab pools and interned strings
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "pool.h"
+
+void
+pool_init(pool_t *p, size_t size, int per_slab)
+{
+	memset(p, 0, sizeof(*p));
+	/* room for the free list link, keep pointer alignment */
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+	p->size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+	p->per_slab = per_slab;
+}
+
+static void
+pool_grow(pool_t *p)
+{
+	char *slab = malloc(p->size * p->per_slab);
+	void **slabs = realloc(p->slabs, (p->nslabs + 1) * sizeof(void *));
+
+	if (!slab || !slabs)
+		abort();
+	p->slabs = slabs;
+	p->slabs[p->nslabs++] = slab;
+	for (int i = p->per_slab - 1; i >= 0; i--) {
+		void **obj = (void **)(slab + i * p->size);
+		*obj = p->free;
+		p->free = obj;
+	}
+}
+
+void *
+pool_get(pool_t *p)
+{
+	void **obj;
+
+	if (!p->free)
+		pool_grow(p);
+	obj = p->free;
+	p->free = *obj;
+	memset(obj, 0, p->size);
+	p->live++;
+	return obj;
+}
+
+void
+pool_put(pool_t *p, void *obj)
+{
+	if (!obj)
+		return;
+	*(void **)obj = p->free;
+	p->free = obj;
+	p->live--;
+}
+
+void
+pool_destroy(pool_t *p)
+{
+	for (int i = 0; i < p->nslabs; i++)
+		free(p->slabs[i]);
+	free(p->slabs);
+	memset(p, 0, sizeof(*p));
+}
+
+typedef struct istr {
+	struct istr *next;
+	uint32_t hash;
+	int refs;
+	char s[];
+} istr_t;
+
+static istr_t **str_tab;
+static int str_nbuckets;
+static int str_n;
+
+static uint32_t
+str_hash(const char *s)
+{
+	uint32_t h = 2166136261u;	/* FNV-1a */
+
+	while (*s)
+		h = (h ^ (uint8_t)*s++) * 16777619u;
+	return h;
+}
+
+static istr_t *
+str_entry(const char *s)
+{
+	return (istr_t *)(s - offsetof(istr_t, s));
+}
+
+static void
+str_rehash(int nbuckets)
+{
+	istr_t **tab = calloc(nbuckets, sizeof(istr_t *));
+
+	if (!tab)
+		abort();
+	for (int i = 0; i < str_nbuckets; i++) {
+		istr_t *e = str_tab[i];
+		while (e) {
+			istr_t *next = e->next;
+			e->next = tab[e->hash & (nbuckets - 1)];
+			tab[e->hash & (nbuckets - 1)] = e;
+			e = next;
+		}
+	}
+	free(str_tab);
+	str_tab = tab;
+	str_nbuckets = nbuckets;
+}
+
+static istr_t *
+str_lookup(const char *s, uint32_t h)
+{
+	if (!str_nbuckets)
+		return NULL;
+	for (istr_t *e = str_tab[h & (str_nbuckets - 1)]; e; e = e->next)
+		if (e->hash == h && strcmp(e->s, s) == 0)
+			return e;
+	return NULL;
+}
+
+const char *
+str_intern(const char *s)
+{
+	uint32_t h = str_hash(s);
+	istr_t *e = str_lookup(s, h);
+	size_t len;
+
+	if (e) {
+		e->refs++;
+		return e->s;
+	}
+	if (str_n >= str_nbuckets)
+		str_rehash(str_nbuckets ? str_nbuckets * 2 : 64);
+	len = strlen(s);
+	e = malloc(sizeof(*e) + len + 1);
+	if (!e)
+		abort();
+	e->hash = h;
+	e->refs = 1;
+	memcpy(e->s, s, len + 1);
+	e->next = str_tab[h & (str_nbuckets - 1)];
+	str_tab[h & (str_nbuckets - 1)] = e;
+	str_n++;
+	return e->s;
+}
+
+/*
+ * the interned copy of s without taking a reference, or NULL
+ */
+const char *
+str_find(const char *s)
+{
+	istr_t *e = str_lookup(s, str_hash(s));
+
+	return e ? e->s : NULL;
+}
+
+const char *
+str_ref(const char *s)
+{
+	str_entry(s)->refs++;
+	return s;
+}
+
+void
+str_unref(const char *s)
+{
+	istr_t *e, **pp;
+
+	if (!s)
+		return;
+	e = str_entry(s);
+	if (--e->refs > 0)
+		return;
+	pp = &str_tab[e->hash & (str_nbuckets - 1)];
+	while (*pp != e)
+		pp = &(*pp)->next;
+	*pp = e->next;
+	str_n--;
+	free(e);
+}
+
+int
+str_count(void)
+{
+	return str_n;
+}
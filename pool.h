@@ -0,0 +1,34 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+/*
+ * fixed size object pool: objects are carved out of slabs and go back
+ * to a free list when released, so churn reuses the same memory.
+ */
+typedef struct {
+	size_t size;
+	int per_slab;
+	void *free;
+	void **slabs;
+	int nslabs;
+	int live;	/* objects handed out */
+} pool_t;
+
+void pool_init(pool_t *p, size_t size, int per_slab);
+void *pool_get(pool_t *p);
+void pool_put(pool_t *p, void *obj);
+void pool_destroy(pool_t *p);
+
+/*
+ * interned, refcounted strings: equal strings share one copy, so
+ * interned names can be compared by pointer. Not thread safe.
+ */
+const char *str_intern(const char *s);
+const char *str_find(const char *s);
+const char *str_ref(const char *s);
+void str_unref(const char *s);
+int str_count(void);
+
+#endif
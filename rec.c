@@ -0,0 +1,146 @@
+/*
+ * session recording file
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "rec.h"
+
+int
+rec_create(rec_t *r, const char *path)
+{
+	memset(r, 0, sizeof(*r));
+	r->f = fopen(path, "w");
+	if (!r->f || fwrite(REC_MAGIC, 8, 1, r->f) != 1) {
+		snprintf(r->err, sizeof(r->err), "%s: %s", path,
+			strerror(errno));
+		if (r->f)
+			fclose(r->f);
+		r->f = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * data NULL records REC_NONE. Write errors only show up as a short
+ * recording, the session goes on.
+ */
+void
+rec_put(rec_t *r, int tag, const char *name, const void *data,
+	uint32_t len)
+{
+	uint8_t hdr[6];
+	size_t name_len = name ? strlen(name) : 0;
+
+	if (name_len > 255)
+		name_len = 255;
+	if (!data)
+		len = REC_NONE;
+	hdr[0] = tag;
+	hdr[1] = name_len;
+	memcpy(hdr + 2, &len, 4);
+	fwrite(hdr, sizeof(hdr), 1, r->f);
+	fwrite(name, 1, name_len, r->f);
+	if (data)
+		fwrite(data, 1, len, r->f);
+	r->count++;
+}
+
+int
+rec_open(rec_t *r, const char *path)
+{
+	char magic[8];
+
+	memset(r, 0, sizeof(*r));
+	r->f = fopen(path, "r");
+	if (!r->f) {
+		snprintf(r->err, sizeof(r->err), "%s: %s", path,
+			strerror(errno));
+		return -1;
+	}
+	if (fread(magic, 8, 1, r->f) != 1 ||
+	    memcmp(magic, REC_MAGIC, 8) != 0) {
+		snprintf(r->err, sizeof(r->err), "%s: not a recording", path);
+		fclose(r->f);
+		r->f = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * tag of the next record, -1 at the end
+ */
+int
+rec_peek(rec_t *r)
+{
+	int ch;
+
+	if (r->next)
+		return r->next;
+	ch = getc(r->f);
+	if (ch == EOF)
+		return -1;
+	r->next = ch;
+	return ch;
+}
+
+/*
+ * read the next record, which has to be tag/name. data is malloced
+ * and NULL for REC_NONE. Returns -1 with a message in err when the
+ * record is something else or the file ends.
+ */
+int
+rec_get(rec_t *r, int tag, const char *name, void **data, uint32_t *len)
+{
+	uint8_t hdr[5];
+	char got[256];
+	int got_tag = rec_peek(r);
+
+	*data = NULL;
+	*len = 0;
+	r->next = 0;
+	if (got_tag < 0) {
+		snprintf(r->err, sizeof(r->err), "record %ld: end of file, "
+			"expected %c %s", r->count, tag, name ? name : "");
+		return -1;
+	}
+	if (fread(hdr, sizeof(hdr), 1, r->f) != 1 ||
+	    fread(got, 1, hdr[0], r->f) != hdr[0])
+		goto truncated;
+	got[hdr[0]] = '\0';
+	if (got_tag != tag || strcmp(got, name ? name : "") != 0) {
+		snprintf(r->err, sizeof(r->err), "record %ld: found %c %s, "
+			"expected %c %s", r->count, got_tag, got, tag,
+			name ? name : "");
+		return -1;
+	}
+	memcpy(len, hdr + 1, 4);
+	if (*len != REC_NONE) {
+		/* one spare byte, so files can be used as strings */
+		*data = malloc(*len + 1);
+		if (!*data || fread(*data, 1, *len, r->f) != *len) {
+			free(*data);
+			*data = NULL;
+			goto truncated;
+		}
+		((char *)*data)[*len] = '\0';
+	}
+	r->count++;
+	return 0;
+
+truncated:
+	snprintf(r->err, sizeof(r->err), "record %ld: truncated", r->count);
+	return -1;
+}
+
+void
+rec_close(rec_t *r)
+{
+	if (r->f)
+		fclose(r->f);
+	r->f = NULL;
+}
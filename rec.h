@@ -0,0 +1,47 @@
+#ifndef REC_H
+#define REC_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*
+ * session recordings: everything from the X server that steered the
+ * event handlers, so a session can be run again without a display.
+ * After the magic come records of a tag byte, a name length byte, a
+ * 32 bit data length, the name and the data, all in host byte order;
+ * a recording only replays on the kind of machine it was made on.
+ * REC_NONE as length stands for a missing reply or file.
+ */
+#define REC_MAGIC "STTREC01"
+#define REC_NONE UINT32_MAX
+
+enum {
+	REC_OPTIONS = 'O',	/* command line settings that change behavior */
+	REC_SETUP = 'S',	/* connection setup from the server */
+	REC_EVENT = 'E',	/* an event, as xcb handed it out */
+	REC_REPLY = 'R',	/* reply to a round trip, named by its function */
+	REC_POLL = 'F',		/* whether a polled reply was there */
+	REC_TIME = 'T',		/* a clock reading */
+	REC_FILE = 'C',		/* a file read: config, state */
+	REC_PASS = 'P',		/* end of a main loop pass */
+};
+
+typedef struct {
+	FILE *f;
+	long count;		/* records read or written */
+	int next;		/* tag of a peeked record, 0 if none */
+	char err[640];
+} rec_t;
+
+int rec_create(rec_t *r, const char *path);
+void rec_put(rec_t *r, int tag, const char *name, const void *data,
+	uint32_t len);
+
+int rec_open(rec_t *r, const char *path);
+int rec_peek(rec_t *r);
+int rec_get(rec_t *r, int tag, const char *name, void **data,
+	uint32_t *len);
+
+void rec_close(rec_t *r);
+
+#endif
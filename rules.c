@@ -0,0 +1,724 @@
+/*
+ * pixel trigger rules: parsing, kernels and the worker threads
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <yaml.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "rules.h"
+
+#define DEFAULT_TOLERANCE 16
+
+/*
+ * binary PPM, maxval 255, as written by the snapshot key
+ */
+static int
+ppm_int(FILE *f)
+{
+	int ch, n = 0, digits = 0;
+
+	while ((ch = getc(f)) != EOF) {
+		if (ch == '#') {
+			while ((ch = getc(f)) != EOF && ch != '\n')
+				;
+		} else if (!isspace(ch)) {
+			break;
+		}
+	}
+	while (ch != EOF && isdigit(ch) && n < 100000) {
+		n = n * 10 + ch - '0';
+		digits++;
+		ch = getc(f);
+	}
+	/* ch is the single whitespace after the number */
+	return digits && ch != EOF && isspace(ch) ? n : -1;
+}
+
+static uint8_t *
+load_ppm(const char *path, int *w, int *h, char *err, int errlen)
+{
+	FILE *f = fopen(path, "rb");
+	uint8_t *rgb = NULL;
+	char magic[2];
+	int maxval;
+
+	if (!f) {
+		snprintf(err, errlen, "%s: %s", path, strerror(errno));
+		return NULL;
+	}
+	if (fread(magic, 2, 1, f) != 1 || memcmp(magic, "P6", 2) != 0 ||
+	    (*w = ppm_int(f)) <= 0 || (*h = ppm_int(f)) <= 0 ||
+	    (maxval = ppm_int(f)) != 255) {
+		snprintf(err, errlen, "%s: not a binary PPM with 8 bit "
+			"channels", path);
+		goto out;
+	}
+	rgb = malloc((size_t)*w * *h * 3);
+	if (!rgb || fread(rgb, 3, (size_t)*w * *h, f) != (size_t)*w * *h) {
+		snprintf(err, errlen, "%s: truncated", path);
+		free(rgb);
+		rgb = NULL;
+	}
+out:
+	fclose(f);
+	return rgb;
+}
+
+/*
+ * store value under key in r, 0 on success. Relative image paths are
+ * taken from dir.
+ */
+static int
+rule_set(rule_t *r, const char *dir, const char *key, const char *value,
+	char *err, int errlen)
+{
+	char path[1024], extra;
+	unsigned rgb;
+	int n;
+
+	if (strcmp(key, "snip") == 0) {
+		if (strlen(value) >= sizeof(r->snip)) {
+			snprintf(err, errlen, "snip: too long");
+			return -1;
+		}
+		strcpy(r->snip, value);
+		return 0;
+	}
+	if (strcmp(key, "region") == 0) {
+		if (sscanf(value, "%d %d %d %d %c", &r->x, &r->y, &r->w,
+				&r->h, &extra) != 4 ||
+		    r->x < 0 || r->y < 0 || r->w < 1 || r->h < 1) {
+			snprintf(err, errlen, "region: \"%s\" is not "
+				"\"x y width height\"", value);
+			return -1;
+		}
+		return 0;
+	}
+	if (strcmp(key, "color") == 0) {
+		if (strlen(value) != 6 || sscanf(value, "%6x%c", &rgb,
+				&extra) != 1) {
+			snprintf(err, errlen, "color: \"%s\" is not rrggbb",
+				value);
+			return -1;
+		}
+		r->kind = RULE_COLOR;
+		r->rgb[0] = rgb >> 16;
+		r->rgb[1] = rgb >> 8;
+		r->rgb[2] = rgb;
+		return 0;
+	}
+	if (strcmp(key, "match") == 0) {
+		if (value[0] == '/' || !dir)
+			snprintf(path, sizeof(path), "%s", value);
+		else
+			snprintf(path, sizeof(path), "%s/%s", dir, value);
+		free(r->ref);
+		r->ref = load_ppm(path, &r->ref_w, &r->ref_h, err, errlen);
+		if (!r->ref)
+			return -1;
+		r->kind = RULE_MATCH;
+		return 0;
+	}
+
+	int *ip = NULL, min = 0, max = 255;
+	if (strcmp(key, "brightness_above") == 0) {
+		r->kind = RULE_BRIGHTER;
+		ip = &r->level;
+	} else if (strcmp(key, "brightness_below") == 0) {
+		r->kind = RULE_DARKER;
+		ip = &r->level;
+	} else if (strcmp(key, "tolerance") == 0) {
+		ip = &r->tolerance;
+	} else if (strcmp(key, "percent") == 0) {
+		ip = &r->percent;
+		min = 1;
+		max = 100;
+	} else {
+		snprintf(err, errlen, "unknown key \"%s\"", key);
+		return -1;
+	}
+	if (sscanf(value, "%d%c", &n, &extra) != 1 || n < min || n > max) {
+		snprintf(err, errlen, "%s: \"%s\" is not a number from %d "
+			"to %d", key, value, min, max);
+		return -1;
+	}
+	*ip = n;
+	return 0;
+}
+
+static int
+is_kind(const char *key)
+{
+	return strcmp(key, "color") == 0 ||
+		strcmp(key, "brightness_above") == 0 ||
+		strcmp(key, "brightness_below") == 0 ||
+		strcmp(key, "match") == 0;
+}
+
+/*
+ * end of a rule mapping: one kind, a snip, region and defaults
+ */
+static int
+rule_finish(rule_t *r, int nkinds, char *err, int errlen)
+{
+	if (!r->snip[0]) {
+		snprintf(err, errlen, "rule without snip");
+		return -1;
+	}
+	if (nkinds != 1) {
+		snprintf(err, errlen, "rule needs one of color, "
+			"brightness_above, brightness_below, match");
+		return -1;
+	}
+	if (r->tolerance < 0)
+		r->tolerance = DEFAULT_TOLERANCE;
+	if (r->percent < 0)
+		r->percent = r->kind == RULE_MATCH ? 100 : 50;
+	if (r->kind == RULE_MATCH) {
+		if (!r->w) {
+			r->w = r->ref_w;
+			r->h = r->ref_h;
+		} else if (r->w != r->ref_w || r->h != r->ref_h) {
+			snprintf(err, errlen, "region is %dx%d, the image "
+				"%dx%d", r->w, r->h, r->ref_w, r->ref_h);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * read the rules at path into rs, images are looked up in dir. Returns
+ * 0 on success, 1 if there is no file (no rules) and -1 with a message
+ * in err if the file is broken, leaving rs alone.
+ */
+int
+rules_load(const char *path, const char *dir, rule_set_t *rs, char *err,
+	int errlen)
+{
+	yaml_parser_t parser;
+	yaml_event_t event;
+	rule_set_t *new;
+	rule_t *r = NULL;
+	char key[64] = "", msg[1100];
+	int depth = 0, nkinds = 0, ret = 0, done = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		if (errno != ENOENT) {
+			snprintf(err, errlen, "%s: %s", path, strerror(errno));
+			return -1;
+		}
+		rules_free(rs);
+		return 1;
+	}
+	new = calloc(1, sizeof(*new));
+	if (!new) {
+		snprintf(err, errlen, "%s: out of memory", path);
+		fclose(f);
+		return -1;
+	}
+	yaml_parser_initialize(&parser);
+	yaml_parser_set_input_file(&parser, f);
+	while (!done && ret == 0) {
+		if (!yaml_parser_parse(&parser, &event)) {
+			snprintf(err, errlen, "%s:%lu: %s", path,
+				(unsigned long)parser.problem_mark.line + 1,
+				parser.problem ? parser.problem : "parse error");
+			ret = -1;
+			break;
+		}
+		int line = event.start_mark.line + 1;
+
+		msg[0] = '\0';
+		switch (event.type) {
+		case YAML_STREAM_END_EVENT:
+			done = 1;
+			break;
+		case YAML_SEQUENCE_START_EVENT:
+			if (depth++ != 0)
+				snprintf(msg, sizeof(msg), "nested lists are "
+					"not supported");
+			break;
+		case YAML_SEQUENCE_END_EVENT:
+			depth--;
+			break;
+		case YAML_MAPPING_START_EVENT:
+			if (depth++ != 1) {
+				snprintf(msg, sizeof(msg), "expected a list "
+					"of rules");
+			} else if (new->n == RULES_MAX) {
+				snprintf(msg, sizeof(msg), "more than %d "
+					"rules", RULES_MAX);
+			} else {
+				r = &new->r[new->n++];
+				r->tolerance = -1;
+				r->percent = -1;
+				nkinds = 0;
+				key[0] = '\0';
+			}
+			break;
+		case YAML_MAPPING_END_EVENT:
+			depth--;
+			rule_finish(r, nkinds, msg, sizeof(msg));
+			break;
+		case YAML_ALIAS_EVENT:
+			snprintf(msg, sizeof(msg), "aliases are not "
+				"supported");
+			break;
+		case YAML_SCALAR_EVENT: {
+			const char *s = (const char *)event.data.scalar.value;
+
+			if (depth != 2) {
+				snprintf(msg, sizeof(msg), "expected a list "
+					"of rules");
+			} else if (!key[0]) {
+				snprintf(key, sizeof(key), "%s", s);
+				if (!key[0])
+					snprintf(msg, sizeof(msg),
+						"empty key");
+			} else {
+				nkinds += is_kind(key);
+				rule_set(r, dir, key, s, msg, sizeof(msg));
+				key[0] = '\0';
+			}
+			break;
+		}
+		default:
+			break;
+		}
+		if (msg[0]) {
+			snprintf(err, errlen, "%s:%d: %s", path, line, msg);
+			ret = -1;
+		}
+		yaml_event_delete(&event);
+	}
+	yaml_parser_delete(&parser);
+	fclose(f);
+
+	if (ret < 0) {
+		rules_free(new);
+		free(new);
+		return -1;
+	}
+	rules_free(rs);
+	*rs = *new;
+	free(new);
+	return 0;
+}
+
+void
+rules_free(rule_set_t *rs)
+{
+	for (int i = 0; i < rs->n; i++)
+		free(rs->r[i].ref);
+	rs->n = 0;
+}
+
+static uint32_t
+pack_pixel(int r, int g, int b, int msb_first)
+{
+	uint8_t p[4];
+	uint32_t px;
+
+	if (msb_first) {
+		p[0] = 0;
+		p[1] = r;
+		p[2] = g;
+		p[3] = b;
+	} else {
+		p[0] = b;
+		p[1] = g;
+		p[2] = r;
+		p[3] = 0;
+	}
+	memcpy(&px, p, 4);
+	return px;
+}
+
+/*
+ * r checked at x, y, w, h of a frame. A match region is always the
+ * whole image. Returns -1 if out of memory.
+ */
+int
+rule_check_init(rule_check_t *c, const rule_t *r, int rule,
+	int x, int y, int w, int h, int msb_first)
+{
+	memset(c, 0, sizeof(*c));
+	c->kind = r->kind;
+	c->x = x;
+	c->y = y;
+	c->w = w;
+	c->h = h;
+	c->level = r->level;
+	c->tolerance = r->tolerance;
+	c->percent = r->percent;
+	c->rule = rule;
+	if (r->kind == RULE_COLOR) {
+		c->ref = malloc(w * sizeof(uint32_t));
+		if (!c->ref)
+			return -1;
+		for (int i = 0; i < w; i++)
+			c->ref[i] = pack_pixel(r->rgb[0], r->rgb[1],
+				r->rgb[2], msb_first);
+	} else if (r->kind == RULE_MATCH) {
+		const uint8_t *p = r->ref;
+
+		c->ref = malloc((size_t)w * h * sizeof(uint32_t));
+		if (!c->ref)
+			return -1;
+		for (long i = 0; i < (long)w * h; i++, p += 3)
+			c->ref[i] = pack_pixel(p[0], p[1], p[2], msb_first);
+		c->ref_stride = w;
+	}
+	return 0;
+}
+
+void
+rule_job_free(rule_job_t *j)
+{
+	for (int k = 0; k < j->n; k++)
+		free(j->c[k].ref);
+	free(j->f.data);
+	free(j);
+}
+
+long
+px_near_scalar(const uint32_t *a, const uint32_t *b, int n, int tol,
+	uint32_t mask)
+{
+	long near = 0;
+
+	for (int i = 0; i < n; i++) {
+		uint32_t pa = a[i], pb = b[i];
+		int ok = 1;
+
+		for (int k = 0; k < 32; k += 8) {
+			int da = pa >> k & 0xff, db = pb >> k & 0xff;
+			if ((mask >> k & 0xff) && abs(da - db) > tol)
+				ok = 0;
+		}
+		near += ok;
+	}
+	return near;
+}
+
+void
+px_sum_scalar(const uint32_t *a, int n, uint64_t sum[4])
+{
+	for (int i = 0; i < n; i++) {
+		const uint8_t *p = (const uint8_t *)(a + i);
+		sum[0] += p[0];
+		sum[1] += p[1];
+		sum[2] += p[2];
+		sum[3] += p[3];
+	}
+}
+
+#ifdef __SSE2__
+long
+px_near_sse2(const uint32_t *a, const uint32_t *b, int n, int tol,
+	uint32_t mask)
+{
+	__m128i vtol = _mm_set1_epi8((char)(tol > 255 ? 255 : tol));
+	__m128i vmask = _mm_set1_epi32(mask);
+	__m128i zero = _mm_setzero_si128();
+	long near = 0;
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+		/* |a - b| per byte, then what is left over tol */
+		__m128i d = _mm_or_si128(_mm_subs_epu8(va, vb),
+			_mm_subs_epu8(vb, va));
+		d = _mm_and_si128(_mm_subs_epu8(d, vtol), vmask);
+		near += __builtin_popcount(_mm_movemask_ps(
+			_mm_castsi128_ps(_mm_cmpeq_epi32(d, zero))));
+	}
+	return near + px_near_scalar(a + i, b + i, n - i, tol, mask);
+}
+
+void
+px_sum_sse2(const uint32_t *a, int n, uint64_t sum[4])
+{
+	__m128i acc[4], zero = _mm_setzero_si128();
+	uint64_t part[2];
+	int i;
+
+	for (int k = 0; k < 4; k++)
+		acc[k] = zero;
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+		/* one byte position at a time, added up by psadbw */
+		for (int k = 0; k < 4; k++)
+			acc[k] = _mm_add_epi64(acc[k], _mm_sad_epu8(
+				_mm_and_si128(va, _mm_set1_epi32(0xffu << 8 * k)),
+				zero));
+	}
+	/* x86 is little endian, bits 8k are byte k */
+	for (int k = 0; k < 4; k++) {
+		_mm_storeu_si128((__m128i *)part, acc[k]);
+		sum[k] += part[0] + part[1];
+	}
+	px_sum_scalar(a + i, n - i, sum);
+}
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+long
+px_near_avx2(const uint32_t *a, const uint32_t *b, int n, int tol,
+	uint32_t mask)
+{
+	__m256i vtol = _mm256_set1_epi8((char)(tol > 255 ? 255 : tol));
+	__m256i vmask = _mm256_set1_epi32(mask);
+	__m256i zero = _mm256_setzero_si256();
+	long near = 0;
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i *)(b + i));
+		__m256i d = _mm256_or_si256(_mm256_subs_epu8(va, vb),
+			_mm256_subs_epu8(vb, va));
+		d = _mm256_and_si256(_mm256_subs_epu8(d, vtol), vmask);
+		near += __builtin_popcount(_mm256_movemask_ps(
+			_mm256_castsi256_ps(_mm256_cmpeq_epi32(d, zero))));
+	}
+	return near + px_near_scalar(a + i, b + i, n - i, tol, mask);
+}
+
+__attribute__((target("avx2")))
+void
+px_sum_avx2(const uint32_t *a, int n, uint64_t sum[4])
+{
+	/* bytes of 4 pixels grouped by position, 4 zeros after each */
+	const __m256i lo = _mm256_setr_epi8(
+		0, 4, 8, 12, -1, -1, -1, -1, 1, 5, 9, 13, -1, -1, -1, -1,
+		0, 4, 8, 12, -1, -1, -1, -1, 1, 5, 9, 13, -1, -1, -1, -1);
+	const __m256i hi = _mm256_setr_epi8(
+		2, 6, 10, 14, -1, -1, -1, -1, 3, 7, 11, 15, -1, -1, -1, -1,
+		2, 6, 10, 14, -1, -1, -1, -1, 3, 7, 11, 15, -1, -1, -1, -1);
+	__m256i zero = _mm256_setzero_si256();
+	__m256i acc01 = zero, acc23 = zero;
+	uint64_t part[4];
+	int i;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m256i va = _mm256_loadu_si256((const __m256i *)(a + i));
+		acc01 = _mm256_add_epi64(acc01, _mm256_sad_epu8(
+			_mm256_shuffle_epi8(va, lo), zero));
+		acc23 = _mm256_add_epi64(acc23, _mm256_sad_epu8(
+			_mm256_shuffle_epi8(va, hi), zero));
+	}
+	_mm256_storeu_si256((__m256i *)part, acc01);
+	sum[0] += part[0] + part[2];
+	sum[1] += part[1] + part[3];
+	_mm256_storeu_si256((__m256i *)part, acc23);
+	sum[2] += part[0] + part[2];
+	sum[3] += part[1] + part[3];
+	px_sum_scalar(a + i, n - i, sum);
+}
+#endif
+
+void
+px_kernels_best(px_near_fn *near, px_sum_fn *sum, const char **name)
+{
+	const char *dummy;
+
+	if (!name)
+		name = &dummy;
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2")) {
+		*name = "avx2";
+		*near = px_near_avx2;
+		*sum = px_sum_avx2;
+		return;
+	}
+#endif
+#ifdef __SSE2__
+	*name = "sse2";
+	*near = px_near_sse2;
+	*sum = px_sum_sse2;
+#else
+	*name = "scalar";
+	*near = px_near_scalar;
+	*sum = px_sum_scalar;
+#endif
+}
+
+static px_near_fn near_fn;
+static px_sum_fn sum_fn;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+
+static void
+pick_kernels(void)
+{
+	px_kernels_best(&near_fn, &sum_fn, NULL);
+}
+
+/*
+ * set bit k of j->hits for each true check k
+ */
+void
+rules_eval(rule_job_t *j)
+{
+	const frame_t *f = &j->f;
+	static const uint8_t lsb[4] = { 0xff, 0xff, 0xff, 0 };
+	static const uint8_t msb[4] = { 0, 0xff, 0xff, 0xff };
+	uint32_t mask;
+
+	pthread_once(&kernels_once, pick_kernels);
+	memcpy(&mask, f->msb_first ? msb : lsb, 4);
+	j->hits = 0;
+	for (int k = 0; k < j->n; k++) {
+		const rule_check_t *c = &j->c[k];
+		const uint8_t *base = f->data + (long)c->y * f->stride +
+			c->x * 4;
+		long npx = (long)c->w * c->h;
+		int hit;
+
+		if (c->kind == RULE_BRIGHTER || c->kind == RULE_DARKER) {
+			uint64_t s[4] = { 0 };
+			int ri = f->msb_first ? 1 : 2;
+			int gi = f->msb_first ? 2 : 1;
+			int bi = f->msb_first ? 3 : 0;
+
+			for (int y = 0; y < c->h; y++)
+				sum_fn((const uint32_t *)(base +
+					(long)y * f->stride), c->w, s);
+			/* BT.601 luma of the mean color */
+			long luma = (77 * s[ri] + 150 * s[gi] + 29 * s[bi]) /
+				(256 * npx);
+			hit = c->kind == RULE_BRIGHTER ? luma > c->level :
+				luma < c->level;
+		} else {
+			long near = 0;
+
+			for (int y = 0; y < c->h; y++)
+				near += near_fn((const uint32_t *)(base +
+					(long)y * f->stride),
+					c->ref + (long)y * c->ref_stride,
+					c->w, c->tolerance, mask);
+			hit = near * 100 >= (long)c->percent * npx;
+		}
+		if (hit)
+			j->hits |= 1ULL << k;
+	}
+}
+
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_cond = PTHREAD_COND_INITIALIZER;
+static rule_job_t *todo_head, *todo_tail, *done;
+static int nworkers;
+static int wake_fd[2] = { -1, -1 };
+static int wake_errno;		/* a write to wake_fd that failed */
+
+static void *
+worker_thread(void *arg)
+{
+	pthread_mutex_lock(&jobs_lock);
+	while (1) {
+		while (!todo_head)
+			pthread_cond_wait(&jobs_cond, &jobs_lock);
+		rule_job_t *j = todo_head;
+		todo_head = j->next;
+		if (!todo_head)
+			todo_tail = NULL;
+		pthread_mutex_unlock(&jobs_lock);
+
+		rules_eval(j);
+
+		pthread_mutex_lock(&jobs_lock);
+		j->next = done;
+		done = j;
+		/* a full pipe already wakes the main loop */
+		if (write(wake_fd[1], "", 1) < 0 && errno != EAGAIN &&
+		    !wake_errno)
+			wake_errno = errno;
+	}
+	return NULL;
+}
+
+int
+rules_start(int nthreads)
+{
+	pthread_t th;
+
+	if (nthreads <= 0 || pipe(wake_fd) < 0)
+		return -1;
+	for (int k = 0; k < 2; k++) {
+		fcntl(wake_fd[k], F_SETFL, O_NONBLOCK);
+		fcntl(wake_fd[k], F_SETFD, FD_CLOEXEC);
+	}
+	for (int i = 0; i < nthreads; i++) {
+		if (pthread_create(&th, NULL, worker_thread, NULL) != 0)
+			break;
+		pthread_detach(th);
+		nworkers++;
+	}
+	if (!nworkers) {
+		close(wake_fd[0]);
+		close(wake_fd[1]);
+		wake_fd[0] = wake_fd[1] = -1;
+	}
+	return wake_fd[0];
+}
+
+void
+rules_submit(rule_job_t *j)
+{
+	pthread_mutex_lock(&jobs_lock);
+	if (!nworkers) {
+		pthread_mutex_unlock(&jobs_lock);
+		rules_eval(j);
+		pthread_mutex_lock(&jobs_lock);
+		j->next = done;
+		done = j;
+	} else {
+		j->next = NULL;
+		if (todo_tail)
+			todo_tail->next = j;
+		else
+			todo_head = j;
+		todo_tail = j;
+		pthread_cond_signal(&jobs_cond);
+	}
+	pthread_mutex_unlock(&jobs_lock);
+}
+
+/*
+ * the jobs done since the last call, most recent first. *err is the
+ * errno of a failed wakeup, the caller can't rely on the descriptor
+ * after that
+ */
+rule_job_t *
+rules_collect(int *err)
+{
+	rule_job_t *list;
+	char buf[64];
+
+	pthread_mutex_lock(&jobs_lock);
+	if (wake_fd[0] >= 0)
+		while (read(wake_fd[0], buf, sizeof(buf)) > 0)
+			;
+	list = done;
+	done = NULL;
+	*err = wake_errno;
+	pthread_mutex_unlock(&jobs_lock);
+	return list;
+}
@@ -0,0 +1,114 @@
+#ifndef RULES_H
+#define RULES_H
+
+#include <stdint.h>
+
+#include "frames.h"
+
+/*
+ * pixel trigger rules from ~/.config/sniptotop/rules.yaml, a list of
+ * mappings. A rule applies to the snips of the window named by "snip"
+ * and looks at a region of their capture area (all of it by default):
+ *
+ *   color: rrggbb           percent of the region is this color
+ *   brightness_above: N     mean luma (0-255) is above N
+ *   brightness_below: N     ... below N
+ *   match: FILE.ppm         the region looks like the image, percent
+ *                           of its pixels within tolerance; relative
+ *                           to the dir passed to rules_load
+ *
+ * tolerance is per channel. Snips in notify mode that have rules flash
+ * when one of them turns true, instead of on every change.
+ */
+#define RULES_MAX 64
+
+enum { RULE_COLOR, RULE_BRIGHTER, RULE_DARKER, RULE_MATCH };
+
+typedef struct {
+	char snip[256];
+	int kind;
+	int x;			/* region in the capture area, */
+	int y;			/* w 0: all of it */
+	int w;
+	int h;
+	uint8_t rgb[3];		/* color */
+	int level;		/* brightness */
+	int tolerance;
+	int percent;
+	int ref_w;		/* match */
+	int ref_h;
+	uint8_t *ref;		/* RGB rows */
+} rule_t;
+
+typedef struct {
+	int n;
+	rule_t r[RULES_MAX];
+} rule_set_t;
+
+int rules_load(const char *path, const char *dir, rule_set_t *rs,
+	char *err, int errlen);
+void rules_free(rule_set_t *rs);
+
+/*
+ * one rule against a region of a job's frame. The reference pixels
+ * are in the frame's byte order, ref_stride 0 repeats one row (color).
+ */
+typedef struct {
+	int kind;
+	int x;
+	int y;
+	int w;
+	int h;
+	int level;
+	int tolerance;
+	int percent;
+	uint32_t *ref;
+	int ref_stride;
+	int rule;		/* index in the rule set */
+} rule_check_t;
+
+/* a frame and the checks of one view, evaluated off the main loop */
+typedef struct rule_job {
+	unsigned seq;
+	frame_t f;
+	int n;
+	rule_check_t c[RULES_MAX];
+	uint64_t hits;		/* bit k: check k is true */
+	struct rule_job *next;
+} rule_job_t;
+
+int rule_check_init(rule_check_t *c, const rule_t *r, int rule,
+	int x, int y, int w, int h, int msb_first);
+void rule_job_free(rule_job_t *j);
+void rules_eval(rule_job_t *j);
+
+/*
+ * worker threads: returns a descriptor that turns readable when jobs
+ * are done, -1 if jobs run in rules_submit itself
+ */
+int rules_start(int nthreads);
+void rules_submit(rule_job_t *j);
+rule_job_t *rules_collect(int *err);
+
+/* kernels: pixels whose bytes in mask are all within tol of b's */
+typedef long (*px_near_fn)(const uint32_t *a, const uint32_t *b, int n,
+	int tol, uint32_t mask);
+/* sum of each byte position */
+typedef void (*px_sum_fn)(const uint32_t *a, int n, uint64_t sum[4]);
+
+long px_near_scalar(const uint32_t *a, const uint32_t *b, int n, int tol,
+	uint32_t mask);
+void px_sum_scalar(const uint32_t *a, int n, uint64_t sum[4]);
+#ifdef __SSE2__
+long px_near_sse2(const uint32_t *a, const uint32_t *b, int n, int tol,
+	uint32_t mask);
+void px_sum_sse2(const uint32_t *a, int n, uint64_t sum[4]);
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+long px_near_avx2(const uint32_t *a, const uint32_t *b, int n, int tol,
+	uint32_t mask);
+void px_sum_avx2(const uint32_t *a, int n, uint64_t sum[4]);
+#endif
+void px_kernels_best(px_near_fn *near, px_sum_fn *sum, const char **name);
+
+#endif
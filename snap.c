@@ -0,0 +1,84 @@
+/*
+ * snapping a moved view to the screen edges and to other views
+ */
+#include <stdlib.h>
+
+#include "snap.h"
+
+int snap_distance = 1;
+
+/*
+ * move the w x h rectangle at *x,*y onto screen and view edges within
+ * snap_distance pixels. Returns SNAP_X and/or SNAP_Y for the axes that
+ * snapped.
+ */
+int
+snap_rect(int *x, int *y, int w, int h, int sw, int sh,
+	const snap_rect_t *others, int n)
+{
+	int new_x = *x, new_y = *y;
+	int snapped_x = 0, snapped_y = 0;
+	int d = snap_distance;
+
+	/* Snap to screen edges */
+	if (abs(new_x) <= d) { new_x = 0; snapped_x = 1; }
+	if (abs(new_y) <= d) { new_y = 0; snapped_y = 1; }
+	if (abs(new_x + w - sw) <= d) { new_x = sw - w; snapped_x = 1; }
+	if (abs(new_y + h - sh) <= d) { new_y = sh - h; snapped_y = 1; }
+
+	/* Snap to other view windows */
+	for (int i = 0; i < n; i++) {
+		int ox = others[i].x;
+		int oy = others[i].y;
+		int ow = others[i].w;
+		int oh = others[i].h;
+
+		/* Check vertical overlap for left/right snapping */
+		int v_overlap = (new_y < oy + oh) &&
+				(new_y + h > oy);
+		if (v_overlap) {
+			/* My right edge to other's left edge */
+			if (abs(new_x + w - ox) <= d)
+				{ new_x = ox - w; snapped_x = 1; }
+			/* My left edge to other's right edge */
+			if (abs(new_x - (ox + ow)) <= d)
+				{ new_x = ox + ow; snapped_x = 1; }
+		}
+
+		/* Check horizontal overlap for top/bottom snapping */
+		int h_overlap = (new_x < ox + ow) &&
+				(new_x + w > ox);
+		if (h_overlap) {
+			/* My bottom edge to other's top edge */
+			if (abs(new_y + h - oy) <= d)
+				{ new_y = oy - h; snapped_y = 1; }
+			/* My top edge to other's bottom edge */
+			if (abs(new_y - (oy + oh)) <= d)
+				{ new_y = oy + oh; snapped_y = 1; }
+		}
+
+		/* When side-by-side, align tops/bottoms */
+		int h_adj = (abs(new_x + w - ox) <= d) ||
+			    (abs(new_x - (ox + ow)) <= d);
+		if (h_adj) {
+			if (abs(new_y - oy) <= d)
+				{ new_y = oy; snapped_y = 1; }
+			if (abs(new_y + h - (oy + oh)) <= d)
+				{ new_y = oy + oh - h; snapped_y = 1; }
+		}
+
+		/* When stacked, align lefts/rights */
+		int v_adj = (abs(new_y + h - oy) <= d) ||
+			    (abs(new_y - (oy + oh)) <= d);
+		if (v_adj) {
+			if (abs(new_x - ox) <= d)
+				{ new_x = ox; snapped_x = 1; }
+			if (abs(new_x + w - (ox + ow)) <= d)
+				{ new_x = ox + ow - w; snapped_x = 1; }
+		}
+	}
+
+	*x = new_x;
+	*y = new_y;
+	return (snapped_x ? SNAP_X : 0) | (snapped_y ? SNAP_Y : 0);
+}
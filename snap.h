@@ -0,0 +1,20 @@
+#ifndef SNAP_H
+#define SNAP_H
+
+typedef struct {
+	int x;
+	int y;
+	int w;
+	int h;
+} snap_rect_t;
+
+#define SNAP_X 1
+#define SNAP_Y 2
+
+/* how close an edge has to come to snap, in pixels */
+extern int snap_distance;
+
+int snap_rect(int *x, int *y, int w, int h, int screen_w, int screen_h,
+	const snap_rect_t *others, int n);
+
+#endif
@@ -0,0 +1,91 @@
+/*
+ * state file parsing
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+
+/*
+ * parse the last nvals space separated integers of a state line.
+ * returns the length of the name in front of them, or -1 if the line
+ * doesn't end in nvals integers.
+ */
+int
+parse_state_ints(const char *line, int len, int *vals, int nvals)
+{
+	const char *p = line + len;
+
+	for (int i = nvals - 1; i >= 0; i--) {
+		const char *end;
+		char *num_end;
+
+		/* skip trailing spaces */
+		while (p > line && *(p - 1) == ' ')
+			p--;
+		end = p;
+		/* find start of number */
+		while (p > line && *(p - 1) != ' ')
+			p--;
+		if (p == end)
+			return -1;
+		vals[i] = strtol(p, &num_end, 10);
+		if (num_end != end)
+			return -1;
+	}
+	while (p > line && *(p - 1) == ' ')
+		p--;
+
+	return p - line;
+}
+
+/*
+ * the numbers each state file version has per line
+ */
+int
+parse_state_header(const char *line)
+{
+	static const int version_fields[] = { 0, 6, 7, 9, 10 };
+	int version, nfields = 0;
+	const char *p;
+
+	if (sscanf(line, "# sniptotop state %d:", &version) == 1)
+		return version >= 1 && version <= STATE_VERSION ?
+			version_fields[version] : 0;
+	if (strncmp(line, "# target_name ", 14) != 0)
+		return 0;
+	/* unversioned, the columns after the name */
+	for (p = line + 14; *p; ) {
+		while (*p == ' ')
+			p++;
+		if (!*p)
+			break;
+		nfields++;
+		while (*p && *p != ' ')
+			p++;
+	}
+	return nfields >= 6 && nfields <= STATE_NVALS ? nfields : 0;
+}
+
+/*
+ * fills STATE_NVALS values from a line of nfields numbers, the ones
+ * an older line lacks are 0. nfields 0 is a file without a header:
+ * 7 numbers, or 6 when there aren't that many. Returns the name
+ * length or -1.
+ */
+int
+parse_state_line(const char *line, int len, int nfields, int *vals)
+{
+	int name_len;
+
+	memset(vals, 0, STATE_NVALS * sizeof(int));
+	if (nfields)
+		return parse_state_ints(line, len, vals, nfields);
+	name_len = parse_state_ints(line, len, vals, 7);
+	if (name_len < 0) {
+		memset(vals, 0, STATE_NVALS * sizeof(int));
+		name_len = parse_state_ints(line, len, vals, 6);
+	}
+	return name_len;
+}
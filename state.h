@@ -0,0 +1,21 @@
+#ifndef STATE_H
+#define STATE_H
+
+/*
+ * state file lines: "name cap_x cap_y cap_w cap_h view_x view_y
+ * notify refresh fps group", the name may contain spaces. group
+ * numbers the composite a view belongs to, 0 for none. The header
+ * comment says which columns the lines after it have: since version 4
+ * it starts "# sniptotop state N:", older ones list the columns after
+ * "# target_name" (notify: 7 numbers, refresh fps: 9, group: 10).
+ * Files from before the header have 6 or 7 numbers.
+ */
+#define STATE_NVALS 10
+#define STATE_VERSION 4
+
+/* numbers per line after this header line, 0 if it is none */
+int parse_state_header(const char *line);
+int parse_state_ints(const char *line, int len, int *vals, int nvals);
+int parse_state_line(const char *line, int len, int nfields, int *vals);
+
+#endif
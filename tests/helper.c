@@ -4,6 +4,11 @@
  * Creates a 200x200 window at 400,300 filled with a solid color.
  * Prints the window ID to stdout on startup.
  *
+ * Options:
+ *   -t title  window title (default sniptotop-test-target)
+ *   -p x,y    window position
+ *   -d ms     damage a random rectangle every ms milliseconds
+ *
  * Signals:
  *   SIGUSR1 - cycle fill color (red -> blue -> green -> red)
  *   SIGUSR2 - destroy window and exit
@@ -31,6 +36,17 @@ static int color_idx = 0;
 static void handle_usr1(int sig) { (void)sig; got_usr1 = 1; }
 static void handle_usr2(int sig) { (void)sig; got_usr2 = 1; }
 
+static void damage_random(void)
+{
+	uint32_t vals[1] = { (uint32_t)rand() & 0xffffff };
+	xcb_change_gc(conn, gc, XCB_GC_FOREGROUND, vals);
+	xcb_rectangle_t rect = {
+		rand() % 200, rand() % 200, 1 + rand() % 40, 1 + rand() % 40
+	};
+	xcb_poly_fill_rectangle(conn, win, gc, 1, &rect);
+	xcb_flush(conn);
+}
+
 static void fill_window(uint32_t color)
 {
 	uint32_t vals[1] = { color };
@@ -40,10 +56,37 @@ static void fill_window(uint32_t color)
 	xcb_flush(conn);
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
 	int screen_num;
 	xcb_generic_event_t *ev;
+	const char *title = "sniptotop-test-target";
+	int x = 400, y = 300;
+	int damage_ms = 0;
+	int idle_ms = 0;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "t:p:d:")) != -1) {
+		switch (opt) {
+		case 't':
+			title = optarg;
+			break;
+		case 'p':
+			if (sscanf(optarg, "%d,%d", &x, &y) != 2) {
+				fprintf(stderr, "helper: bad position\n");
+				return 1;
+			}
+			break;
+		case 'd':
+			damage_ms = atoi(optarg);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-t title] [-p x,y] "
+				"[-d ms]\n", argv[0]);
+			return 1;
+		}
+	}
+	srand(getpid());
 
 	signal(SIGUSR1, handle_usr1);
 	signal(SIGUSR2, handle_usr2);
@@ -66,12 +109,11 @@ int main(void)
 	vals[0] = colors[0];
 	vals[1] = XCB_EVENT_MASK_EXPOSURE;
 	xcb_create_window(conn, XCB_COPY_FROM_PARENT, win, scr->root,
-		400, 300, 200, 200, 0,
+		x, y, 200, 200, 0,
 		XCB_WINDOW_CLASS_INPUT_OUTPUT, XCB_COPY_FROM_PARENT,
 		mask, vals);
 
 	/* Set WM_NAME */
-	const char *title = "sniptotop-test-target";
 	xcb_change_property(conn, XCB_PROP_MODE_REPLACE, win,
 		XCB_ATOM_WM_NAME, XCB_ATOM_STRING, 8,
 		strlen(title), title);
@@ -125,6 +167,16 @@ int main(void)
 			free(ev);
 		}
 
+		if (damage_ms > 0) {
+			idle_ms += damage_ms < 50 ? damage_ms : 50;
+			if (idle_ms >= damage_ms) {
+				idle_ms = 0;
+				damage_random();
+			}
+			usleep((damage_ms < 50 ? damage_ms : 50) * 1000);
+			continue;
+		}
+
 		usleep(50000); /* 50ms poll */
 	}
 }
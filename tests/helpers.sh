@@ -39,9 +39,10 @@ setup_tmpdir() {
 	export HOME="$TEST_TMPDIR"
 }
 
-# Start the test helper window. Sets HELPER_PID and HELPER_WID.
+# Start the test helper window. Extra args passed through.
+# Sets HELPER_PID and HELPER_WID.
 start_helper() {
-	"$TEST_HELPER" &
+	"$TEST_HELPER" "$@" &
 	HELPER_PID=$!
 	# Wait for the helper window to appear
 	HELPER_WID=""
@@ -155,7 +156,8 @@ press_key() {
 	sleep 0.1
 }
 
-# Create a snippet from the helper window.
+# Create a snippet from the helper window. Optional args: the dragged
+# rectangle in helper coordinates, default 20 20 80 80.
 # Full interaction sequence:
 #   1. Move windows so they don't overlap
 #   2. Click main window (enter select mode)
@@ -201,10 +203,10 @@ create_snippet() {
 	hy=$(echo "$helper_info" | grep "Absolute upper-left Y:" | awk '{print $NF}')
 	hw=$(echo "$helper_info" | grep "Width:" | awk '{print $NF}')
 	hh=$(echo "$helper_info" | grep "Height:" | awk '{print $NF}')
-	local drag_x1=$(( hx + 20 ))
-	local drag_y1=$(( hy + 20 ))
-	local drag_x2=$(( hx + 80 ))
-	local drag_y2=$(( hy + 80 ))
+	local drag_x1=$(( hx + ${1:-20} ))
+	local drag_y1=$(( hy + ${2:-20} ))
+	local drag_x2=$(( hx + ${3:-80} ))
+	local drag_y2=$(( hy + ${4:-80} ))
 	lclick_drag "$drag_x1" "$drag_y1" "$drag_x2" "$drag_y2"
 	sleep 0.5
 
@@ -0,0 +1,111 @@
+/*
+ * Checks the vector pixel kernels in rules.c against the scalar ones:
+ * every length up to a few vectors, unaligned starts, tolerances and
+ * masks around the edges. Needs no X server.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rules.h"
+
+#define NPX 4096
+
+static uint32_t a[NPX + 1], b[NPX + 1];
+static int failures;
+
+static void
+check_near(px_near_fn fn, const char *name)
+{
+	static const int tols[] = { 0, 1, 16, 254, 255, 300 };
+	static const uint32_t masks[] = { 0, 0xff, 0xff00, 0xffffff,
+		0xff00ff00, 0xffffffff };
+
+	for (int n = 0; n <= 67; n++)
+		for (int off = 0; off < 2; off++)
+			for (int t = 0; t < 6; t++)
+				for (int m = 0; m < 6; m++) {
+					long ref = px_near_scalar(a + off, b + off,
+						n, tols[t], masks[m]);
+					long got = fn(a + off, b + off, n, tols[t],
+						masks[m]);
+					if (ref == got)
+						continue;
+					fprintf(stderr, "%s near: n %d off %d tol %d "
+						"mask %08x: %ld, scalar %ld\n", name, n,
+						off, tols[t], masks[m], got, ref);
+					failures++;
+				}
+}
+
+static void
+check_sum(px_sum_fn fn, const char *name)
+{
+	for (int n = 0; n <= NPX; n = n < 67 ? n + 1 : n * 2)
+		for (int off = 0; off < 2; off++) {
+			uint64_t ref[4] = { 1, 2, 3, 4 }, got[4] = { 1, 2, 3, 4 };
+
+			px_sum_scalar(a + off, n, ref);
+			fn(a + off, n, got);
+			if (memcmp(ref, got, sizeof(ref)) == 0)
+				continue;
+			fprintf(stderr, "%s sum: n %d off %d: %llu %llu %llu %llu, "
+				"scalar %llu %llu %llu %llu\n", name, n, off,
+				(unsigned long long)got[0], (unsigned long long)got[1],
+				(unsigned long long)got[2], (unsigned long long)got[3],
+				(unsigned long long)ref[0], (unsigned long long)ref[1],
+				(unsigned long long)ref[2], (unsigned long long)ref[3]);
+			failures++;
+		}
+}
+
+static void
+check(px_near_fn near, px_sum_fn sum, const char *name)
+{
+	check_near(near, name);
+	check_sum(sum, name);
+	printf("  %s: checked\n", name);
+}
+
+int
+main(void)
+{
+	srand(1);
+	for (int i = 0; i <= NPX; i++) {
+		a[i] = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+		/* b near a in some bytes, far in others, saturated in a few */
+		b[i] = a[i];
+		for (int k = 0; k < 32; k += 8) {
+			int v = (a[i] >> k & 0xff) + rand() % 41 - 20;
+			if (rand() % 8 == 0)
+				v = rand() % 2 ? 0 : 255;
+			v = v < 0 ? 0 : v > 255 ? 255 : v;
+			b[i] = (b[i] & ~(0xffu << k)) | (uint32_t)v << k;
+		}
+	}
+	/* a stretch of all ones for the sums */
+	for (int i = NPX / 2; i < NPX / 2 + 100; i++)
+		a[i] = 0xffffffff;
+
+#ifdef __SSE2__
+	check(px_near_sse2, px_sum_sse2, "sse2");
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		check(px_near_avx2, px_sum_avx2, "avx2");
+	else
+		printf("  avx2: not supported here, skipped\n");
+#endif
+	px_near_fn near;
+	px_sum_fn sum;
+	const char *name;
+	px_kernels_best(&near, &sum, &name);
+	check(near, sum, name);
+
+	if (failures) {
+		fprintf(stderr, "%d disagreements with scalar\n", failures);
+		return 1;
+	}
+	return 0;
+}
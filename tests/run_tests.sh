@@ -1,6 +1,7 @@
 #!/bin/bash
 # Main test runner for sniptotop integration tests.
 # Starts Xvfb, builds binaries, runs all test_*.sh, reports results.
+# An optional argument selects other scripts, e.g. 'stress_*.sh'.
 
 set -uo pipefail
 
@@ -77,7 +78,8 @@ passed=0
 failed=0
 failures=""
 
-tests=$(find "$SCRIPT_DIR" -name 'test_*.sh' -type f | sort)
+pattern="${1:-test_*.sh}"
+tests=$(find "$SCRIPT_DIR" -name "$pattern" -type f | sort)
 
 for test_script in $tests; do
 	test_name=$(basename "$test_script" .sh)
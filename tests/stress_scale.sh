@@ -0,0 +1,175 @@
+#!/bin/bash
+# Stress: thousands of snips over many targets, churned with damage,
+# moves, resizes, disconnects and reconnects. Checks memory, server
+# resources, event loop stalls and state save time against bounds.
+# Run with 'make stress'; sizes and bounds can be set from the
+# environment.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+TARGETS=${STRESS_TARGETS:-16}
+SNIPS=${STRESS_SNIPS:-2000}
+GHOST_NAMES=${STRESS_GHOST_NAMES:-20}
+GHOSTS=${STRESS_GHOSTS:-200}
+ROUNDS=${STRESS_ROUNDS:-30}
+MAX_RSS_KB=${STRESS_MAX_RSS_KB:-262144}
+MAX_RSS_GROWTH_KB=${STRESS_MAX_RSS_GROWTH_KB:-65536}
+MAX_STALL_MS=${STRESS_MAX_STALL_MS:-2000}
+MAX_SAVE_MS=${STRESS_MAX_SAVE_MS:-1000}
+
+HELPER_PIDS=()
+
+stress_cleanup() {
+	for pid in "${HELPER_PIDS[@]}"; do
+		kill "$pid" 2>/dev/null || true
+	done
+	cleanup
+}
+trap stress_cleanup EXIT
+
+start_target() {
+	local i=$1
+	"$TEST_HELPER" -t "stress-target-$i" \
+		-p "$(( 10 + i % 6 * 210 )),$(( 10 + i / 6 % 3 * 230 ))" \
+		-d 20 > /dev/null &
+	HELPER_PIDS[$i]=$!
+}
+
+# Ask for stats and wait for the dump, prints it on one line. A dump
+# starts with the views line; it is complete once its max stall line
+# is there, the lines come out in one flush.
+dump_stats() {
+	local before after
+	before=$(grep -c '^stats: max stall' "$out" || true)
+	kill -USR1 "$SNIPTOTOP_PID" 2>/dev/null || return 1
+	for i in $(seq 1 100); do
+		after=$(grep -c '^stats: max stall' "$out" || true)
+		if [ "$after" -gt "$before" ]; then
+			awk '/^stats: views/ { s = "" } /^stats:/ { s = s $0 " " }
+				END { print s }' "$out"
+			return 0
+		fi
+		sleep 0.1
+	done
+	return 1
+}
+
+# stat_of FIELD STATS: the number following FIELD
+stat_of() {
+	echo "$2" | grep -oP "$1 \K[0-9]+" | head -1
+}
+
+rss_kb() {
+	awk '/^VmRSS/ { print $2 }' "/proc/$SNIPTOTOP_PID/status"
+}
+
+assert_le() {
+	local actual=$1 bound=$2 msg="$3"
+	if [ -n "$actual" ] && [ "$actual" -le "$bound" ]; then
+		echo "  ok: $msg ($actual <= $bound)"
+	else
+		fail "$msg (got '$actual', bound $bound)"
+	fi
+}
+
+setup_tmpdir
+out="$TEST_TMPDIR/out"
+
+for i in $(seq 0 $(( TARGETS - 1 ))); do
+	start_target "$i"
+done
+sleep 1
+
+state_file="$TEST_TMPDIR/.config/sniptotop/state"
+RANDOM=42
+{
+	for i in $(seq 1 "$SNIPS"); do
+		echo "stress-target-$(( RANDOM % TARGETS ))" \
+			$(( RANDOM % 160 )) $(( RANDOM % 160 )) \
+			$(( 8 + RANDOM % 32 )) $(( 8 + RANDOM % 32 )) \
+			$(( RANDOM % 1240 )) $(( RANDOM % 680 )) \
+			$(( RANDOM % 4 == 0 )) $(( RANDOM % 3 )) \
+			$(( 1 + RANDOM % 9 ))
+	done
+	for i in $(seq 1 "$GHOSTS"); do
+		echo "stress-ghost-$(( RANDOM % GHOST_NAMES ))" \
+			0 0 16 16 $(( RANDOM % 1240 )) $(( RANDOM % 680 )) \
+			0 0 1
+	done
+} > "$state_file"
+
+start=$(date +%s%N)
+start_sniptotop > "$out"
+stats=""
+for i in $(seq 1 120); do
+	stats=$(dump_stats) && break
+	sleep 1
+done
+[ -n "$stats" ] || fail "sniptotop did not come up"
+echo "  restored $(( SNIPS + GHOSTS )) snips in" \
+	"$(( ($(date +%s%N) - start) / 1000000 )) ms"
+assert_eq "$(stat_of views "$stats")" "$(( SNIPS + GHOSTS ))" "all snips restored" ||
+	fail "snips missing"
+rss_start=$(rss_kb)
+
+helpers=" $(xdotool search --name '^stress-target-' 2>/dev/null | tr '\n' ' ' || true) "
+main_wid=$(wait_for_window "sniptotop") || fail "main window not found"
+views=()
+for wid in $(xprop -root _NET_CLIENT_LIST | cut -d'#' -f2 | tr -d ','); do
+	wid=$(( wid ))
+	[ "$wid" = "$main_wid" ] && continue
+	case "$helpers" in *" $wid "*) continue ;; esac
+	views+=("$wid")
+done
+echo "  ${#views[@]} managed snip windows"
+[ "${#views[@]}" -gt 0 ] || fail "no snip windows found"
+
+for round in $(seq 1 "$ROUNDS"); do
+	for k in $(seq 1 20); do
+		wid=${views[$(( RANDOM % ${#views[@]} ))]}
+		xdotool windowmove "$wid" $(( RANDOM % 1240 )) \
+			$(( RANDOM % 680 )) 2>/dev/null || true
+	done
+	for k in 1 2; do
+		wid=${views[$(( RANDOM % ${#views[@]} ))]}
+		press_key "$(shuf -n1 -e Right Down Left Up)" "$wid"
+	done
+	if [ $(( round % 5 )) -eq 0 ]; then
+		i=$(( RANDOM % TARGETS ))
+		kill -USR2 "${HELPER_PIDS[$i]}" 2>/dev/null || true
+		wait "${HELPER_PIDS[$i]}" 2>/dev/null || true
+		sleep 0.3
+		start_target "$i"
+	fi
+	sleep 0.2
+	kill -0 "$SNIPTOTOP_PID" 2>/dev/null || fail "sniptotop died in round $round"
+done
+sleep 1
+
+stats=$(dump_stats) || fail "no stats after churn"
+echo "  $stats"
+rss_end=$(rss_kb)
+
+assert_eq "$(stat_of views "$stats")" "$(( SNIPS + GHOSTS ))" "no snips lost" ||
+	fail "snips lost"
+assert_le "$(stat_of targets "$stats")" "$TARGETS" "connected targets"
+assert_le "$(stat_of gcs "$stats")" 3 "GCs"
+assert_le "$(stat_of cursors "$stats")" 1 "cursors"
+assert_le "$(stat_of colormaps "$stats")" 1 "colormaps"
+assert_le "$(stat_of damage "$stats")" "$TARGETS" "damage objects"
+assert_le "$(stat_of pixmaps "$stats")" $(( TARGETS + GHOST_NAMES )) "pixmaps"
+assert_le "$(stat_of names "$stats")" $(( TARGETS + GHOST_NAMES )) "interned names"
+assert_le "$rss_end" "$MAX_RSS_KB" "RSS in kB"
+assert_le $(( rss_end - rss_start )) "$MAX_RSS_GROWTH_KB" "RSS growth in kB"
+assert_le "$(stat_of 'max stall' "$stats")" "$MAX_STALL_MS" "longest loop pass in ms"
+assert_le "$(stat_of '\(max' "$stats")" "$MAX_SAVE_MS" "longest state save in ms"
+
+kill "$SNIPTOTOP_PID" 2>/dev/null
+wait "$SNIPTOTOP_PID" 2>/dev/null || true
+SNIPTOTOP_PID=""
+entry_count=$(grep -v '^#' "$state_file" | grep -c .)
+assert_eq "$entry_count" "$(( SNIPS + GHOSTS ))" "all snips saved" ||
+	fail "saved $entry_count"
+
+echo "stress_scale: all assertions passed"
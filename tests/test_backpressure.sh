@@ -0,0 +1,32 @@
+#!/bin/bash
+# Test: past copy_budget_px in flight, damaged snips wait for the fence
+# reply instead of being copied, then catch up.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+# every copy of the snip is over budget
+echo "copy_budget_px: 1000" > "$TEST_TMPDIR/.config/sniptotop/config.yaml"
+start_helper -d 1
+out="$TEST_TMPDIR/out"
+start_sniptotop -n > "$out"
+
+create_snippet 2 2 198 198
+sleep 1
+
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+stats=$(grep '^stats: in flight' "$out" | tail -1)
+echo "  $stats"
+throttled=$(echo "$stats" | grep -oP 'throttled \K[0-9]+')
+[ "$throttled" -gt 0 ] || fail "no copy held back: $stats"
+echo "  ok: copies held back over budget"
+
+# the held back views are copied once the fence reply is in
+flushes=$(echo "$stats" | grep -oP 'flushes \K[0-9]+')
+[ "$flushes" -gt 0 ] || fail "held back views never copied: $stats"
+echo "  ok: held back views caught up"
+
+echo "test_backpressure: all assertions passed"
+cleanup
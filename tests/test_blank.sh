@@ -0,0 +1,37 @@
+#!/bin/bash
+# Test: Snippets stop updating while the screensaver runs and catch up on wake.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+start_helper
+out="$TEST_TMPDIR/out"
+start_sniptotop -n > "$out"
+
+create_snippet
+
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "snippet shows red" || fail "not red: $color"
+
+# The screensaver hides every snippet, the damage object goes away
+xset s activate
+sleep 0.3
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+grep -E '^stats: (views|pixmaps)' "$out" | tail -2 | tr '\n' ' ' |
+	grep -q "hidden 1 .* damage 0 " ||
+	fail "still tracking damage while blanked: $(grep -E '^stats: (views|pixmaps)' "$out" | tail -2)"
+echo "  ok: no damage object while blanked"
+
+# Helper turns blue while the screen is blanked
+kill -USR1 "$HELPER_PID"
+sleep 0.3
+
+xset s reset
+sleep 0.5
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "0000FF" "snippet caught up on wake" || fail "stale: $color"
+
+echo "test_blank: all assertions passed"
+cleanup
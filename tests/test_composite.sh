@@ -0,0 +1,77 @@
+#!/bin/bash
+# Test: 'm' merges two snippets into one window, shift+m splits them.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+start_helper
+start_sniptotop -n
+
+create_snippet
+first="$SNIPPET_WID"
+create_snippet
+second="$SNIPPET_WID"
+
+size=$(get_window_size "$second")
+assert_eq "$size" "64 64" "single snippet size" || fail "size: $size"
+
+press_key "m" "$first"
+press_key "m" "$second"
+sleep 0.3
+
+assert_window_gone "$first" "merged snippet window destroyed" || fail "first window kept"
+size=$(get_window_size "$second")
+assert_eq "$size" "126 64" "composite holds both side by side" || fail "size: $size"
+
+color=$(get_pixel_color "$second" 5 5)
+assert_eq "$color" "FF0000" "first part shows red" || fail "first part: $color"
+color=$(get_pixel_color "$second" 70 5)
+assert_eq "$color" "FF0000" "second part shows red" || fail "second part: $color"
+
+kill -USR1 "$HELPER_PID"
+sleep 0.5
+color=$(get_pixel_color "$second" 5 5)
+assert_eq "$color" "0000FF" "first part updated" || fail "first part: $color"
+color=$(get_pixel_color "$second" 70 5)
+assert_eq "$color" "0000FF" "second part updated" || fail "second part: $color"
+
+# Both parts are saved with the same group number
+kill "$SNIPTOTOP_PID" 2>/dev/null
+wait "$SNIPTOTOP_PID" 2>/dev/null || true
+SNIPTOTOP_PID=""
+state_file="$TEST_TMPDIR/.config/sniptotop/state"
+groups=$(grep -v '^#' "$state_file" | grep -v '^$' | awk '{print $11}' | tr '\n' ' ')
+assert_eq "$groups" "1 1 " "group saved" || fail "groups: $groups"
+
+# The restart restores one composite window
+before_restart=$(xdotool search --onlyvisible --name "" 2>/dev/null | sort || true)
+start_sniptotop
+sleep 1
+main_wid=$(wait_for_window "sniptotop") || fail "main window not found on restart"
+after_restart=$(xdotool search --onlyvisible --name "" 2>/dev/null | sort || true)
+restored=""
+for wid in $after_restart; do
+	if ! echo "$before_restart" | grep -qx "$wid" && [ "$wid" != "$main_wid" ]; then
+		[ -z "$restored" ] || fail "more than one snippet window restored"
+		restored="$wid"
+	fi
+done
+[ -n "$restored" ] || fail "composite not restored"
+size=$(get_window_size "$restored")
+assert_eq "$size" "126 64" "restored composite size" || fail "size: $size"
+
+# shift+m over the second part gives it its own window again
+pos=$(get_window_pos "$restored")
+px=$(echo "$pos" | awk '{print $1}')
+py=$(echo "$pos" | awk '{print $2}')
+xdotool windowfocus --sync "$restored" 2>/dev/null || true
+xdotool mousemove --sync $(( px + 90 )) $(( py + 30 ))
+sleep 0.1
+xdotool key shift+m
+sleep 0.5
+size=$(get_window_size "$restored")
+assert_eq "$size" "64 64" "split leaves one part" || fail "size: $size"
+
+echo "test_composite: all assertions passed"
+cleanup
@@ -0,0 +1,56 @@
+#!/bin/bash
+# Test: config.yaml is read at startup and reloaded when it changes.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+config="$TEST_TMPDIR/.config/sniptotop/config.yaml"
+stats_log="$TEST_TMPDIR/stats.log"
+cat > "$config" <<EOF
+# periodic stats into a file
+stats_interval_s: 1
+stats_file: $stats_log
+EOF
+
+start_helper
+start_sniptotop -n
+
+sleep 1.5
+grep -q "^stats: views 0 " "$stats_log" 2>/dev/null ||
+	fail "no periodic stats in $stats_log"
+echo "  ok: periodic stats written to the stats file"
+
+# New snips start frozen after the reload
+cat > "$config.tmp" <<EOF
+stats_interval_s: 1
+stats_file: $stats_log
+refresh: frozen
+EOF
+mv "$config.tmp" "$config"
+sleep 0.3
+
+create_snippet
+
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "snippet shows red" || fail "not red: $color"
+kill -USR1 "$HELPER_PID"
+sleep 0.5
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "new snippet is frozen" || fail "updated: $color"
+
+# A broken file keeps the current settings
+echo "refresh: sometimes" > "$config"
+sleep 0.3
+kill -0 "$SNIPTOTOP_PID" 2>/dev/null || fail "sniptotop died on a broken config"
+echo "  ok: broken config ignored"
+
+kill "$SNIPTOTOP_PID" 2>/dev/null
+wait "$SNIPTOTOP_PID" 2>/dev/null || true
+SNIPTOTOP_PID=""
+state_file="$TEST_TMPDIR/.config/sniptotop/state"
+refresh=$(grep -v '^#' "$state_file" | grep -v '^$' | awk '{print $9}')
+assert_eq "$refresh" "3" "frozen policy saved" || fail "refresh field wrong: $refresh"
+
+echo "test_config: all assertions passed"
+cleanup
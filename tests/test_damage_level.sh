@@ -0,0 +1,40 @@
+#!/bin/bash
+# Test: damage: auto moves a busy target to coarser damage reports, and
+# back once it goes quiet.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+echo "damage_busy_hz: 100" > "$TEST_TMPDIR/.config/sniptotop/config.yaml"
+start_helper -d 1
+out="$TEST_TMPDIR/out"
+start_sniptotop -n > "$out"
+
+# The snippet covers nearly all of the helper, so does its damage
+create_snippet 2 2 198 198
+sleep 2.5
+
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+stats=$(grep '^stats: pixmaps' "$out" | tail -1)
+echo "  $stats"
+echo "$stats" | grep -q "damage 1 (coarse 1)" ||
+	fail "busy target still on raw rectangles"
+echo "  ok: busy target on coarse damage reports"
+
+# a stopped helper sends no damage, the timer steps it back down
+# (non-empty takes two one second samples to get there)
+kill -STOP "$HELPER_PID"
+sleep 4
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+kill -CONT "$HELPER_PID"
+stats=$(grep '^stats: pixmaps' "$out" | tail -1)
+echo "  $stats"
+echo "$stats" | grep -q "damage 1 (coarse 0)" ||
+	fail "quiet target kept coarse reports"
+echo "  ok: quiet target back on raw rectangles"
+
+echo "test_damage_level: all assertions passed"
+cleanup
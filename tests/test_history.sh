@@ -0,0 +1,58 @@
+#!/bin/bash
+# Test: A notify snip keeps its recent frames, , and . step through
+# them and the oldest ones go first.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+cat > "$TEST_TMPDIR/.config/sniptotop/config.yaml" <<EOF
+history_frames: 2
+EOF
+start_helper
+out="$TEST_TMPDIR/out"
+start_sniptotop -n > "$out"
+
+create_snippet
+press_key "n" "$SNIPPET_WID"
+sleep 0.3
+
+# red -> blue -> green
+kill -USR1 "$HELPER_PID"
+sleep 0.3
+kill -USR1 "$HELPER_PID"
+sleep 0.3
+assert_eq "$(get_pixel_color "$SNIPPET_WID" 30 30)" "00FF00" "content" ||
+	fail "snip doesn't show green"
+
+press_key "comma" "$SNIPPET_WID"
+sleep 0.2
+assert_eq "$(get_pixel_color "$SNIPPET_WID" 30 30)" "0000FF" "one back" ||
+	fail "one step back isn't blue"
+# red was the oldest of three, it is gone
+press_key "comma" "$SNIPPET_WID"
+sleep 0.2
+assert_eq "$(get_pixel_color "$SNIPPET_WID" 30 30)" "0000FF" "oldest" ||
+	fail "stepped past the oldest frame"
+echo "  ok: stepping back"
+
+press_key "period" "$SNIPPET_WID"
+sleep 0.2
+assert_eq "$(get_pixel_color "$SNIPPET_WID" 30 30)" "00FF00" "forward" ||
+	fail "forward doesn't show the content again"
+echo "  ok: stepping forward"
+
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+grep -q "^stats: history 2 frames, [0-9]* KiB of 64 MiB$" "$out" ||
+	fail "history stats: $(grep 'stats: history' "$out")"
+
+press_key "n" "$SNIPPET_WID"
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+grep "^stats: history" "$out" | tail -1 | grep -q "history 0 frames" ||
+	fail "notify off keeps the history"
+echo "  ok: frames accounted"
+
+echo "test_history: all assertions passed"
+cleanup
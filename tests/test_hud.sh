@@ -0,0 +1,49 @@
+#!/bin/bash
+# Test: 'i' toggles the HUD in the snippet's top left corner.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+start_helper
+out="$TEST_TMPDIR/out"
+start_sniptotop -n > "$out"
+
+gcs() {
+	kill -USR1 "$SNIPTOTOP_PID"
+	sleep 0.3
+	grep '^stats: pixmaps' "$out" | tail -1 | grep -oP 'gcs \K[0-9]+'
+}
+
+create_snippet
+gcs_before=$(gcs)
+
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "snippet shows red" || fail "not red: $color"
+
+press_key "i" "$SNIPPET_WID"
+sleep 0.3
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+[ "$color" != "FF0000" ] || fail "no HUD drawn"
+echo "  ok: HUD drawn over the corner ($color)"
+color=$(get_pixel_color "$SNIPPET_WID" 40 50)
+assert_eq "$color" "FF0000" "content below the HUD kept" || fail "content: $color"
+
+# The HUD stays after the content changes
+kill -USR1 "$HELPER_PID"
+sleep 1.2
+color=$(get_pixel_color "$SNIPPET_WID" 40 50)
+assert_eq "$color" "0000FF" "content updated" || fail "content: $color"
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+[ "$color" != "0000FF" ] || fail "HUD lost on copy"
+echo "  ok: HUD kept over new content ($color)"
+
+press_key "i" "$SNIPPET_WID"
+sleep 0.3
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "0000FF" "HUD removed" || fail "HUD still there: $color"
+assert_eq "$(gcs)" "$gcs_before" "HUD GC freed with the last HUD" ||
+	fail "HUD GC kept"
+
+echo "test_hud: all assertions passed"
+cleanup
@@ -0,0 +1,13 @@
+#!/bin/bash
+# Test: the vector pixel kernels of the rules agree with the scalar ones.
+# Runs without X.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+make -s -C "$PROJECT_DIR" tests/kernels >/dev/null ||
+	fail "can't build tests/kernels"
+"$SCRIPT_DIR/kernels" || fail "kernels disagree with scalar"
+echo "  ok: kernels agree with scalar"
+
+echo "test_kernels: all assertions passed"
@@ -0,0 +1,32 @@
+#!/bin/bash
+# Test: More snips than the old fixed limits, all restored and saved.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+
+# 150 disconnected snips, two sharing each name
+state_file="$TEST_TMPDIR/.config/sniptotop/state"
+for i in $(seq 0 149); do
+	echo "ghost-$(( i / 2 )) 0 0 8 8 $(( i % 30 * 10 )) $(( i / 30 * 10 )) 0 0 1"
+done > "$state_file"
+
+start_sniptotop
+sleep 1
+
+kill -0 "$SNIPTOTOP_PID" 2>/dev/null || fail "sniptotop exited on restore"
+echo "  ok: sniptotop alive with 150 snips"
+
+kill "$SNIPTOTOP_PID" 2>/dev/null
+wait "$SNIPTOTOP_PID" 2>/dev/null || true
+SNIPTOTOP_PID=""
+sleep 0.3
+
+entry_count=$(grep -v '^#' "$state_file" | grep -c .)
+assert_eq "$entry_count" "150" "all snips saved" || fail "saved $entry_count"
+name_count=$(grep -v '^#' "$state_file" | awk '{print $1}' | sort -u | wc -l)
+assert_eq "$name_count" "75" "names kept" || fail "saved $name_count names"
+
+echo "test_many: all assertions passed"
+cleanup
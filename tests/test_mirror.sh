@@ -0,0 +1,70 @@
+#!/bin/bash
+# Test: -m shows part of a window on a second display and follows its
+# changes.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+command -v Xvfb >/dev/null 2>&1 || { echo "  skip: no Xvfb"; exit 0; }
+
+SRC_DISPLAY=""
+for d in $(seq 121 140); do
+	if ! [ -e "/tmp/.X${d}-lock" ]; then
+		SRC_DISPLAY=":$d"
+		break
+	fi
+done
+[ -n "$SRC_DISPLAY" ] || { echo "  skip: no free display"; exit 0; }
+
+Xvfb "$SRC_DISPLAY" -screen 0 640x480x24 +extension DAMAGE &
+SRC_XVFB_PID=$!
+sleep 0.5
+stop_source() {
+	kill "$SRC_XVFB_PID" 2>/dev/null || true
+	wait "$SRC_XVFB_PID" 2>/dev/null || true
+	cleanup
+}
+trap stop_source EXIT
+
+setup_tmpdir
+# the helper lives on the source display only
+DISPLAY="$SRC_DISPLAY" "$TEST_HELPER" &
+HELPER_PID=$!
+sleep 0.5
+
+before_wids=$(xdotool search --onlyvisible --name "" 2>/dev/null | sort || true)
+out="$TEST_TMPDIR/out"
+start_sniptotop -n -m "$SRC_DISPLAY 60x60+20+20 sniptotop-test-target" > "$out"
+sleep 0.5
+
+main_wid=$(wait_for_window "sniptotop") || fail "main window not found"
+MIRROR_WID=""
+for wid in $(xdotool search --onlyvisible --name "" 2>/dev/null | sort); do
+	if ! echo "$before_wids" | grep -qx "$wid" && [ "$wid" != "$main_wid" ]; then
+		MIRROR_WID="$wid"
+	fi
+done
+[ -n "$MIRROR_WID" ] || fail "mirror window not found"
+
+read -r w h < <(get_window_size "$MIRROR_WID")
+assert_eq "$w $h" "64 64" "capture size and border" ||
+	fail "mirror is ${w}x${h}"
+assert_eq "$(get_pixel_color "$MIRROR_WID" 30 30)" "FF0000" "content" ||
+	fail "mirror doesn't show the red helper"
+echo "  ok: mirror shows the source"
+
+# red -> blue on the source display
+kill -USR1 "$HELPER_PID"
+sleep 0.5
+assert_eq "$(get_pixel_color "$MIRROR_WID" 30 30)" "0000FF" "update" ||
+	fail "mirror didn't follow the source"
+echo "  ok: mirror follows damage"
+
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+grep -q "^stats: mirrors 1, puts [1-9][0-9]*, [1-9][0-9]* px$" "$out" ||
+	fail "mirror stats: $(grep 'stats: mirrors' "$out")"
+echo "  ok: puts accounted"
+
+echo "test_mirror: all assertions passed"
+cleanup
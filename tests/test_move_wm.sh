@@ -0,0 +1,72 @@
+#!/bin/bash
+# Test: With drag: wm the window manager moves the snippet, it snaps
+# once on release.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+cat > "$TEST_TMPDIR/.config/sniptotop/config.yaml" <<EOF
+drag: wm
+snap_distance: 20
+EOF
+start_helper
+ensure_wm
+# run_tests.sh starts xfwm4 or openbox, both have it; without it this
+# would test nothing
+xprop -root _NET_SUPPORTED 2>/dev/null | grep -q _NET_WM_MOVERESIZE ||
+	fail "the window manager has no _NET_WM_MOVERESIZE"
+out="$TEST_TMPDIR/out"
+start_sniptotop -n -d > "$out" 2>&1
+
+create_snippet
+
+read -r x y < <(get_window_pos "$SNIPPET_WID")
+read -r sw sh < <(get_window_size "$SNIPPET_WID")
+cx=$((x + sw / 2))
+cy=$((y + sh / 2))
+
+# away from the edges, shift keeps it where it was dropped
+xdotool mousemove --sync "$cx" "$cy"
+sleep 0.05
+xdotool keydown shift
+xdotool mousedown 3
+sleep 0.2
+for i in 1 2 3 4 5; do
+	xdotool mousemove --sync $((cx + i * 10)) $((cy + i * 6))
+	sleep 0.05
+done
+xdotool mouseup 3
+xdotool keyup shift
+sleep 0.3
+
+grep -q "moved by the window manager" "$out" ||
+	fail "the drag didn't go to the window manager"
+
+read -r nx ny < <(get_window_pos "$SNIPPET_WID")
+assert_near "$((nx - x))" 50 5 "moved ~50px right" ||
+	fail "dx=$((nx - x)) expected ~50"
+assert_near "$((ny - y))" 30 5 "moved ~30px down" ||
+	fail "dy=$((ny - y)) expected ~30"
+
+# dropped 10px from the left edge, snaps to it on release
+read -r x y < <(get_window_pos "$SNIPPET_WID")
+cx=$((x + sw / 2))
+cy=$((y + sh / 2))
+xdotool mousemove --sync "$cx" "$cy"
+sleep 0.05
+xdotool mousedown 3
+sleep 0.2
+for i in 1 2 3 4 5; do
+	xdotool mousemove --sync $((cx - (x - 10) * i / 5)) "$cy"
+	sleep 0.05
+done
+xdotool mouseup 3
+sleep 0.3
+
+read -r nx ny < <(get_window_pos "$SNIPPET_WID")
+assert_eq "$nx" "0" "snapped to the left edge" ||
+	fail "x=$nx after dropping it at 10"
+
+echo "test_move_wm: all assertions passed"
+cleanup
@@ -0,0 +1,50 @@
+#!/bin/bash
+# Test: Refresh policies — on demand and frozen views hold back updates.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+start_helper
+start_sniptotop -n
+
+create_snippet
+
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "live snippet shows red" || fail "not red: $color"
+
+# live -> throttled -> on demand
+press_key "r" "$SNIPPET_WID"
+press_key "r" "$SNIPPET_WID"
+sleep 0.3
+
+# Helper turns blue, the on-demand snippet must keep red
+kill -USR1 "$HELPER_PID"
+sleep 0.5
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "on-demand snippet not updated" || fail "updated: $color"
+
+# Space refreshes it
+press_key "space" "$SNIPPET_WID"
+sleep 0.3
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "0000FF" "on-demand snippet refreshed" || fail "not refreshed: $color"
+
+# on demand -> frozen, helper turns green, snippet stays blue
+press_key "r" "$SNIPPET_WID"
+sleep 0.3
+kill -USR1 "$HELPER_PID"
+sleep 0.5
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "0000FF" "frozen snippet not updated" || fail "updated: $color"
+
+# Frozen policy is saved in the state file
+kill "$SNIPTOTOP_PID" 2>/dev/null
+wait "$SNIPTOTOP_PID" 2>/dev/null || true
+SNIPTOTOP_PID=""
+state_file="$TEST_TMPDIR/.config/sniptotop/state"
+refresh=$(grep -v '^#' "$state_file" | grep -v '^$' | awk '{print $9}')
+assert_eq "$refresh" "3" "frozen policy saved" || fail "refresh field wrong: $refresh"
+
+echo "test_refresh: all assertions passed"
+cleanup
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Test: A recorded session replays without a display and reaches the same state.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+start_helper
+session="$TEST_TMPDIR/session.rec"
+start_sniptotop -n -R "$session" > /dev/null
+
+create_snippet
+kill -USR1 "$HELPER_PID"
+sleep 0.3
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+
+kill "$SNIPTOTOP_PID" 2>/dev/null
+wait "$SNIPTOTOP_PID" 2>/dev/null || true
+SNIPTOTOP_PID=""
+state_before=$(cat "$TEST_TMPDIR/.config/sniptotop/state")
+
+out="$TEST_TMPDIR/replay.out"
+DISPLAY= "$SNIPTOTOP" -P "$session" > "$out" 2>&1 ||
+	fail "replay failed: $(tail -3 "$out")"
+grep -q "^stats: views 1 " "$out" ||
+	fail "replay didn't rebuild the snippet: $(grep '^stats:' "$out")"
+events=$(sed -n 's/^replay: \([0-9]*\) events.*/\1/p' "$out")
+[ "${events:-0}" -gt 0 ] || fail "no events replayed: $(tail -1 "$out")"
+echo "  ok: $(tail -1 "$out")"
+
+state_after=$(cat "$TEST_TMPDIR/.config/sniptotop/state")
+assert_eq "$state_after" "$state_before" "replay leaves the state file alone" ||
+	fail "state file changed"
+
+echo "test_replay: all assertions passed"
+cleanup
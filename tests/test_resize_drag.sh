@@ -0,0 +1,102 @@
+#!/bin/bash
+# Test: Dragging the edges of a snippet resizes its capture area, the
+# state is saved when the drag ends; held arrow keys save once too.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+# capture width and height saved for the snippet
+saved_size() {
+	grep -v '^#' "$TEST_TMPDIR/.config/sniptotop/state" | awk '{print $4, $5}'
+}
+
+setup_tmpdir
+start_helper
+start_sniptotop -n
+
+create_snippet
+
+read -r x y < <(get_window_pos "$SNIPPET_WID")
+read -r w h < <(get_window_size "$SNIPPET_WID")
+read -r cw ch < <(saved_size)
+
+# bottom right corner, 40 right and 30 down in small steps
+xdotool mousemove --sync $((x + w - 1)) $((y + h - 1))
+sleep 0.05
+xdotool mousedown 1
+for i in $(seq 1 10); do
+	xdotool mousemove --sync $((x + w - 1 + i * 4)) $((y + h - 1 + i * 3))
+done
+xdotool mouseup 1
+sleep 0.3
+
+read -r nw nh < <(get_window_size "$SNIPPET_WID")
+assert_eq "$nw $nh" "$((w + 40)) $((h + 30))" "corner drag" ||
+	fail "size ${nw}x${nh} after dragging ${w}x${h} by 40,30"
+assert_eq "$(saved_size)" "$((cw + 40)) $((ch + 30))" "saved on release" ||
+	fail "state has $(saved_size)"
+echo "  ok: corner drag"
+
+# left edge 20 left: wider, and the window moves with the edge
+read -r x y < <(get_window_pos "$SNIPPET_WID")
+w=$nw
+xdotool mousemove --sync "$x" $((y + h / 2))
+sleep 0.05
+xdotool mousedown 1
+for i in $(seq 1 4); do
+	xdotool mousemove --sync $((x - i * 5)) $((y + h / 2))
+done
+xdotool mouseup 1
+sleep 0.3
+
+read -r nw nh < <(get_window_size "$SNIPPET_WID")
+read -r nx ny < <(get_window_pos "$SNIPPET_WID")
+assert_eq "$nw" "$((w + 20))" "left edge drag" || fail "width $nw"
+assert_near "$nx" "$((x - 20))" 2 "window follows the edge" || fail "x $nx"
+echo "  ok: left edge drag"
+
+# a held key repeats, the state follows once it is released
+read -r cw ch < <(saved_size)
+xdotool windowfocus --sync "$SNIPPET_WID" 2>/dev/null || true
+xdotool keydown Right
+sleep 1
+xdotool keyup Right
+sleep 0.8
+read -r nw nh < <(get_window_size "$SNIPPET_WID")
+read -r sw sh < <(saved_size)
+[ "$sw" -gt "$((cw + 1))" ] || fail "key repeat didn't grow the capture"
+assert_eq "$((nw - sw))" "$((w + 20 - cw))" "saved after the repeat" ||
+	fail "window ${nw} wide, state has ${sw}"
+echo "  ok: key repeat"
+
+# far past the right edge of the 200px wide target: the capture stops
+# at it
+read -r x y < <(get_window_pos "$SNIPPET_WID")
+read -r w h < <(get_window_size "$SNIPPET_WID")
+cx=$(grep -v '^#' "$TEST_TMPDIR/.config/sniptotop/state" | awk '{print $2}')
+xdotool mousemove --sync $((x + w - 1)) $((y + h / 2))
+sleep 0.05
+xdotool mousedown 1
+for i in $(seq 1 10); do
+	xdotool mousemove --sync $((x + w - 1 + i * 30)) $((y + h / 2))
+done
+xdotool mouseup 1
+sleep 0.3
+read -r sw sh < <(saved_size)
+assert_eq "$sw" "$((200 - cx))" "clamped to the target" ||
+	fail "capture ${sw} wide from ${cx} on a 200px target"
+echo "  ok: clamped to the target"
+
+# a click on the edge without moving raises, the capture stays
+read -r cw ch < <(saved_size)
+read -r w h < <(get_window_size "$SNIPPET_WID")
+xdotool mousemove --sync $((x + w - 1)) $((y + h / 2))
+sleep 0.05
+xdotool click 1
+sleep 0.3
+assert_eq "$(saved_size)" "$cw $ch" "click on the edge" ||
+	fail "state has $(saved_size) after a click"
+echo "  ok: click on the edge"
+
+echo "test_resize_drag: all assertions passed"
+cleanup
@@ -0,0 +1,45 @@
+#!/bin/bash
+# Test: Snip churn doesn't grow server resources (SIGUSR1 stats).
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+# sample server resources every second, the first one before the churn
+echo "xres_interval_s: 1" > "$TEST_TMPDIR/.config/sniptotop/config.yaml"
+start_helper
+out="$TEST_TMPDIR/out"
+err="$TEST_TMPDIR/err"
+start_sniptotop -n > "$out" 2> "$err"
+sleep 1
+
+for i in 1 2 3; do
+	create_snippet
+	press_key "Escape" "$SNIPPET_WID"
+	sleep 0.3
+done
+create_snippet
+
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+
+stats=$(grep '^stats:' "$out" | tr '\n' ' ')
+echo "  $stats"
+echo "$stats" | grep -q "views 1 (pool 1) hidden 0 targets 1+0 disconnected (pool 1)" ||
+	fail "contexts leaked"
+# one GC for the main window, one copy GC shared by view and target
+echo "$stats" | grep -q "gcs 2 cursors 1 " || fail "GCs or cursors leaked"
+echo "  ok: resources stay flat over snip churn"
+
+# The server agrees, if it has X-Resource
+sleep 1
+server=$(grep '^stats: server' "$out" || true)
+if [ -n "$server" ]; then
+	echo "  $server"
+	! grep -q "warning: the X server holds" "$err" ||
+		fail "server resources grew: $(grep warning "$err")"
+	echo "  ok: server resources match"
+fi
+
+echo "test_resources: all assertions passed"
+cleanup
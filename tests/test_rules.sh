@@ -0,0 +1,51 @@
+#!/bin/bash
+# Test: A notify snip with a color rule flashes when the rule turns
+# true, not on other changes.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+# sample the border for a second, 1 if it showed red
+saw_red() {
+	for i in $(seq 1 8); do
+		if [ "$(get_pixel_color "$SNIPPET_WID" 0 0)" = "FF0000" ]; then
+			echo 1
+			return
+		fi
+		sleep 0.15
+	done
+	echo 0
+}
+
+setup_tmpdir
+cat > "$TEST_TMPDIR/.config/sniptotop/rules.yaml" <<EOF
+- snip: sniptotop-test-target
+  color: 00ff00
+EOF
+start_helper
+out="$TEST_TMPDIR/out"
+start_sniptotop -n > "$out"
+
+create_snippet
+press_key "n" "$SNIPPET_WID"
+sleep 0.3
+
+# red -> blue changes the content, but isn't green
+kill -USR1 "$HELPER_PID"
+sleep 0.3
+assert_eq "$(saw_red)" "0" "no flash on blue" || fail "flashed on blue"
+echo "  ok: other changes don't flash"
+
+# blue -> green turns the rule true
+kill -USR1 "$HELPER_PID"
+sleep 0.3
+assert_eq "$(saw_red)" "1" "flash on green" || fail "no flash on green"
+echo "  ok: rule hit flashes"
+
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+grep -q "^stats: rules 1, checks [0-9]*, hits 1$" "$out" ||
+	fail "rule stats: $(grep 'stats: rules' "$out")"
+
+echo "test_rules: all assertions passed"
+cleanup
@@ -0,0 +1,37 @@
+#!/bin/bash
+# Test: views that don't fit into a tick's tick_budget_px go late and
+# are copied in the next tick.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+# one 60x60 snip is over budget, only the first of a tick goes
+echo "tick_budget_px: 1000" > "$TEST_TMPDIR/.config/sniptotop/config.yaml"
+start_helper
+out="$TEST_TMPDIR/out"
+start_sniptotop -n > "$out"
+
+create_snippet
+first="$SNIPPET_WID"
+create_snippet
+second="$SNIPPET_WID"
+
+# red -> blue damages both at once
+kill -USR1 "$HELPER_PID"
+sleep 0.5
+assert_eq "$(get_pixel_color "$first" 5 5)" "0000FF" "first updated" ||
+	fail "first snippet stale"
+assert_eq "$(get_pixel_color "$second" 5 5)" "0000FF" "second updated" ||
+	fail "second snippet stale"
+
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+stats=$(grep '^stats: in flight' "$out" | tail -1)
+echo "  $stats"
+late=$(echo "$stats" | grep -oP 'late \K[0-9]+')
+[ "$late" -gt 0 ] || fail "no view went late: $stats"
+echo "  ok: the view over budget went late and caught up"
+
+echo "test_schedule: all assertions passed"
+cleanup
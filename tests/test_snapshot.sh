@@ -0,0 +1,55 @@
+#!/bin/bash
+# Test: s saves a snip as PPM, shift+s records it to Y4M.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+cap="$TEST_TMPDIR/captures"
+mkdir -p "$cap"
+cat > "$TEST_TMPDIR/.config/sniptotop/config.yaml" <<EOF
+capture_dir: $cap
+record_fps: 10
+EOF
+start_helper
+start_sniptotop -n > "$TEST_TMPDIR/out"
+
+create_snippet
+sleep 0.3
+
+press_key "s" "$SNIPPET_WID"
+sleep 0.5
+ppm=$(ls "$cap"/*.ppm 2>/dev/null | head -1 || true)
+[ -n "$ppm" ] || fail "no snapshot written"
+read -r w h < <(sed -n 2p "$ppm")
+size=$(stat -c %s "$ppm")
+assert_eq "$size" "$(( $(head -3 "$ppm" | wc -c) + w * h * 3 ))" \
+	"snapshot size" || fail "snapshot is ${size} bytes for ${w}x${h}"
+pixel=$(tail -c 3 "$ppm" | od -An -tx1 | tr -d ' \n')
+assert_eq "$pixel" "ff0000" "snapshot is red" || fail "not red: $pixel"
+echo "  ok: ${w}x${h} snapshot"
+
+press_key "shift+s" "$SNIPPET_WID"
+sleep 1.2
+press_key "shift+s" "$SNIPPET_WID"
+sleep 0.5
+y4m=$(ls "$cap"/*.y4m 2>/dev/null | head -1 || true)
+[ -n "$y4m" ] || fail "no recording written"
+header=$(head -1 "$y4m")
+echo "$header" | grep -q "^YUV4MPEG2 W$w H$h F10:1 .*C444$" ||
+	fail "bad header: $header"
+size=$(stat -c %s "$y4m")
+frame=$(( 6 + w * h * 3 ))
+frames=$(( (size - ${#header} - 1) / frame ))
+assert_eq "$(( (size - ${#header} - 1) % frame ))" "0" "whole frames" ||
+	fail "recording of $size bytes isn't whole frames"
+[ "$frames" -ge 8 ] && [ "$frames" -le 16 ] ||
+	fail "$frames frames in 1.2s at 10 fps"
+grep -q "recording stopped: $frames frames, 0 dropped" "$TEST_TMPDIR/out" ||
+	fail "stop message: $(grep recording "$TEST_TMPDIR/out")"
+echo "  ok: recorded $frames frames"
+
+kill -0 "$SNIPTOTOP_PID" 2>/dev/null || fail "sniptotop died"
+
+echo "test_snapshot: all assertions passed"
+cleanup
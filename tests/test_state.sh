@@ -38,9 +38,9 @@ else
 	fail "state missing target name"
 fi
 
-# Last field should be 1 (notify enabled)
-last_field=$(echo "$entries" | awk '{print $NF}')
-assert_eq "$last_field" "1" "notify=1 in state" || fail "notify field wrong: $last_field"
+# Notify field follows name, capture area and position (notify enabled)
+notify_field=$(echo "$entries" | awk '{print $8}')
+assert_eq "$notify_field" "1" "notify=1 in state" || fail "notify field wrong: $notify_field"
 
 # Record windows before restart
 before_restart=$(xdotool search --onlyvisible --name "" 2>/dev/null | sort || true)
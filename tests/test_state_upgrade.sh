@@ -0,0 +1,48 @@
+#!/bin/bash
+# Test: A state file of an older version is read by its header, also
+# for a window title that ends in a number.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+state_file="$TEST_TMPDIR/.config/sniptotop/state"
+
+"$TEST_HELPER" -t "build 42" -p 400,300 &
+HELPER_PID=$!
+wait_for_window "build 42" > /dev/null || fail "helper window not found"
+
+# refresh and fps, no group column yet
+cat > "$state_file" <<EOT
+# target_name cap_x cap_y cap_width cap_height view_x view_y notify refresh fps
+build 42 20 20 60 60 100 100 0 0 1
+EOT
+
+before=$(xdotool search --onlyvisible --name "" 2>/dev/null | sort || true)
+start_sniptotop
+sleep 1
+main_wid=$(wait_for_window "sniptotop") || fail "main window not found"
+SNIPPET_WID=""
+for wid in $(xdotool search --onlyvisible --name "" 2>/dev/null | sort); do
+	if ! echo "$before" | grep -qx "$wid" && [ "$wid" != "$main_wid" ]; then
+		SNIPPET_WID="$wid"
+	fi
+done
+[ -n "$SNIPPET_WID" ] || fail "snippet not restored"
+
+read -r w h < <(get_window_size "$SNIPPET_WID")
+assert_eq "$w $h" "64 64" "capture size kept" || fail "restored as ${w}x${h}"
+echo "  ok: old state restored"
+
+kill "$SNIPTOTOP_PID" 2>/dev/null
+wait "$SNIPTOTOP_PID" 2>/dev/null || true
+SNIPTOTOP_PID=""
+
+head -1 "$state_file" | grep -q "^# sniptotop state [0-9]*: " ||
+	fail "no version in the header: $(head -1 "$state_file")"
+assert_eq "$(grep -v '^#' "$state_file")" "build 42 20 20 60 60 100 100 0 0 1 0" \
+	"saved in the new layout" || fail "state: $(grep -v '^#' "$state_file")"
+echo "  ok: saved with a version"
+
+echo "test_state_upgrade: all assertions passed"
+cleanup
@@ -0,0 +1,55 @@
+#!/bin/bash
+# Test: A restored snippet whose target is gone shows its last frame.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+start_helper
+start_sniptotop -n
+
+create_snippet
+sleep 0.3
+
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "snippet shows red" || fail "not red: $color"
+
+# Save state (and thumbnails) on exit
+kill "$SNIPTOTOP_PID" 2>/dev/null
+wait "$SNIPTOTOP_PID" 2>/dev/null || true
+SNIPTOTOP_PID=""
+sleep 0.3
+
+thumbs_file="$TEST_TMPDIR/.config/sniptotop/state.thumbs"
+[ -s "$thumbs_file" ] || fail "thumbnail file not written"
+echo "  ok: thumbnail file written"
+
+# Target goes away before the restart
+kill -USR2 "$HELPER_PID"
+wait "$HELPER_PID" 2>/dev/null || true
+HELPER_PID=""
+sleep 0.3
+
+before_restart=$(xdotool search --onlyvisible --name "" 2>/dev/null | sort || true)
+start_sniptotop
+sleep 1
+
+main_wid=$(wait_for_window "sniptotop") || fail "main window not found on restart"
+after_restart=$(xdotool search --onlyvisible --name "" 2>/dev/null | sort || true)
+
+SNIPPET_WID=""
+for wid in $after_restart; do
+	if ! echo "$before_restart" | grep -qx "$wid"; then
+		if [ "$wid" != "$main_wid" ]; then
+			SNIPPET_WID="$wid"
+		fi
+	fi
+done
+[ -n "$SNIPPET_WID" ] || fail "snippet not restored"
+
+# Disconnected, but showing the persisted frame instead of grey
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "restored snippet shows last frame" || fail "not red: $color"
+
+echo "test_thumbnail: all assertions passed"
+cleanup
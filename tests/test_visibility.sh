@@ -0,0 +1,37 @@
+#!/bin/bash
+# Test: A hidden snippet drops damage and catches up when shown.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+setup_tmpdir
+start_helper
+out="$TEST_TMPDIR/out"
+start_sniptotop -n > "$out"
+
+create_snippet
+
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "FF0000" "snippet shows red" || fail "not red: $color"
+
+# Hide the snippet, the target's damage object goes away
+xdotool windowunmap --sync "$SNIPPET_WID"
+sleep 0.3
+kill -USR1 "$SNIPTOTOP_PID"
+sleep 0.3
+grep -E '^stats: (views|pixmaps)' "$out" | tail -2 | tr '\n' ' ' |
+	grep -q "hidden 1 .* damage 0 " ||
+	fail "damage kept for hidden snippet: $(grep -E '^stats: (views|pixmaps)' "$out" | tail -2)"
+echo "  ok: no damage object while hidden"
+
+# Helper turns blue while the snippet is hidden
+kill -USR1 "$HELPER_PID"
+sleep 0.3
+
+xdotool windowmap --sync "$SNIPPET_WID"
+sleep 0.5
+color=$(get_pixel_color "$SNIPPET_WID" 5 5)
+assert_eq "$color" "0000FF" "shown snippet caught up" || fail "stale: $color"
+
+echo "test_visibility: all assertions passed"
+cleanup
@@ -0,0 +1,34 @@
+#!/bin/bash
+# Test: -v 2 paces a busy snippet to every second vblank. Xvfb never
+# completes NotifyMSC, so this runs on the 30Hz software timer.
+
+SCRIPT_DIR="$(cd "$(dirname "$0")" && pwd)"
+source "$SCRIPT_DIR/helpers.sh"
+
+flushes() {
+	kill -USR1 "$SNIPTOTOP_PID"
+	sleep 0.3
+	grep '^stats: in flight' "$out" | tail -1 | grep -oP 'flushes \K[0-9]+'
+}
+
+setup_tmpdir
+start_helper -d 5
+out="$TEST_TMPDIR/out"
+start_sniptotop -n -v 2 > "$out"
+
+create_snippet
+# past the 100ms wait for the first MSC completion
+sleep 0.5
+
+first=$(flushes)
+sleep 2
+second=$(flushes)
+# the dumps are 2.3s apart, with the settle after the first one
+rate=$(( (second - first) * 10 / 23 ))
+echo "  $rate flushes/s"
+[ "$rate" -ge 20 ] && [ "$rate" -le 40 ] ||
+	fail "expected about 30 flushes/s at -v 2, got $rate"
+echo "  ok: updates paced to every second vblank"
+
+echo "test_vsync: all assertions passed"
+cleanup
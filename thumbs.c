@@ -0,0 +1,293 @@
+/*
+ * persisted last frames of the views
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "thumbs.h"
+
+#define ALIGN16(x) (((x) + 15) & ~(uint64_t)15)
+
+struct thumb_set {
+	int n;
+	int alloc;
+	struct {
+		char *name;
+		int cap_x, cap_y, cap_w, cap_h;
+		thumb_buf_t *b;
+	} *e;
+};
+
+thumb_buf_t *
+thumb_buf_new(int depth, int width, int height, int stride,
+	const uint8_t *data)
+{
+	thumb_buf_t *b = malloc(sizeof(*b) + (size_t)stride * height);
+
+	if (!b)
+		return NULL;
+	b->refs = 1;
+	b->depth = depth;
+	b->width = width;
+	b->height = height;
+	b->stride = stride;
+	memcpy(b->data, data, (size_t)stride * height);
+	return b;
+}
+
+thumb_buf_t *
+thumb_buf_ref(thumb_buf_t *b)
+{
+	__atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+	return b;
+}
+
+void
+thumb_buf_unref(thumb_buf_t *b)
+{
+	if (b && __atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(b);
+}
+
+thumb_set_t *
+thumb_set_new(void)
+{
+	return calloc(1, sizeof(thumb_set_t));
+}
+
+void
+thumb_set_add(thumb_set_t *ts, const char *name, int cap_x, int cap_y,
+	int cap_w, int cap_h, thumb_buf_t *b)
+{
+	if (ts->n == ts->alloc) {
+		ts->alloc = ts->alloc ? ts->alloc * 2 : 16;
+		ts->e = realloc(ts->e, ts->alloc * sizeof(ts->e[0]));
+		if (!ts->e)
+			abort();
+	}
+	ts->e[ts->n].name = strdup(name);
+	ts->e[ts->n].cap_x = cap_x;
+	ts->e[ts->n].cap_y = cap_y;
+	ts->e[ts->n].cap_w = cap_w;
+	ts->e[ts->n].cap_h = cap_h;
+	ts->e[ts->n].b = thumb_buf_ref(b);
+	ts->n++;
+}
+
+static void
+thumb_set_free(thumb_set_t *ts)
+{
+	for (int i = 0; i < ts->n; i++) {
+		free(ts->e[i].name);
+		thumb_buf_unref(ts->e[i].b);
+	}
+	free(ts->e);
+	free(ts);
+}
+
+static int
+write_thumbs(const char *path, thumb_set_t *ts)
+{
+	char tmp_path[520];
+	thumb_file_header_t hdr = { .count = ts->n };
+	uint64_t off;
+	FILE *f;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	f = fopen(tmp_path, "w");
+	if (!f)
+		return -1;
+
+	memcpy(hdr.magic, THUMB_MAGIC, sizeof(hdr.magic));
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	/* entries, then names, then the aligned pixel data */
+	uint32_t name_off = sizeof(hdr) + ts->n * sizeof(thumb_entry_t);
+	off = name_off;
+	for (int i = 0; i < ts->n; i++)
+		off += strlen(ts->e[i].name);
+	off = ALIGN16(off);
+
+	for (int i = 0; i < ts->n; i++) {
+		thumb_buf_t *b = ts->e[i].b;
+		thumb_entry_t e = {
+			.name_off = name_off,
+			.name_len = strlen(ts->e[i].name),
+			.cap_x = ts->e[i].cap_x,
+			.cap_y = ts->e[i].cap_y,
+			.cap_w = b->width,
+			.cap_h = b->height,
+			.depth = b->depth,
+			.stride = b->stride,
+			.data_off = off,
+		};
+		fwrite(&e, sizeof(e), 1, f);
+		name_off += e.name_len;
+		off = ALIGN16(off + (uint64_t)b->stride * b->height);
+	}
+	for (int i = 0; i < ts->n; i++)
+		fputs(ts->e[i].name, f);
+	for (int i = 0; i < ts->n; i++) {
+		thumb_buf_t *b = ts->e[i].b;
+		fseek(f, ALIGN16(ftell(f)), SEEK_SET);
+		fwrite(b->data, b->stride, b->height, f);
+	}
+
+	if (fclose(f) != 0) {
+		unlink(tmp_path);
+		return -1;
+	}
+	return rename(tmp_path, path);
+}
+
+/*
+ * one writer thread; a newer snapshot replaces one still waiting
+ */
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static int writer_running;
+static int writer_busy;
+static thumb_set_t *writer_next;
+static char writer_path[512];
+
+static void *
+writer_thread(void *arg)
+{
+	pthread_mutex_lock(&writer_lock);
+	while (1) {
+		while (!writer_next)
+			pthread_cond_wait(&writer_cond, &writer_lock);
+		thumb_set_t *ts = writer_next;
+		char path[512];
+		writer_next = NULL;
+		writer_busy = 1;
+		strcpy(path, writer_path);
+		pthread_mutex_unlock(&writer_lock);
+
+		write_thumbs(path, ts);
+		thumb_set_free(ts);
+
+		pthread_mutex_lock(&writer_lock);
+		writer_busy = 0;
+		pthread_cond_broadcast(&writer_cond);
+	}
+	return NULL;
+}
+
+void
+thumbs_write_async(const char *path, thumb_set_t *ts)
+{
+	pthread_t th;
+
+	pthread_mutex_lock(&writer_lock);
+	if (!writer_running) {
+		if (pthread_create(&th, NULL, writer_thread, NULL) != 0) {
+			pthread_mutex_unlock(&writer_lock);
+			write_thumbs(path, ts);
+			thumb_set_free(ts);
+			return;
+		}
+		pthread_detach(th);
+		writer_running = 1;
+	}
+	if (writer_next)
+		thumb_set_free(writer_next);
+	writer_next = ts;
+	snprintf(writer_path, sizeof(writer_path), "%s", path);
+	pthread_cond_broadcast(&writer_cond);
+	pthread_mutex_unlock(&writer_lock);
+}
+
+/*
+ * block until everything handed to the writer is on disk
+ */
+void
+thumbs_wait(void)
+{
+	pthread_mutex_lock(&writer_lock);
+	while (writer_next || writer_busy)
+		pthread_cond_wait(&writer_cond, &writer_lock);
+	pthread_mutex_unlock(&writer_lock);
+}
+
+int
+thumbs_open(thumb_file_t *f, const char *path)
+{
+	struct stat st;
+	int fd;
+
+	f->map = NULL;
+	f->len = 0;
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(thumb_file_header_t)) {
+		close(fd);
+		return -1;
+	}
+	f->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (f->map == MAP_FAILED) {
+		f->map = NULL;
+		return -1;
+	}
+	f->len = st.st_size;
+
+	const thumb_file_header_t *hdr = f->map;
+	if (memcmp(hdr->magic, THUMB_MAGIC, sizeof(hdr->magic)) != 0 ||
+	    sizeof(*hdr) + (uint64_t)hdr->count * sizeof(thumb_entry_t) >
+	    f->len) {
+		thumbs_close(f);
+		return -1;
+	}
+	return 0;
+}
+
+const thumb_entry_t *
+thumbs_find(thumb_file_t *f, const char *name, int cap_x, int cap_y,
+	int cap_w, int cap_h)
+{
+	const thumb_file_header_t *hdr = f->map;
+	const thumb_entry_t *e;
+	size_t name_len = strlen(name);
+
+	if (!f->map)
+		return NULL;
+
+	e = (const thumb_entry_t *)(hdr + 1);
+	for (uint32_t i = 0; i < hdr->count; i++, e++) {
+		if (e->name_len != name_len ||
+		    e->cap_x != cap_x || e->cap_y != cap_y ||
+		    e->cap_w != cap_w || e->cap_h != cap_h)
+			continue;
+		if ((uint64_t)e->name_off + e->name_len > f->len ||
+		    e->data_off + (uint64_t)e->stride * e->cap_h > f->len)
+			continue;
+		if (memcmp((const char *)f->map + e->name_off, name,
+		    name_len) != 0)
+			continue;
+		return e;
+	}
+	return NULL;
+}
+
+const uint8_t *
+thumbs_data(thumb_file_t *f, const thumb_entry_t *e)
+{
+	return (const uint8_t *)f->map + e->data_off;
+}
+
+void
+thumbs_close(thumb_file_t *f)
+{
+	if (f->map)
+		munmap(f->map, f->len);
+	f->map = NULL;
+	f->len = 0;
+}
@@ -0,0 +1,68 @@
+#ifndef THUMBS_H
+#define THUMBS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Last frames of the views, stored next to the state file so restored
+ * snips can show content before their target is back. The file is a
+ * header, a table of fixed-size entries and the raw ZPixmap data of
+ * each frame, 16-byte aligned, so it can be used straight from mmap.
+ */
+#define THUMB_MAGIC "STTHUMB1"
+
+typedef struct {
+	char magic[8];
+	uint32_t count;
+	uint32_t reserved;
+} thumb_file_header_t;
+
+typedef struct {
+	uint32_t name_off;
+	uint32_t name_len;
+	int32_t cap_x;
+	int32_t cap_y;
+	int32_t cap_w;
+	int32_t cap_h;
+	uint32_t depth;
+	uint32_t stride;
+	uint64_t data_off;
+} thumb_entry_t;
+
+/* immutable, refcounted frame, shared between a view and the writer */
+typedef struct {
+	int refs;
+	int depth;
+	int width;
+	int height;
+	int stride;
+	uint8_t data[];
+} thumb_buf_t;
+
+thumb_buf_t *thumb_buf_new(int depth, int width, int height, int stride,
+	const uint8_t *data);
+thumb_buf_t *thumb_buf_ref(thumb_buf_t *b);
+void thumb_buf_unref(thumb_buf_t *b);
+
+/* a snapshot of all frames, handed to the background writer */
+typedef struct thumb_set thumb_set_t;
+
+thumb_set_t *thumb_set_new(void);
+void thumb_set_add(thumb_set_t *ts, const char *name, int cap_x, int cap_y,
+	int cap_w, int cap_h, thumb_buf_t *b);
+void thumbs_write_async(const char *path, thumb_set_t *ts);
+void thumbs_wait(void);
+
+typedef struct {
+	void *map;
+	size_t len;
+} thumb_file_t;
+
+int thumbs_open(thumb_file_t *f, const char *path);
+const thumb_entry_t *thumbs_find(thumb_file_t *f, const char *name,
+	int cap_x, int cap_y, int cap_w, int cap_h);
+const uint8_t *thumbs_data(thumb_file_t *f, const thumb_entry_t *e);
+void thumbs_close(thumb_file_t *f);
+
+#endif